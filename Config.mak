@@ -17,6 +17,12 @@ CC = cc
 DEBUG = yes
 PROFILE = no
 
+#
+# SIMD instruction set (avx2/sse/no)
+#
+
+SIMD = sse
+
 #
 # BLAS
 #
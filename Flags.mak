@@ -8,6 +8,16 @@ else
   REAL = -DREAL=double
 endif
 
+ifeq ($(SIMD),avx2)
+  SIMD = -mavx2
+else
+  ifeq ($(SIMD),sse)
+    SIMD =
+  else
+    SIMD = -DNOSIMD
+  endif
+endif
+
 ifeq ($(OPENGL),yes)
   ifeq ($(VBO),yes)
     OPENGL = -DOPENGL -DVBO $(GLINC)
@@ -0,0 +1,142 @@
+/*
+ * arena.c
+ * -------
+ * bump allocation from per worker chunk lists, released all at once
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "arena.h"
+#include "error.h"
+
+#define CHUNK (1 << 16) /* default chunk size */
+
+#define ALIGN 16 /* allocation alignment */
+
+struct chunk
+{
+  struct chunk *next;
+
+  size_t size, used;
+
+  char data [];
+};
+
+struct worker /* worker chunk list; padded against false sharing */
+{
+  struct chunk *chunk;
+
+  long allocations;
+
+  size_t bytes; /* chunk memory */
+
+  char pad [64 - sizeof (struct chunk*) - sizeof (long) - sizeof (size_t)];
+};
+
+struct arena
+{
+  struct worker *worker;
+
+  int workers;
+};
+
+/* create arena with per worker chunks */
+struct arena* arena_create (int workers)
+{
+  struct arena *arena;
+
+  ERRMEM (arena = calloc (1, sizeof (struct arena)));
+
+  arena_workers (arena, workers);
+
+  return arena;
+}
+
+/* make sure the arena serves a number of workers; not to be called while allocating */
+void arena_workers (struct arena *arena, int workers)
+{
+  if (workers <= arena->workers) return;
+
+  ERRMEM (arena->worker = realloc (arena->worker, workers * sizeof (struct worker)));
+
+  for (int i = arena->workers; i < workers; i ++)
+  {
+    arena->worker[i].chunk = NULL;
+    arena->worker[i].allocations = 0;
+    arena->worker[i].bytes = 0;
+  }
+
+  arena->workers = workers;
+}
+
+/* return zeroed memory from a worker's chunk */
+void* arena_alloc (struct arena *arena, int worker, size_t size)
+{
+  struct worker *w = &arena->worker [worker];
+  struct chunk *c = w->chunk;
+  void *out;
+
+  size = (size + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+
+  if (!c || c->used + size > c->size)
+  {
+    size_t n = size > CHUNK ? size : CHUNK;
+
+    ERRMEM (c = calloc (1, sizeof (struct chunk) + n + ALIGN));
+    c->used = (ALIGN - ((size_t) c->data & (ALIGN - 1))) & (ALIGN - 1); /* align the first block */
+    c->size = c->used + n;
+    c->next = w->chunk;
+    w->chunk = c;
+    w->bytes += sizeof (struct chunk) + n + ALIGN;
+  }
+
+  out = c->data + c->used;
+  c->used += size;
+  w->allocations ++;
+
+  return out;
+}
+
+/* return number of chunks and of allocations */
+void arena_stats (struct arena *arena, long *chunks, long *allocations)
+{
+  struct chunk *c;
+
+  *chunks = *allocations = 0;
+
+  for (int i = 0; i < arena->workers; i ++)
+  {
+    for (c = arena->worker[i].chunk; c; c = c->next) (*chunks) ++;
+    *allocations += arena->worker[i].allocations;
+  }
+}
+
+/* return chunk memory held by a worker or by all workers if the worker is negative */
+size_t arena_bytes (struct arena *arena, int worker)
+{
+  size_t bytes = 0;
+
+  if (worker >= 0) return arena->worker[worker].bytes;
+
+  for (int i = 0; i < arena->workers; i ++) bytes += arena->worker[i].bytes;
+
+  return bytes;
+}
+
+/* free all arena memory */
+void arena_destroy (struct arena *arena)
+{
+  struct chunk *c, *next;
+
+  for (int i = 0; i < arena->workers; i ++)
+  {
+    for (c = arena->worker[i].chunk; c; c = next)
+    {
+      next = c->next;
+      free (c);
+    }
+  }
+
+  free (arena->worker);
+  free (arena);
+}
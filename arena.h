@@ -0,0 +1,31 @@
+/*
+ * arena.h
+ * -------
+ */
+
+#include <stddef.h>
+
+#ifndef __arena__
+#define __arena__
+
+struct arena;
+
+/* create arena with per worker chunks */
+struct arena* arena_create (int workers);
+
+/* make sure the arena serves a number of workers; not to be called while allocating */
+void arena_workers (struct arena *arena, int workers);
+
+/* return zeroed memory from a worker's chunk */
+void* arena_alloc (struct arena *arena, int worker, size_t size);
+
+/* return number of chunks and of allocations */
+void arena_stats (struct arena *arena, long *chunks, long *allocations);
+
+/* return chunk memory held by a worker or by all workers if the worker is negative */
+size_t arena_bytes (struct arena *arena, int worker);
+
+/* free all arena memory */
+void arena_destroy (struct arena *arena);
+
+#endif
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# bench.py
+# --------
+# run inp/*.py scenes and inp/part.stl headless at several cutoffs, record timings and geometry and compare them with a baseline
+#
+
+import argparse, csv, glob, json, os, re, shutil, struct, subprocess, sys, tempfile, time
+
+HERE = os.path.dirname (os.path.abspath (__file__))
+ROOT = os.path.dirname (HERE)
+
+# wrapper running a scene with its cutoffs scaled and its output redirected
+WRAPPER = """_SIMULATION = SIMULATION
+def SIMULATION (outpath, duration, step, cutoff):
+  return _SIMULATION (%r, duration, step, cutoff * %r)
+exec (compile (open (%r).read (), %r, 'exec'))
+"""
+
+# scene meshing an STL file as a single MESH leaf
+STLSCENE = """simu = SIMULATION ('out/part', 1.0, 0.001, 1.0)
+DOMAIN (simu, MESH (%r, 1))
+"""
+
+FIELDS = ['scene', 'scale', 'wall', 'mesh', 'rss', 'triangles', 'area']
+
+def stl_geometry (path):
+  """return triangle count and area of a binary STL file"""
+  with open (path, 'rb') as f:
+    data = f.read ()
+  n = struct.unpack_from ('<I', data, 80)[0]
+  area = 0.0
+  for i in range (n):
+    v = struct.unpack_from ('<9f', data, 84 + 50*i + 12)
+    a = (v[3]-v[0], v[4]-v[1], v[5]-v[2])
+    b = (v[6]-v[0], v[7]-v[1], v[8]-v[2])
+    c = (a[1]*b[2]-a[2]*b[1], a[2]*b[0]-a[0]*b[2], a[0]*b[1]-a[1]*b[0])
+    area += 0.5 * (c[0]*c[0] + c[1]*c[1] + c[2]*c[2]) ** 0.5
+  return n, area
+
+def run (binary, scene, path, scale, work, threads, stats = False):
+  """mesh a scene once and return its record; stats runs instrumented and records phase timings instead"""
+  out = os.path.join (work, 'out')
+  shutil.rmtree (out, ignore_errors = True)
+  wrapper = os.path.join (work, 'scene.py')
+  with open (wrapper, 'w') as f:
+    f.write (WRAPPER % (out, scale, path, path))
+  cmd = [binary, wrapper, '--threads', str (threads)]
+  if stats:
+    cmd += ['--stats-json', os.path.join (work, 'stats.json')]
+  log = os.path.join (work, 'log.txt')
+  with open (log, 'w+') as f:
+    t = time.perf_counter ()
+    p = subprocess.Popen (cmd, cwd = ROOT, stdout = f, stderr = subprocess.STDOUT)
+    _, status, usage = os.wait4 (p.pid, 0)
+    wall = time.perf_counter () - t
+    f.seek (0)
+    text = f.read ()
+  m = re.search (r'initialized in (\S+) s', text)
+  if status != 0 or m is None:
+    sys.exit ('%s failed:\n%s' % (scene, text))
+  if stats:
+    with open (os.path.join (work, 'stats.json')) as f:
+      return {x['name']: x['seconds'] for x in json.load (f)['phases']}
+  triangles, area = 0, 0.0
+  for stl in sorted (glob.glob (os.path.join (out, '*.stl'))):
+    n, a = stl_geometry (stl)
+    triangles += n
+    area += a
+  return {'scene': scene, 'scale': scale, 'wall': wall, 'mesh': float (m.group (1)),
+          'rss': usage.ru_maxrss * 1024, 'triangles': triangles, 'area': area}
+
+def compare (results, baseline, args):
+  """print differences from a baseline and return the number of flagged cases"""
+  old = {(r['scene'], r['scale']): r for r in baseline}
+  flagged = 0
+  for r in results:
+    b = old.get ((r['scene'], r['scale']))
+    if b is None:
+      print ('%-24s x%-5g new, not in baseline' % (r['scene'], r['scale']))
+      continue
+    notes = []
+    if r['triangles'] != b['triangles']:
+      notes.append ('GEOMETRY triangles %d -> %d' % (b['triangles'], r['triangles']))
+    if abs (r['area'] - b['area']) > args.area * max (abs (b['area']), 1E-30):
+      notes.append ('GEOMETRY area %.9g -> %.9g' % (b['area'], r['area']))
+    for key in ('mesh', 'wall'):
+      if r[key] > b[key] * (1.0 + args.time) and r[key] - b[key] > args.floor:
+        notes.append ('SLOWER %s %.3f -> %.3f s (%+.0f%%)' % (key, b[key], r[key], 100.0 * (r[key] / b[key] - 1.0)))
+    if r['rss'] > b['rss'] * (1.0 + args.memory):
+      notes.append ('MEMORY rss %.1f -> %.1f MB' % (b['rss'] / 1048576.0, r['rss'] / 1048576.0))
+    for key in ('mesh', 'wall'):
+      if r[key] < b[key] * (1.0 - args.time) and b[key] - r[key] > args.floor:
+        notes.append ('faster %s %.3f -> %.3f s (%+.0f%%)' % (key, b[key], r[key], 100.0 * (r[key] / b[key] - 1.0)))
+    flagged += any (x.split ()[0].isupper () for x in notes)
+    print ('%-24s x%-5g %s' % (r['scene'], r['scale'], '; '.join (notes) if notes else 'ok'))
+  return flagged
+
+def main ():
+  parser = argparse.ArgumentParser (description = 'oaktree benchmark suite')
+  parser.add_argument ('--binary', default = os.path.join (ROOT, 'oaktree'))
+  parser.add_argument ('--scales', default = '2,1,0.5', help = 'cutoff multipliers applied to every scene')
+  parser.add_argument ('--repeat', type = int, default = 3, help = 'runs per case; the fastest is kept')
+  parser.add_argument ('--threads', type = int, default = 1)
+  parser.add_argument ('--baseline', default = os.path.join (HERE, 'baseline.json'))
+  parser.add_argument ('--output', default = os.path.join (ROOT, 'out', 'bench'), help = 'directory of results.csv and results.json')
+  parser.add_argument ('--stats', action = 'store_true', help = 'add a separate instrumented run per case recording phase timings')
+  parser.add_argument ('--save', action = 'store_true', help = 'store results as the new baseline')
+  parser.add_argument ('--time', type = float, default = 0.10, help = 'relative slowdown flagged as a regression')
+  parser.add_argument ('--floor', type = float, default = 0.05, help = 'absolute slowdown in seconds below which timings are noise')
+  parser.add_argument ('--memory', type = float, default = 0.10, help = 'relative peak RSS growth flagged as a regression')
+  parser.add_argument ('--area', type = float, default = 1E-6, help = 'relative surface area drift flagged as a geometry change')
+  parser.add_argument ('scenes', nargs = '*', help = 'scene scripts or STL files; inp/*.py and inp/*.stl by default')
+  args = parser.parse_args ()
+
+  scenes = args.scenes or sorted (glob.glob (os.path.join (ROOT, 'inp', '*.py')) + glob.glob (os.path.join (ROOT, 'inp', '*.stl')))
+  scales = [float (x) for x in args.scales.split (',')]
+  work = tempfile.mkdtemp (prefix = 'oaktree-bench-')
+  results = []
+
+  try:
+    for scene in scenes:
+      path = os.path.abspath (scene)
+      name = os.path.relpath (path, ROOT)
+      if path.endswith ('.stl'):
+        script = os.path.join (work, os.path.basename (path) + '.py')
+        with open (script, 'w') as f:
+          f.write (STLSCENE % path)
+        path = script
+      for scale in scales:
+        runs = [run (args.binary, name, path, scale, work, args.threads) for i in range (max (args.repeat, 1))]
+        best = min (runs, key = lambda r: r['mesh'])
+        best['wall'] = min (r['wall'] for r in runs)
+        best['rss'] = min (r['rss'] for r in runs)
+        if args.stats:
+          best['phases'] = run (args.binary, name, path, scale, work, args.threads, True)
+        results.append (best)
+        print ('%-24s x%-5g wall %8.3f s  mesh %8.3f s  rss %7.1f MB  triangles %9d  area %.6g' %
+               (name, scale, best['wall'], best['mesh'], best['rss'] / 1048576.0, best['triangles'], best['area']))
+        sys.stdout.flush ()
+  finally:
+    shutil.rmtree (work, ignore_errors = True)
+
+  os.makedirs (args.output, exist_ok = True)
+  with open (os.path.join (args.output, 'results.csv'), 'w', newline = '') as f:
+    w = csv.DictWriter (f, fieldnames = FIELDS, extrasaction = 'ignore')
+    w.writeheader ()
+    w.writerows (results)
+  with open (os.path.join (args.output, 'results.json'), 'w') as f:
+    json.dump (results, f, indent = 1)
+
+  if args.save:
+    with open (args.baseline, 'w') as f:
+      json.dump (results, f, indent = 1)
+    print ('Baseline saved to %s' % os.path.relpath (args.baseline, ROOT))
+    return 0
+
+  if not os.path.exists (args.baseline):
+    print ('No baseline at %s; run make bench-baseline to store one' % os.path.relpath (args.baseline, ROOT))
+    return 0
+
+  with open (args.baseline) as f:
+    flagged = compare (results, json.load (f), args)
+
+  if flagged:
+    print ('%d case(s) with regressions or geometry changes against the baseline' % flagged)
+    return 1
+
+  print ('No regressions against the baseline')
+  return 0
+
+if __name__ == '__main__':
+  sys.exit (main ())
@@ -0,0 +1,87 @@
+/*
+ * polygon.c
+ * ---------
+ * micro-benchmark of polygonise and polygonise_shared on the cells of a perturbed sphere field
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "../polygon.h"
+#include "../timer.h"
+#include "../error.h"
+
+#define N 48 /* cells per grid side */
+
+#define R 20 /* repetitions */
+
+/* grid cell corner offsets in polygonise order */
+static const int corner [8][3] = {{0,0,0},{0,1,0},{1,1,0},{1,0,0},{0,0,1},{0,1,1},{1,1,1},{1,0,1}};
+
+int main (void)
+{
+  unsigned long long (*key) [8];
+  REAL (*p) [8][3], (*v) [8], (*t) [5][3][3], h = 2.0 / N, *q;
+  int m = N*N*N, i, j, k, r, x [3], total [2];
+  struct edges *edges;
+  struct timing timing;
+  double time [2];
+
+  ERRMEM (p = malloc (m * sizeof (REAL [8][3])));
+  ERRMEM (v = malloc (m * sizeof (REAL [8])));
+  ERRMEM (t = malloc (m * sizeof (REAL [5][3][3])));
+  ERRMEM (key = malloc (m * sizeof (unsigned long long [8])));
+
+  for (i = 0; i < m; i ++)
+  {
+    x[0] = i % N;
+    x[1] = (i / N) % N;
+    x[2] = i / (N*N);
+
+    for (j = 0; j < 8; j ++)
+    {
+      q = p[i][j];
+
+      for (k = 0; k < 3; k ++) q[k] = -1.0 + h * (x[k] + corner[j][k]);
+
+      v[i][j] = sqrt (q[0]*q[0] + q[1]*q[1] + q[2]*q[2]) - 0.8 + 0.1*sin (7.0*q[0])*sin (5.0*q[1]);
+
+      key[i][j] = 1 + (((unsigned long long) (x[0] + corner[j][0]) << 42) |
+	               ((unsigned long long) (x[1] + corner[j][1]) << 21) | (unsigned long long) (x[2] + corner[j][2]));
+    }
+  }
+
+  timerstart (&timing);
+
+  for (r = 0; r < R; r ++)
+  {
+    for (total [0] = i = 0; i < m; i ++) total [0] += polygonise (p[i], v[i], 0.0, 1E-6, t[i]);
+  }
+
+  time [0] = timerend (&timing);
+
+  timerstart (&timing);
+
+  for (r = 0; r < R; r ++) /* the cache is rebuilt every repetition, as per refinement */
+  {
+    edges = edges_create ();
+
+    for (total [1] = i = 0; i < m; i ++) total [1] += polygonise_shared (edges, NULL, key[i], p[i], v[i], 0.0, 1E-6, t[i]);
+
+    edges_destroy (edges);
+  }
+
+  time [1] = timerend (&timing);
+
+  printf ("%d cells, %d triangles, x%d: polygonise %.4f s, polygonise_shared %.4f s%s\n",
+          m, total [0], R, time [0], time [1], total [0] == total [1] ? "" : " (TRIANGLE COUNTS DIFFER)");
+
+  free (p);
+  free (v);
+  free (t);
+  free (key);
+
+  return total [0] != total [1];
+}
@@ -0,0 +1,155 @@
+/*
+ * capture.c
+ * ---------
+ * bounded frame queue drained into an avi file by a writer thread,
+ * so that encoding and disk output overlap with rendering
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "capture.h"
+#include "image.h"
+#include "error.h"
+
+struct capture
+{
+  struct avi *avi;
+
+  int width, height;
+
+  void **frame; /* ring of frame buffers */
+
+  int size, head, count, fill; /* ring size, oldest queued frame, queued frames, frame being filled or -1 */
+
+  int full, quit; /* times the producer waited and stop flag */
+
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+
+  pthread_cond_t queued, written;
+};
+
+/* writer thread loop */
+static void* writer (void *data)
+{
+  struct capture *capture = data;
+  void *rgb;
+
+  pthread_mutex_lock (&capture->lock);
+
+  for (;;)
+  {
+    while (capture->count == 0 && !capture->quit) pthread_cond_wait (&capture->queued, &capture->lock);
+
+    if (capture->count == 0) break;
+
+    rgb = capture->frame [capture->head];
+
+    pthread_mutex_unlock (&capture->lock);
+
+    avi_frame (capture->avi, rgb); /* the frame stays queued, and so untouched by the producer, until written */
+
+    pthread_mutex_lock (&capture->lock);
+
+    capture->head = (capture->head + 1) % capture->size;
+    capture->count --;
+
+    pthread_cond_signal (&capture->written);
+  }
+
+  pthread_mutex_unlock (&capture->lock);
+
+  return NULL;
+}
+
+/* open an avi movie written by a background thread from a queue of a given number of frames;
+ * frames are JPEG compressed for quality in 1..100 or uncompressed for zero */
+struct capture* capture_open (int width, int height, int fps, int quality, int frames, const char *path)
+{
+  struct capture *capture;
+  int i;
+
+  ERRMEM (capture = calloc (1, sizeof (struct capture)));
+  capture->avi = avi_open (width, height, fps, quality, path);
+  capture->width = width;
+  capture->height = height;
+  capture->size = frames > 2 ? frames : 2;
+  capture->fill = -1;
+
+  ERRMEM (capture->frame = malloc (capture->size * sizeof (void*)));
+  for (i = 0; i < capture->size; i ++) capture->frame [i] = rgb_alloc (width, height);
+
+  pthread_mutex_init (&capture->lock, NULL);
+  pthread_cond_init (&capture->queued, NULL);
+  pthread_cond_init (&capture->written, NULL);
+  ASSERT (pthread_create (&capture->thread, NULL, writer, capture) == 0, "Creating capture thread has failed!");
+
+  return capture;
+}
+
+/* return a free RGB frame buffer, waiting while the queue is full */
+void* capture_buffer (struct capture *capture)
+{
+  pthread_mutex_lock (&capture->lock);
+
+  if (capture->count == capture->size) capture->full ++;
+
+  while (capture->count == capture->size) pthread_cond_wait (&capture->written, &capture->lock);
+
+  capture->fill = (capture->head + capture->count) % capture->size;
+
+  pthread_mutex_unlock (&capture->lock);
+
+  return capture->frame [capture->fill];
+}
+
+/* queue the frame buffer returned by capture_buffer for writing */
+void capture_submit (struct capture *capture)
+{
+  pthread_mutex_lock (&capture->lock);
+
+  ASSERT (capture->fill >= 0, "No capture buffer to submit!");
+
+  capture->count ++;
+  capture->fill = -1;
+
+  pthread_cond_signal (&capture->queued);
+
+  pthread_mutex_unlock (&capture->lock);
+}
+
+/* return movie frame width and height */
+void capture_sizes (struct capture *capture, int *width, int *height)
+{
+  *width = capture->width;
+  *height = capture->height;
+}
+
+/* write queued frames, close the movie and return the number of times the queue was full */
+int capture_close (struct capture *capture)
+{
+  int i, full;
+
+  pthread_mutex_lock (&capture->lock);
+  capture->quit = 1;
+  pthread_cond_signal (&capture->queued);
+  pthread_mutex_unlock (&capture->lock);
+
+  pthread_join (capture->thread, NULL);
+
+  avi_close (capture->avi);
+
+  for (i = 0; i < capture->size; i ++) rgb_free (capture->frame [i]);
+  free (capture->frame);
+
+  pthread_mutex_destroy (&capture->lock);
+  pthread_cond_destroy (&capture->queued);
+  pthread_cond_destroy (&capture->written);
+
+  full = capture->full;
+  free (capture);
+
+  return full;
+}
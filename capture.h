@@ -0,0 +1,27 @@
+/*
+ * capture.h
+ * ---------
+ */
+
+#ifndef __capture__
+#define __capture__
+
+struct capture;
+
+/* open an avi movie written by a background thread from a queue of a given number of frames;
+ * frames are JPEG compressed for quality in 1..100 or uncompressed for zero */
+struct capture* capture_open (int width, int height, int fps, int quality, int frames, const char *path);
+
+/* return a free RGB frame buffer, waiting while the queue is full */
+void* capture_buffer (struct capture *capture);
+
+/* queue the frame buffer returned by capture_buffer for writing */
+void capture_submit (struct capture *capture);
+
+/* return movie frame width and height */
+void capture_sizes (struct capture *capture, int *width, int *height);
+
+/* write queued frames, close the movie and return the number of times the queue was full */
+int capture_close (struct capture *capture);
+
+#endif
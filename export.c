@@ -0,0 +1,458 @@
+/*
+ * export.c
+ * --------
+ * streaming mesh output of domain boundaries
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include "export.h"
+#include "mesh.h"
+#include "error.h"
+#include "alg.h"
+
+#define BUFFER_SIZE (1 << 20) /* bytes buffered between writes */
+
+struct output /* buffered binary file */
+{
+  FILE *file;
+
+  char *buffer;
+
+  size_t used, bytes;
+};
+
+/* open output; a temporary file without a path */
+static void output_open (struct output *out, const char *path)
+{
+  if (path) ASSERT (out->file = fopen (path, "wb"), "Opening %s for writing has failed", path);
+  else ASSERT (out->file = tmpfile (), "Opening a temporary file has failed");
+  ERRMEM (out->buffer = malloc (BUFFER_SIZE));
+  out->used = out->bytes = 0;
+}
+
+/* write buffered data */
+static void output_flush (struct output *out)
+{
+  ASSERT (fwrite (out->buffer, 1, out->used, out->file) == out->used, "Writing output has failed");
+  out->bytes += out->used;
+  out->used = 0;
+}
+
+/* append bytes */
+static void output_write (struct output *out, const void *data, size_t size)
+{
+  if (out->used + size > BUFFER_SIZE) output_flush (out);
+
+  memcpy (out->buffer + out->used, data, size);
+  out->used += size;
+}
+
+/* overwrite bytes already written at an offset */
+static void output_patch (struct output *out, long offset, const void *data, size_t size)
+{
+  output_flush (out);
+  ASSERT (fseek (out->file, offset, SEEK_SET) == 0 && fwrite (data, 1, size, out->file) == size &&
+    fseek (out->file, 0, SEEK_END) == 0, "Writing output has failed");
+}
+
+/* close output and return bytes written */
+static size_t output_close (struct output *out)
+{
+  output_flush (out);
+  ASSERT (fclose (out->file) == 0, "Closing output has failed");
+  free (out->buffer);
+  return out->bytes;
+}
+
+/* test whether a face belongs to the domain boundary; a NULL domain stands for all domains */
+static int boundary (struct cell *cell, struct face *face, struct domain *domain)
+{
+  return face->leaf && (!domain || cell->domain == domain);
+}
+
+/* write STL records and count them */
+static void stl_records (struct output *out, struct octree *octree, struct mesh *mesh, struct domain *domain, long *n)
+{
+  char record [50] = {0}; /* normal, three vertices and a zero attribute */
+  struct cell *cell;
+  struct face *face;
+  float v [12];
+  int i, j, k;
+
+  if (octree->down [0])
+  {
+    for (i = 0; i < 8; i ++) stl_records (out, octree->down [i], mesh, domain, n);
+  }
+
+  for (cell = octree->cell; cell; cell = cell->next)
+  {
+    for (face = cell->face; face; face = face->next)
+    {
+      if (!boundary (cell, face, domain)) continue;
+
+      for (k = 0; k < 3; k ++) v [k] = face->normal [k];
+
+      for (i = 0; i < face->n; i ++)
+      {
+	for (j = 0; j < 3; j ++)
+	{
+	  REAL *p = mesh_point (mesh, FACE_VERTEX (face, i, j));
+	  for (k = 0; k < 3; k ++) v [3+3*j+k] = p [k];
+	}
+
+	memcpy (record, v, sizeof (v));
+	output_write (out, record, sizeof (record));
+      }
+
+      *n += face->n;
+    }
+  }
+}
+
+/* stream domain boundary faces to a binary STL file and return bytes written */
+size_t export_stl (struct octree *octree, struct domain *domain, const char *path)
+{
+  char header [80] = "oaktree";
+  uint32_t count = 0;
+  struct output out;
+  long n = 0;
+
+  output_open (&out, path);
+  output_write (&out, header, sizeof (header));
+  output_write (&out, &count, sizeof (count)); /* patched once known */
+  stl_records (&out, octree, octree->mesh, domain, &n);
+
+  ASSERT (n <= UINT32_MAX, "Too many triangles for STL output");
+
+  count = (uint32_t) n;
+  output_patch (&out, sizeof (header), &count, sizeof (count));
+
+  return output_close (&out);
+}
+
+/* number used vertices in order of first use, write them in that order and count triangles */
+static void ply_vertices (struct output *out, struct octree *octree, struct domain *domain, int *map, int *n, long *m)
+{
+  struct cell *cell;
+  struct face *face;
+  int i, j, v;
+
+  if (octree->down [0])
+  {
+    for (i = 0; i < 8; i ++) ply_vertices (out, octree->down [i], domain, map, n, m);
+  }
+
+  for (cell = octree->cell; cell; cell = cell->next)
+  {
+    for (face = cell->face; face; face = face->next)
+    {
+      if (!boundary (cell, face, domain)) continue;
+
+      for (i = 0; i < face->n; i ++)
+      {
+	for (j = 0; j < 3; j ++)
+	{
+	  v = FACE_VERTEX (face, i, j);
+
+	  if (!map [v])
+	  {
+	    output_write (out, mesh_point (octree->mesh, v), sizeof (REAL [3]));
+	    map [v] = ++ (*n);
+	  }
+	}
+      }
+
+      *m += face->n;
+    }
+  }
+}
+
+/* write PLY faces */
+static void ply_faces (struct output *out, struct octree *octree, struct domain *domain, int *map)
+{
+  char record [1 + sizeof (int [3])] = {3}; /* vertex count and indices */
+  struct cell *cell;
+  struct face *face;
+  int i, j, v [3];
+
+  if (octree->down [0])
+  {
+    for (i = 0; i < 8; i ++) ply_faces (out, octree->down [i], domain, map);
+  }
+
+  for (cell = octree->cell; cell; cell = cell->next)
+  {
+    for (face = cell->face; face; face = face->next)
+    {
+      if (!boundary (cell, face, domain)) continue;
+
+      for (i = 0; i < face->n; i ++)
+      {
+	for (j = 0; j < 3; j ++) v [j] = map [FACE_VERTEX (face, i, j)] - 1;
+
+	memcpy (record + 1, v, sizeof (v));
+	output_write (out, record, sizeof (record));
+      }
+    }
+  }
+}
+
+/* PLY header with counts padded to a fixed width so that they can be patched */
+static int ply_header (char *header, size_t size, long n, long m)
+{
+  const char *type = sizeof (REAL) == sizeof (double) ? "double" : "float";
+
+  return snprintf (header, size, "ply\nformat binary_little_endian 1.0\ncomment oaktree\n"
+    "element vertex %-20ld\nproperty %s x\nproperty %s y\nproperty %s z\n"
+    "element face %-20ld\nproperty list uchar int vertex_indices\nend_header\n", n, type, type, type, m);
+}
+
+/* stream domain boundary faces to an indexed binary PLY file and return bytes written */
+size_t export_ply (struct octree *octree, struct domain *domain, const char *path)
+{
+  struct mesh *mesh = octree->mesh;
+  char header [256];
+  struct output out;
+  int *map, n = 0;
+  long m = 0;
+
+  ERRMEM (map = calloc (mesh->count > 0 ? mesh->count : 1, sizeof (int))); /* vertex numbers plus one */
+
+  output_open (&out, path);
+  output_write (&out, header, ply_header (header, sizeof (header), 0, 0));
+  ply_vertices (&out, octree, domain, map, &n, &m);
+  ply_faces (&out, octree, domain, map);
+  output_patch (&out, 0, header, ply_header (header, sizeof (header), n, m));
+
+  free (map);
+
+  return output_close (&out);
+}
+
+struct frontier /* streamed PLY vertices that later subtrees may share */
+{
+  REAL p [3];
+
+  int index; /* index plus one; zero marks empty entries */
+};
+
+struct export /* streaming output of one domain */
+{
+  struct domain *domain;
+
+  struct output stl, ply, faces; /* PLY faces are spilled until all vertices are written */
+
+  REAL margin; /* subtrees share vertices within this distance from their boundaries */
+
+  struct frontier *frontier; /* open addressing table */
+
+  int size, count; /* size is a power of two */
+
+  int vertices;
+
+  long triangles;
+};
+
+/* frontier slot of a point */
+static struct frontier* frontier_slot (struct frontier *table, int size, REAL p [3])
+{
+  int i = mesh_hash (p) & (size - 1);
+
+  while (table[i].index && memcmp (table[i].p, p, sizeof (REAL [3]))) i = (i + 1) & (size - 1); /* linear probing */
+
+  return &table [i];
+}
+
+/* rebuild frontier table of a given size, dropping points strictly inside of the extents shrunk by the margin */
+static void frontier_rebuild (struct export *export, int size, REAL *extents)
+{
+  struct frontier *old = export->frontier, *f, *g;
+  REAL *e = extents, d = export->margin;
+  int n = export->size;
+
+  ERRMEM (export->frontier = calloc (size, sizeof (struct frontier)));
+  export->size = size;
+  export->count = 0;
+
+  for (f = old; f < old + n; f ++)
+  {
+    if (!f->index) continue;
+
+    if (e && f->p[0] > e[0]+d && f->p[0] < e[3]-d && f->p[1] > e[1]+d && f->p[1] < e[4]-d && f->p[2] > e[2]+d && f->p[2] < e[5]-d) continue;
+
+    g = frontier_slot (export->frontier, size, f->p);
+    *g = *f;
+    export->count ++;
+  }
+
+  free (old);
+}
+
+/* open streaming STL and PLY output of a domain; subtrees share vertices within a margin from their boundaries */
+struct export* export_open (struct domain *domain, const char *stl, const char *ply, REAL margin)
+{
+  struct export *export;
+  char header [256];
+
+  ERRMEM (export = calloc (1, sizeof (struct export)));
+  export->domain = domain;
+  export->margin = margin;
+  export->size = 1024;
+  ERRMEM (export->frontier = calloc (export->size, sizeof (struct frontier)));
+
+  memset (header, 0, 84);
+  strcpy (header, "oaktree");
+  output_open (&export->stl, stl);
+  output_write (&export->stl, header, 84); /* header and triangle count patched at closing */
+
+  output_open (&export->ply, ply);
+  output_write (&export->ply, header, ply_header (header, sizeof (header), 0, 0));
+  output_open (&export->faces, NULL);
+
+  return export;
+}
+
+/* write boundary triangles of a subtree and its PLY vertices, spilling PLY faces */
+static void export_triangles (struct export *export, struct octree *octree, struct mesh *mesh, REAL *e, int *map)
+{
+  char record [1 + sizeof (int [3])] = {3};
+  REAL d = export->margin, *p;
+  struct frontier *f;
+  struct cell *cell;
+  struct face *face;
+  int i, j, v [3];
+  long n = 0;
+
+  if (octree->down [0])
+  {
+    for (i = 0; i < 8; i ++) export_triangles (export, octree->down [i], mesh, e, map);
+  }
+
+  for (cell = octree->cell; cell; cell = cell->next)
+  {
+    for (face = cell->face; face; face = face->next)
+    {
+      if (!boundary (cell, face, export->domain)) continue;
+
+      for (i = 0; i < face->n; i ++)
+      {
+	for (j = 0; j < 3; j ++)
+	{
+	  v [j] = FACE_VERTEX (face, i, j);
+
+	  if (!map [v[j]])
+	  {
+	    p = mesh_point (mesh, v[j]);
+
+	    if (p[0] > e[0]+d && p[0] < e[3]-d && p[1] > e[1]+d && p[1] < e[4]-d && p[2] > e[2]+d && p[2] < e[5]-d) f = NULL; /* interior */
+	    else if ((f = frontier_slot (export->frontier, export->size, p))->index) /* shared with an earlier subtree */
+	    {
+	      map [v[j]] = f->index;
+	      continue;
+	    }
+
+	    output_write (&export->ply, p, sizeof (REAL [3]));
+	    map [v[j]] = ++ export->vertices;
+
+	    if (f)
+	    {
+	      COPY (p, f->p);
+	      f->index = map [v[j]];
+	      if (2 * ++ export->count > export->size) frontier_rebuild (export, 2 * export->size, NULL);
+	    }
+	  }
+	}
+
+	for (j = 0; j < 3; j ++) v [j] = map [v[j]] - 1;
+
+	memcpy (record + 1, v, sizeof (v));
+	output_write (&export->faces, record, sizeof (record));
+      }
+
+      n += face->n;
+    }
+  }
+
+  export->triangles += n;
+}
+
+/* append boundary faces of a finished subtree */
+void export_subtree (struct export *export, struct octree *octree)
+{
+  long n = 0;
+  int *map;
+
+  stl_records (&export->stl, octree, octree->mesh, export->domain, &n);
+
+  ERRMEM (map = calloc (octree->mesh->count > 0 ? octree->mesh->count : 1, sizeof (int))); /* subtree to PLY vertex numbers plus one */
+
+  export_triangles (export, octree, octree->mesh, octree->extents, map);
+
+  free (map);
+}
+
+/* forget vertices that only subtrees within completed extents could share */
+void export_complete (struct export *export, REAL extents [6])
+{
+  frontier_rebuild (export, export->size, extents);
+}
+
+/* finish streaming output and return bytes written */
+size_t export_close (struct export *export)
+{
+  char header [256];
+  size_t bytes, n;
+  uint32_t count;
+
+  ASSERT (export->triangles <= UINT32_MAX, "Too many triangles for STL output");
+  count = (uint32_t) export->triangles;
+  output_patch (&export->stl, 80, &count, sizeof (count));
+  bytes = output_close (&export->stl);
+
+  output_flush (&export->faces); /* append spilled faces */
+  rewind (export->faces.file);
+  while ((n = fread (export->faces.buffer, 1, BUFFER_SIZE, export->faces.file)) > 0) output_write (&export->ply, export->faces.buffer, n);
+  ASSERT (!ferror (export->faces.file), "Reading spilled faces has failed");
+  export->faces.used = 0;
+  output_close (&export->faces);
+
+  output_patch (&export->ply, 0, header, ply_header (header, sizeof (header), export->vertices, export->triangles));
+  bytes += output_close (&export->ply);
+
+  free (export->frontier);
+  free (export);
+
+  return bytes;
+}
+
+/* create output directory including its parents; zero on failure */
+int export_directory (const char *path)
+{
+  char *copy, *p;
+  int ok = 1;
+
+  ERRMEM (copy = malloc (strlen (path) + 1));
+  strcpy (copy, path);
+
+  for (p = copy; *p && ok; p ++)
+  {
+    if (*p == '/' && p > copy)
+    {
+      *p = '\0';
+      ok = (mkdir (copy, 0777) == 0 || errno == EEXIST);
+      *p = '/';
+    }
+  }
+
+  if (ok) ok = (mkdir (copy, 0777) == 0 || errno == EEXIST);
+
+  free (copy);
+
+  return ok;
+}
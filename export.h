@@ -0,0 +1,35 @@
+/*
+ * export.h
+ * --------
+ */
+
+#include <stddef.h>
+#include "oaktree.h"
+
+#ifndef __export__
+#define __export__
+
+/* stream domain boundary faces to a binary STL file and return bytes written */
+size_t export_stl (struct octree *octree, struct domain *domain, const char *path);
+
+/* stream domain boundary faces to an indexed binary PLY file and return bytes written */
+size_t export_ply (struct octree *octree, struct domain *domain, const char *path);
+
+struct export;
+
+/* open streaming STL and PLY output of a domain; subtrees share vertices within a margin from their boundaries */
+struct export* export_open (struct domain *domain, const char *stl, const char *ply, REAL margin);
+
+/* append boundary faces of a finished subtree */
+void export_subtree (struct export *export, struct octree *octree);
+
+/* forget vertices that only subtrees within completed extents could share */
+void export_complete (struct export *export, REAL extents [6]);
+
+/* finish streaming output and return bytes written */
+size_t export_close (struct export *export);
+
+/* create output directory including its parents; zero on failure */
+int export_directory (const char *path);
+
+#endif
@@ -0,0 +1,568 @@
+/*
+ * image.c
+ * -------
+ * bitmap and avi video output; avi frames are stored as uncompressed
+ * bitmaps or as baseline JPEG images (MJPEG)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include "image.h"
+#include "error.h"
+
+/* offsets to AVI header entries updated
+ * at the end of the write process */
+#define FILE_SIZE_OFFSET 4
+#define FRAMES_1_OFFSET 48
+#define FRAMES_2_OFFSET 140
+#define MOVIE_SIZE_OFFSET 216
+
+#define HEADER_SIZE 220 /* bytes before the movie list data */
+
+#define IO_BUFFER (1 << 20) /* stdio buffer of output files */
+
+/* growing byte buffer */
+struct bytes
+{
+  unsigned char *data;
+  size_t count, size;
+};
+
+/* movie handle */
+struct avi
+{
+  FILE *file;
+  int width;
+  int height;
+  int frames;
+  int quality; /* JPEG quality or zero for bitmaps */
+  int *sizes; /* chunk sizes of frames */
+  int maxframes;
+  struct bytes frame; /* encoded frame */
+};
+
+/* round up to the next 4-divisible width */
+static int ROUNDED_WIDTH (int width)
+{
+  width *= 3;
+  while (width % 4) width ++;
+  return width;
+}
+
+/* rounded up image size */
+#define ROUNDED_SIZE(width, height)\
+  (ROUNDED_WIDTH (width) * (height))
+
+/* little-endian DWORD output */
+static void DWORD (int32_t v, FILE *f)
+{
+  putc (v, f);
+  putc (v >> 8, f);
+  putc (v >> 16, f);
+  putc (v >> 24, f);
+}
+
+/* little-endian WORD output */
+static void WORD (int16_t v, FILE *f)
+{
+  putc (v, f);
+  putc (v >> 8, f);
+}
+
+/* string output (no byte reversal) */
+#define STRING(s, f) fwrite (s, 1, strlen (s), f)
+
+/* make room for more bytes */
+static unsigned char* reserve (struct bytes *b, size_t n)
+{
+  if (b->count + n > b->size)
+  {
+    b->size = 2 * b->size + n + 65536;
+    ERRMEM (b->data = realloc (b->data, b->size));
+  }
+
+  return b->data + b->count;
+}
+
+/* little-endian BGR copy of RGB data */
+static void BGR (int w, int h, unsigned char *rgb, struct bytes *out)
+{
+  int row = ROUNDED_WIDTH (w), i;
+  unsigned char *b;
+
+  out->count = 0;
+  b = reserve (out, ROUNDED_SIZE (w, h));
+  out->count = ROUNDED_SIZE (w, h);
+
+  for (; h; h --, b += row, rgb += row)
+  {
+    for (i = 0; i < 3*w; i += 3)
+    {
+      b [i] = rgb [i+2];
+      b [i+1] = rgb [i+1];
+      b [i+2] = rgb [i];
+    }
+
+    for (; i < row; i ++) b [i] = 0;
+  }
+}
+
+/*
+ * baseline JPEG encoding with 2x2 chroma subsampling and the standard tables
+ */
+
+static const unsigned char zigzag [64] = {0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+static const unsigned char luminance [64] = {16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56,
+  14, 17, 22, 29, 51, 87, 80, 62, 18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103, 99};
+
+static const unsigned char chrominance [64] = {17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99,
+  47, 66, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99};
+
+static const unsigned char dc_bits [2][16] = {{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0}, {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}};
+
+static const unsigned char dc_values [12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const unsigned char ac_bits [2][16] = {{0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d}, {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}};
+
+static const unsigned char ac_values [2][162] = {
+ {0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+  0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+  0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+  0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa},
+ {0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+  0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+  0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+  0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa}};
+
+struct huffman /* codes and lengths by symbol */
+{
+  unsigned short code [256];
+  unsigned char size [256];
+};
+
+struct encoder
+{
+  struct bytes *out;
+
+  uint32_t bits; /* pending bits, most significant first */
+
+  int nbits;
+
+  float c [8][8]; /* c[u][x] = C(u)/2 cos ((2x+1) u pi / 16) */
+
+  float q [2][64]; /* quantizer divisors in natural order */
+
+  unsigned char dqt [2][64]; /* quantizer tables in zigzag order */
+
+  struct huffman dc [2], ac [2];
+
+  int pred [3]; /* DC predictions of components */
+};
+
+/* derive canonical Huffman codes */
+static void huffman (const unsigned char *bits, const unsigned char *values, struct huffman *h)
+{
+  int i, j, k, code;
+
+  for (code = k = 0, i = 0; i < 16; i ++, code <<= 1)
+  {
+    for (j = 0; j < bits [i]; j ++, k ++, code ++)
+    {
+      h->code [values [k]] = code;
+      h->size [values [k]] = i + 1;
+    }
+  }
+}
+
+/* append bytes */
+static void put (struct bytes *b, const unsigned char *v, size_t n)
+{
+  memcpy (reserve (b, n), v, n);
+  b->count += n;
+}
+
+/* append a big-endian marker segment header */
+static void segment (struct bytes *b, int marker, int length)
+{
+  unsigned char v [4] = {0xFF, marker, length >> 8, length};
+
+  put (b, v, 4);
+}
+
+/* append bits with 0xFF byte stuffing */
+static void emit (struct encoder *e, unsigned code, int size)
+{
+  unsigned char c, zero = 0;
+
+  e->bits |= (code & ((1u << size) - 1)) << (32 - e->nbits - size);
+  e->nbits += size;
+
+  while (e->nbits >= 8)
+  {
+    c = e->bits >> 24;
+    put (e->out, &c, 1);
+    if (c == 0xFF) put (e->out, &zero, 1);
+    e->bits <<= 8;
+    e->nbits -= 8;
+  }
+}
+
+/* emit magnitude category and bits of a value */
+static void magnitude (struct encoder *e, struct huffman *h, int run, int v)
+{
+  int a = v < 0 ? -v : v, n = 0;
+
+  while (a) { n ++; a >>= 1; }
+
+  emit (e, h->code [(run << 4) | n], h->size [(run << 4) | n]);
+
+  if (n) emit (e, v < 0 ? v - 1 : v, n);
+}
+
+/* transform, quantize and emit an 8x8 block */
+static void block (struct encoder *e, float *f, int component)
+{
+  int u, v, x, k, q [64], run, table = component ? 1 : 0;
+  float t [64], s;
+
+  for (v = 0; v < 8; v ++) /* rows */
+    for (u = 0; u < 8; u ++)
+    {
+      for (s = 0.0, x = 0; x < 8; x ++) s += e->c [u][x] * f [8*v+x];
+      t [8*v+u] = s;
+    }
+
+  for (u = 0; u < 8; u ++) /* columns */
+    for (v = 0; v < 8; v ++)
+    {
+      for (s = 0.0, x = 0; x < 8; x ++) s += e->c [v][x] * t [8*x+u];
+      q [8*v+u] = (int) lroundf (s / e->q [table][8*v+u]);
+    }
+
+  magnitude (e, &e->dc [table], 0, q [0] - e->pred [component]);
+  e->pred [component] = q [0];
+
+  for (run = 0, k = 1; k < 64; k ++)
+  {
+    if (q [zigzag [k]] == 0) run ++;
+    else
+    {
+      for (; run > 15; run -= 16) emit (e, e->ac [table].code [0xF0], e->ac [table].size [0xF0]);
+      magnitude (e, &e->ac [table], run, q [zigzag [k]]);
+      run = 0;
+    }
+  }
+
+  if (run) emit (e, e->ac [table].code [0x00], e->ac [table].size [0x00]);
+}
+
+/* encode bottom up padded RGB rows as a baseline JPEG image of a given quality in 1..100 */
+static void jpeg (int w, int h, unsigned char *rgb, int quality, struct bytes *out)
+{
+  unsigned char v [32], *p;
+  float y [4][64], cb [64], cr [64], *f;
+  int row = ROUNDED_WIDTH (w), mx, my, i, j, k, x, yy, s;
+  struct encoder e;
+
+  memset (&e, 0, sizeof (struct encoder));
+  e.out = out;
+  out->count = 0;
+
+  quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+  s = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+
+  for (i = 0; i < 64; i ++)
+  {
+    j = (luminance [i] * s + 50) / 100;
+    k = (chrominance [i] * s + 50) / 100;
+    j = j < 1 ? 1 : j > 255 ? 255 : j;
+    k = k < 1 ? 1 : k > 255 ? 255 : k;
+    e.q [0][i] = j;
+    e.q [1][i] = k;
+  }
+
+  for (i = 0; i < 8; i ++)
+    for (j = 0; j < 8; j ++) e.c [i][j] = (i ? 0.5 : 0.5 / sqrt (2.0)) * cos ((2*j + 1) * i * 3.14159265358979323846 / 16.0);
+
+  for (i = 0; i < 64; i ++)
+  {
+    e.dqt [0][i] = e.q [0][zigzag [i]];
+    e.dqt [1][i] = e.q [1][zigzag [i]];
+  }
+
+  for (i = 0; i < 2; i ++)
+  {
+    huffman (dc_bits [i], dc_values, &e.dc [i]);
+    huffman (ac_bits [i], ac_values [i], &e.ac [i]);
+  }
+
+  v [0] = 0xFF; v [1] = 0xD8; /* SOI */
+  put (out, v, 2);
+
+  for (i = 0; i < 2; i ++) /* DQT */
+  {
+    segment (out, 0xDB, 67);
+    v [0] = i;
+    put (out, v, 1);
+    put (out, e.dqt [i], 64);
+  }
+
+  segment (out, 0xC0, 17); /* SOF0: 8 bit precision, luminance sampled 2x2 and chrominance 1x1 */
+  v [0] = 8; v [1] = h >> 8; v [2] = h; v [3] = w >> 8; v [4] = w; v [5] = 3;
+  v [6] = 1; v [7] = 0x22; v [8] = 0;
+  v [9] = 2; v [10] = 0x11; v [11] = 1;
+  v [12] = 3; v [13] = 0x11; v [14] = 1;
+  put (out, v, 15);
+
+  for (i = 0; i < 2; i ++) /* DHT */
+  {
+    segment (out, 0xC4, 2 + 17 + 12);
+    v [0] = i;
+    put (out, v, 1);
+    put (out, dc_bits [i], 16);
+    put (out, dc_values, 12);
+
+    segment (out, 0xC4, 2 + 17 + 162);
+    v [0] = 0x10 | i;
+    put (out, v, 1);
+    put (out, ac_bits [i], 16);
+    put (out, ac_values [i], 162);
+  }
+
+  segment (out, 0xDA, 12); /* SOS */
+  v [0] = 3; v [1] = 1; v [2] = 0x00; v [3] = 2; v [4] = 0x11; v [5] = 3; v [6] = 0x11; v [7] = 0; v [8] = 63; v [9] = 0;
+  put (out, v, 10);
+
+  for (my = 0; my < h; my += 16)
+  {
+    for (mx = 0; mx < w; mx += 16)
+    {
+      memset (cb, 0, sizeof (cb));
+      memset (cr, 0, sizeof (cr));
+
+      for (j = 0; j < 16; j ++)
+      {
+	yy = my + j < h ? my + j : h - 1;
+	p = rgb + (size_t) (h - 1 - yy) * row; /* rows are stored bottom up */
+
+	for (i = 0; i < 16; i ++)
+	{
+	  x = mx + i < w ? mx + i : w - 1;
+	  f = &y [(j / 8) * 2 + i / 8][(j % 8) * 8 + i % 8];
+	  *f = 0.299f * p [3*x] + 0.587f * p [3*x+1] + 0.114f * p [3*x+2] - 128.0f;
+	  k = (j / 2) * 8 + i / 2;
+	  cb [k] += 0.25f * (-0.168736f * p [3*x] - 0.331264f * p [3*x+1] + 0.5f * p [3*x+2]);
+	  cr [k] += 0.25f * (0.5f * p [3*x] - 0.418688f * p [3*x+1] - 0.081312f * p [3*x+2]);
+	}
+      }
+
+      for (k = 0; k < 4; k ++) block (&e, y [k], 0);
+      block (&e, cb, 1);
+      block (&e, cr, 2);
+    }
+  }
+
+  if (e.nbits) emit (&e, 0x7F, 8 - e.nbits); /* pad the last byte with ones */
+
+  v [0] = 0xFF; v [1] = 0xD9; /* EOI */
+  put (out, v, 2);
+}
+
+/* bytes per padded RGB buffer row */
+int rgb_row (int width)
+{
+  return ROUNDED_WIDTH (width);
+}
+
+/* allocate RGB buffer */
+void* rgb_alloc (int width, int height)
+{
+  void *rgb;
+  ERRMEM (rgb = malloc (ROUNDED_SIZE (width, height)));
+  return rgb;
+}
+
+/* free the buffer */
+void rgb_free (void *rgb)
+{
+  free (rgb);
+}
+
+/* output an RGB bitmap file (24 bits per pixel) */
+void bmp_output (int width, int height, void *rgb, const char *path)
+{
+  struct bytes bgr = {NULL, 0, 0};
+  FILE *f;
+
+  ASSERT (f = fopen (path, "wb"), "File open failed!");
+
+  WORD (0x4D42, f); /* BM magic */
+  DWORD (ROUNDED_SIZE (width, height) + 54, f); /* header size */
+  WORD (0, f); /* reserved */
+  WORD (0, f); /* reserved */
+  DWORD (54, f); /* offset to data */
+  DWORD (40, f); /* DIB header size */
+  DWORD (width, f);
+  DWORD (height, f);
+  WORD (1, f); /* number of planes */
+  WORD (24, f); /* bits per pixel */
+  DWORD (0, f); /* compression */
+  DWORD (0, f); /* image size (will be calculated) */
+  DWORD (0, f); /* horisontal pixels per meter */
+  DWORD (0, f); /* vertical ... */
+  DWORD (0, f); /* number of colors */
+  DWORD (0, f); /* number of important colors */
+  BGR (width, height, rgb, &bgr);
+  fwrite (bgr.data, 1, bgr.count, f);
+  fclose (f);
+  free (bgr.data);
+}
+
+/* open an RGB avi file (24 bits per pixel, 'fps' frames per second);
+ * frames are JPEG compressed for quality in 1..100 or uncompressed for zero */
+struct avi* avi_open (int width, int height, int fps, int quality, const char *path)
+{
+  struct avi *avi;
+  FILE *f;
+
+  ERRMEM (avi = calloc (1, sizeof (struct avi)));
+  ASSERT (avi->file = fopen (path, "wb"), "File open failed!");
+  setvbuf (avi->file, NULL, _IOFBF, IO_BUFFER);
+
+  avi->width = width;
+  avi->height = height;
+  avi->frames = 0;
+  avi->quality = quality;
+  f = avi->file;
+
+  STRING ("RIFF", f);
+  DWORD (0, f); /* file size => updated at the end */
+  STRING ("AVI ", f);
+  STRING ("LIST", f);
+  DWORD (192, f); /* length of this list */
+  STRING ("hdrl", f); /* headers list */
+  STRING ("avih", f); /* avi header */
+  DWORD (56, f); /* size of this header */
+  DWORD (1000000.0 / (double)fps, f);
+  DWORD (0, f); /* maximal bytes per second (leave default) */
+  DWORD (0, f); /* reserved value */
+  DWORD (16, f); /* file will have an index */
+  DWORD (0, f); /* number of frames => updated at the end */
+  DWORD (0, f); /* initial number of frames */
+  DWORD (1, f); /* only one video stram */
+  DWORD (ROUNDED_SIZE (width, height), f);
+  DWORD (width, f);
+  DWORD (height, f);
+  DWORD (0, f); /* scale */
+  DWORD (0, f); /* rate */
+  DWORD (0, f); /* start */
+  DWORD (0, f); /* length */
+  STRING ("LIST", f);
+  DWORD (116, f); /* size of this list */
+  STRING ("strl", f); /* video stream list */
+  STRING ("strh", f);  /* video stream header */
+  DWORD (56, f); /* size of this header */
+  STRING ("vids", f);
+  STRING (quality ? "MJPG" : "DIB ", f); /* Motion JPEG or Device Independent Bitmap */
+  DWORD (0, f); /* flags */
+  DWORD (0, f); /* priority */
+  DWORD (0, f); /* initial frames */
+  DWORD (1000000.0 / (double)fps, f); /* micro seconds per frame */
+  DWORD (1000000, f); /* rate */
+  DWORD (0, f); /* start */
+  DWORD (0, f); /* number of frames => updated at the end */
+  DWORD (ROUNDED_SIZE (width, height), f);
+  DWORD (0, f); /* quality */
+  DWORD (0, f); /* sample size */
+  DWORD (0, f); /* reserved */
+  WORD (width, f);
+  WORD (height, f);
+  STRING ("strf", f); /* video stream format */
+  DWORD (40, f); /* size of header */
+  DWORD (40, f); /* size of DIB header */
+  DWORD (width, f);
+  DWORD (height, f);
+  WORD (1, f); /* number of planes */
+  WORD (24, f); /* bits per pixel */
+  if (quality) STRING ("MJPG", f); /* compression */
+  else DWORD (0, f);
+  DWORD (ROUNDED_SIZE (width, height), f); /* image size */
+  DWORD (0, f); /* pixels per meter along x */
+  DWORD (0, f); /* ... along y */
+  DWORD (0, f); /* number of colors */
+  DWORD (0, f); /* number of important colors */
+  STRING ("LIST", f);
+  DWORD (0, f); /* movie size => updated at the end */
+  STRING ("movi", f); /* the movie frames begin here */
+  return avi;
+}
+
+/* output one frame  */
+void avi_frame (struct avi *avi, void *rgb)
+{
+  static const unsigned char zero = 0;
+
+  if (avi->quality) jpeg (avi->width, avi->height, rgb, avi->quality, &avi->frame);
+  else BGR (avi->width, avi->height, rgb, &avi->frame);
+
+  if (avi->frames == avi->maxframes)
+  {
+    avi->maxframes = 2 * avi->maxframes + 256;
+    ERRMEM (avi->sizes = realloc (avi->sizes, avi->maxframes * sizeof (int)));
+  }
+
+  avi->sizes [avi->frames ++] = avi->frame.count;
+
+  STRING (avi->quality ? "00dc" : "00db", avi->file);
+  DWORD (avi->frame.count, avi->file);
+  fwrite (avi->frame.data, 1, avi->frame.count, avi->file);
+  if (avi->frame.count % 2) fwrite (&zero, 1, 1, avi->file); /* chunks are word aligned */
+}
+
+/* close the avi file */
+void avi_close (struct avi *avi)
+{
+  int offset = 4, frame, index_size = avi->frames * 16, movie_size = 4, file_size;
+
+  for (frame = 0; frame < avi->frames; frame ++) movie_size += 8 + avi->sizes [frame] + avi->sizes [frame] % 2;
+
+  file_size = HEADER_SIZE + movie_size + index_size; /* all but the 8 byte RIFF header, plus the 8 byte index header */
+
+  STRING ("idx1", avi->file);
+  DWORD (index_size, avi->file);
+
+  for (frame = 0; frame < avi->frames; frame ++)
+  {
+    STRING (avi->quality ? "00dc" : "00db", avi->file);
+    DWORD (16, avi->file);
+    DWORD (offset, avi->file);
+    DWORD (avi->sizes [frame], avi->file);
+    offset += 8 + avi->sizes [frame] + avi->sizes [frame] % 2;
+  }
+
+  fseek (avi->file, FILE_SIZE_OFFSET, SEEK_SET);
+  DWORD (file_size, avi->file);
+  fseek (avi->file, FRAMES_1_OFFSET, SEEK_SET);
+  DWORD (avi->frames, avi->file);
+  fseek (avi->file, FRAMES_2_OFFSET, SEEK_SET);
+  DWORD (avi->frames, avi->file);
+  fseek (avi->file, MOVIE_SIZE_OFFSET, SEEK_SET);
+  DWORD (movie_size, avi->file);
+  fclose (avi->file);
+  free (avi->frame.data);
+  free (avi->sizes);
+  free (avi);
+}
@@ -0,0 +1,33 @@
+/*
+ * image.h
+ * -------
+ */
+
+#ifndef __image__
+#define __image__
+
+struct avi;
+
+/* bytes per padded RGB buffer row; rows are stored bottom up */
+int rgb_row (int width);
+
+/* allocate RGB buffer */
+void* rgb_alloc (int width, int height);
+
+/* free the buffer */
+void rgb_free (void *rgb);
+
+/* output an RGB bitmap file (24 bits per pixel) */
+void bmp_output (int width, int height, void *rgb, const char *path);
+
+/* open an RGB avi file (24 bits per pixel, 'fps' frames per second);
+ * frames are JPEG compressed for quality in 1..100 or uncompressed for zero */
+struct avi* avi_open (int width, int height, int fps, int quality, const char *path);
+
+/* output one frame */
+void avi_frame (struct avi *avi, void *rgb);
+
+/* close the avi file */
+void avi_close (struct avi *avi);
+
+#endif
@@ -0,0 +1,10 @@
+simu = SIMULATION ('out/meshcsg', 1.0, 0.001, 1.0)
+
+a = MESH ('inp/part.stl', 1)
+b = CYLINDER ((0, 0, 0), 30, 8, (2, 2, 2))
+c = UNION (a, b)
+a = CUBE ((100, 100, -10), 60, 60, 40, (3, 3, 3, 3, 3, 3))
+ROTATE (a, (100, 100, 0), (0, 0, 1), 30)
+c = DIFFERENCE (c, a)
+
+DOMAIN (simu, c)
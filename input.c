@@ -817,18 +817,20 @@ static PyObject* POLYGON (PyObject *self, PyObject *args, PyObject *kwds)
 /* create sphere */
 static PyObject* MLS__ (PyObject *self, PyObject *args, PyObject *kwds)
 {
-  KEYWORDS ("op", "r", "scolor");
+  KEYWORDS ("op", "r", "scolor", "cut");
   int scolor, n, i, j;
   PyObject *op, *x;
   struct mls *mls;
-  double r;
+  double r, cut;
   SHAPE *out;
 
   out = (SHAPE*)SHAPE_TYPE.tp_alloc (&SHAPE_TYPE, 0);
 
   if (out)
   {
-    PARSEKEYS ("Odi", &op, &r, &scolor);
+    cut = 4.0;
+
+    PARSEKEYS ("Odi|d", &op, &r, &scolor, &cut);
 
     n = is_list_of_tuples (op, kwl[0], 1, 6);
 
@@ -852,7 +854,12 @@ static PyObject* MLS__ (PyObject *self, PyObject *args, PyObject *kwds)
     mls->nop = n;
     mls->r = r;
     mls->s = 1.0;
+    mls->t = cut;
     mls->scolor = scolor;
+    mls->cell = mls->seed = NULL;
+    mls->bound = NULL;
+
+    mls_index (mls);
 
     out->ptr->what = MLS;
     out->ptr->data = mls;
@@ -861,6 +868,58 @@ static PyObject* MLS__ (PyObject *self, PyObject *args, PyObject *kwds)
   return (PyObject*)out;
 }
 
+/* create triangle mesh */
+static PyObject* MESH__ (PyObject *self, PyObject *args, PyObject *kwds)
+{
+  KEYWORDS ("path", "scolor");
+  struct trimesh *mesh;
+  PyObject *path;
+  REAL *triang;
+  int scolor, n;
+  SHAPE *out;
+
+  out = (SHAPE*)SHAPE_TYPE.tp_alloc (&SHAPE_TYPE, 0);
+
+  if (out)
+  {
+    PARSEKEYS ("Oi", &path, &scolor);
+
+    TYPETEST (is_string (path, kwl[0]));
+
+    triang = stlread (PyUnicode_AsUTF8 (path), &n, 1);
+
+    if (!triang || n == 0)
+    {
+      char buf [BUFLEN];
+      snprintf (buf, BUFLEN, "'%s' is not a readable STL file with triangles", PyUnicode_AsUTF8 (path));
+      PyErr_SetString (PyExc_ValueError, buf);
+      free (triang);
+      return NULL;
+    }
+
+    mesh = trimesh_create (triang, n);
+
+    free (triang);
+
+    if (!mesh)
+    {
+      char buf [BUFLEN];
+      snprintf (buf, BUFLEN, "'%s' has only degenerate triangles", PyUnicode_AsUTF8 (path));
+      PyErr_SetString (PyExc_ValueError, buf);
+      return NULL;
+    }
+
+    mesh->scolor = scolor;
+
+    ERRMEM (out->ptr = calloc (1, sizeof (struct shape)));
+
+    out->ptr->what = MESH;
+    out->ptr->data = mesh;
+  }
+
+  return (PyObject*)out;
+}
+
 /* copy shape */
 static PyObject* COPY__ (PyObject *self, PyObject *args, PyObject *kwds) /* COPY__ => alg.h has a macro COPY */
 {
@@ -1028,6 +1087,7 @@ static PyMethodDef methods [] =
   {"CUBE", (PyCFunction)CUBE, METH_VARARGS|METH_KEYWORDS, "Create cube"},
   {"POLYGON", (PyCFunction)POLYGON, METH_VARARGS|METH_KEYWORDS, "Create polygon"},
   {"MLS", (PyCFunction)MLS__, METH_VARARGS|METH_KEYWORDS, "Create moving least square fit"},
+  {"MESH", (PyCFunction)MESH__, METH_VARARGS|METH_KEYWORDS, "Create triangle mesh from STL file"},
   {"COPY", (PyCFunction)COPY__, METH_VARARGS|METH_KEYWORDS, "Copy shape"},
   {"UNION", (PyCFunction)UNION, METH_VARARGS|METH_KEYWORDS, "Union of shapes"},
   {"INTERSECTION", (PyCFunction)INTERSECTION, METH_VARARGS|METH_KEYWORDS, "Intersection of shapes"},
@@ -1142,6 +1202,7 @@ int input (const char *path)
                     "from oaktree import CUBE\n"
                     "from oaktree import POLYGON\n"
                     "from oaktree import MLS\n"
+                    "from oaktree import MESH\n"
                     "from oaktree import COPY\n"
                     "from oaktree import UNION\n"
                     "from oaktree import INTERSECTION\n"
@@ -0,0 +1,210 @@
+/*
+ * linear.c
+ * --------
+ * linear octree: nodes in a Morton key ordered array
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "oaktree.h"
+#include "error.h"
+#include "alg.h"
+
+/* down [] index of the child with Morton index j (x bit 0, y bit 1, z bit 2) */
+static const int child [8] = {0, 3, 1, 2, 4, 7, 5, 6};
+
+/* spread the low 21 bits of x to every third bit */
+static unsigned long long spread (unsigned int x)
+{
+  unsigned long long v = x & 0x1fffff;
+
+  v = (v | v << 32) & 0x1f00000000ffffULL;
+  v = (v | v << 16) & 0x1f0000ff0000ffULL;
+  v = (v | v << 8) & 0x100f00f00f00f00fULL;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+  v = (v | v << 2) & 0x1249249249249249ULL;
+
+  return v;
+}
+
+/* gather every third bit of v into the low 21 bits */
+static unsigned int compact (unsigned long long v)
+{
+  v &= 0x1249249249249249ULL;
+  v = (v | v >> 2) & 0x10c30c30c30c30c3ULL;
+  v = (v | v >> 4) & 0x100f00f00f00f00fULL;
+  v = (v | v >> 8) & 0x1f0000ff0000ffULL;
+  v = (v | v >> 16) & 0x1f00000000ffffULL;
+  v = (v | v >> 32) & 0x1fffff;
+
+  return (unsigned int) v;
+}
+
+/* interleave lattice coordinates into a Morton key */
+static unsigned long long encode (unsigned int x, unsigned int y, unsigned int z)
+{
+  return spread (x) | spread (y) << 1 | spread (z) << 2;
+}
+
+/* split Morton key into lattice coordinates */
+static void decode (unsigned long long key, unsigned int x [3])
+{
+  x [0] = compact (key);
+  x [1] = compact (key >> 1);
+  x [2] = compact (key >> 2);
+}
+
+/* count nodes and find depth */
+static void count (struct octree *octree, int level, int *size, int *depth)
+{
+  (*size) ++;
+
+  if (level > *depth) *depth = level;
+
+  if (octree->down [0]) for (int i = 0; i < 8; i ++) count (octree->down [i], level+1, size, depth);
+}
+
+/* store nodes in pre-order with children visited in Morton order, which yields sorted keys */
+static void store (struct linear *linear, struct octree *octree, int level, unsigned long long key, int *i)
+{
+  struct lnode *node = &linear->node [(*i) ++];
+  int shift;
+
+  node->key = key;
+  node->level = level;
+  node->cell = octree->cell;
+
+  if (octree->down [0])
+  {
+    shift = 3 * (linear->depth - level - 1);
+
+    for (int j = 0; j < 8; j ++) store (linear, octree->down [child [j]], level+1, key | ((unsigned long long) j << shift), i);
+  }
+}
+
+/* create linear octree from a pointer octree */
+struct linear* linear_create (struct octree *octree)
+{
+  struct linear *linear;
+  int i = 0;
+
+  ERRMEM (linear = calloc (1, sizeof (struct linear)));
+
+  COPY6 (octree->extents, linear->extents);
+
+  count (octree, 0, &linear->size, &linear->depth);
+
+  ASSERT (linear->depth <= LINEAR_BITS, "Octree is too deep for %d bit Morton coordinates", LINEAR_BITS);
+
+  ERRMEM (linear->node = malloc (linear->size * sizeof (struct lnode)));
+
+  store (linear, octree, 0, 0, &i);
+
+  return linear;
+}
+
+/* compute node extents from its key and level by halving the root extents as the pointer octree does */
+void linear_extents (struct linear *linear, struct lnode *node, REAL extents [6])
+{
+  int l, k, shift;
+  REAL mid;
+
+  COPY6 (linear->extents, extents);
+
+  for (l = 1; l <= node->level; l ++)
+  {
+    shift = 3 * (linear->depth - l);
+
+    for (k = 0; k < 3; k ++)
+    {
+      mid = .5*(extents[k] + extents[k+3]);
+
+      if ((node->key >> (shift + k)) & 1) extents [k] = mid;
+      else extents [k+3] = mid;
+    }
+  }
+}
+
+/* return index of the node following a node's subtree */
+int linear_next (struct linear *linear, int i)
+{
+  int level = linear->node[i].level;
+
+  for (i ++; i < linear->size && linear->node[i].level > level; i ++);
+
+  return i;
+}
+
+/* return index of the node with given key and level or -1 */
+static int find (struct linear *linear, unsigned long long key, int level)
+{
+  int lo = 0, hi = linear->size - 1, mid;
+  struct lnode *n;
+
+  while (lo <= hi)
+  {
+    mid = (lo + hi) / 2;
+    n = &linear->node [mid];
+
+    if (n->key < key || (n->key == key && n->level < level)) lo = mid + 1;
+    else if (n->key > key || n->level > level) hi = mid - 1;
+    else return mid;
+  }
+
+  return -1;
+}
+
+/* return index of the deepest node containing a lattice key: the last one in pre-order with a key not above it */
+static int deepest (struct linear *linear, unsigned long long key)
+{
+  int lo = 0, hi = linear->size - 1, mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi + 1) / 2;
+
+    if (linear->node[mid].key <= key) lo = mid;
+    else hi = mid - 1;
+  }
+
+  return lo;
+}
+
+/* return index of the face neighbour (direction 0..5 for -x, +x, -y, +y, -z, +z) at the same or a coarser level, or -1 */
+int linear_neighbour (struct linear *linear, int i, int direction)
+{
+  struct lnode *node = &linear->node [i];
+  unsigned int x [3], size = 1u << (linear->depth - node->level);
+  int k = direction / 2, j;
+
+  decode (node->key, x);
+
+  if (direction % 2) /* positive */
+  {
+    if (x[k] + size >= (1u << linear->depth)) return -1;
+    x [k] += size;
+  }
+  else
+  {
+    if (x[k] == 0) return -1;
+    x [k] -= 1;
+  }
+
+  j = deepest (linear, encode (x[0], x[1], x[2]));
+
+  if (linear->node[j].level > node->level) /* finer; ascend to the node's level */
+  {
+    int shift = 3 * (linear->depth - node->level);
+
+    j = find (linear, (linear->node[j].key >> shift) << shift, node->level);
+  }
+
+  return j;
+}
+
+/* free linear octree */
+void linear_destroy (struct linear *linear)
+{
+  free (linear->node);
+  free (linear);
+}
@@ -0,0 +1,129 @@
+/*
+ * mesh.c
+ * ------
+ * welded vertex pool shared by the faces of an octree
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "mesh.h"
+#include "error.h"
+
+/* table slot of a point */
+static struct weld* slot (struct mesh *mesh, REAL point [3], unsigned int h)
+{
+  int i = h & (mesh->size - 1);
+  struct weld *w;
+
+  for (w = &mesh->table [i]; w->index; w = &mesh->table [i])
+  {
+    if (w->hash == h && memcmp (mesh_point (mesh, w->index - 1), point, sizeof (REAL [3])) == 0) break;
+
+    i = (i + 1) & (mesh->size - 1); /* linear probing */
+  }
+
+  return w;
+}
+
+/* double table size */
+static void grow (struct mesh *mesh)
+{
+  struct weld *old = mesh->table, *w;
+  int i, size = mesh->size;
+
+  mesh->size *= 2;
+  ERRMEM (mesh->table = calloc (mesh->size, sizeof (struct weld)));
+
+  for (i = 0; i < size; i ++)
+  {
+    if (old[i].index)
+    {
+      for (w = &mesh->table [old[i].hash & (mesh->size - 1)]; w->index; w = w + 1 < mesh->table + mesh->size ? w + 1 : mesh->table);
+      *w = old [i];
+    }
+  }
+
+  free (old);
+}
+
+/* create welded vertex pool */
+struct mesh* mesh_create (void)
+{
+  struct mesh *mesh;
+
+  ERRMEM (mesh = calloc (1, sizeof (struct mesh)));
+  mesh->size = 1024;
+  ERRMEM (mesh->table = calloc (mesh->size, sizeof (struct weld)));
+  pthread_mutex_init (&mesh->lock, NULL);
+
+  return mesh;
+}
+
+/* return index of a vertex, adding it unless a bitwise equal one exists */
+int mesh_vertex (struct mesh *mesh, REAL point [3])
+{
+  unsigned int h = mesh_hash (point);
+  struct weld *w;
+  int i;
+
+  if (mesh->shared) pthread_mutex_lock (&mesh->lock);
+
+  w = slot (mesh, point, h);
+
+  if (w->index) i = w->index - 1;
+  else
+  {
+    i = mesh->count ++;
+
+    ASSERT (i < MESH_CHUNKS << MESH_CHUNK_BITS, "Too many mesh vertices");
+
+    if (!mesh->chunk [i >> MESH_CHUNK_BITS])
+    {
+      ERRMEM (mesh->chunk [i >> MESH_CHUNK_BITS] = malloc (sizeof (REAL [3]) << MESH_CHUNK_BITS));
+    }
+
+    memcpy (mesh_point (mesh, i), point, sizeof (REAL [3]));
+
+    w->hash = h;
+    w->index = i + 1;
+
+    if (2 * mesh->count > mesh->size) grow (mesh);
+  }
+
+  if (mesh->shared) pthread_mutex_unlock (&mesh->lock);
+
+  return i;
+}
+
+/* set whether vertices are added concurrently; not to be called while adding */
+void mesh_shared (struct mesh *mesh, int shared)
+{
+  mesh->shared = shared;
+}
+
+/* return memory used by the pool in bytes */
+size_t mesh_bytes (struct mesh *mesh)
+{
+  size_t chunks, bytes;
+
+  if (mesh->shared) pthread_mutex_lock (&mesh->lock);
+
+  chunks = ((size_t) mesh->count + (1 << MESH_CHUNK_BITS) - 1) >> MESH_CHUNK_BITS;
+
+  bytes = sizeof (struct mesh) + mesh->size * sizeof (struct weld) + (chunks * sizeof (REAL [3]) << MESH_CHUNK_BITS);
+
+  if (mesh->shared) pthread_mutex_unlock (&mesh->lock);
+
+  return bytes;
+}
+
+/* free welded vertex pool */
+void mesh_destroy (struct mesh *mesh)
+{
+  for (int i = 0; i < MESH_CHUNKS && mesh->chunk [i]; i ++) free (mesh->chunk [i]);
+
+  pthread_mutex_destroy (&mesh->lock);
+  free (mesh->table);
+  free (mesh);
+}
@@ -0,0 +1,72 @@
+/*
+ * mesh.h
+ * ------
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#ifndef __mesh__
+#define __mesh__
+
+#define MESH_CHUNK_BITS 15 /* vertices per chunk are 2^MESH_CHUNK_BITS */
+
+#define MESH_CHUNKS 8192 /* maximum number of chunks */
+
+struct weld /* vertex table entry */
+{
+  unsigned int hash;
+
+  int index; /* index plus one; zero marks empty entries */
+};
+
+struct mesh /* welded vertex pool */
+{
+  REAL (*chunk [MESH_CHUNKS]) [3]; /* stable vertex storage */
+
+  int count;
+
+  struct weld *table; /* open addressing vertex table */
+
+  int size; /* size is a power of two */
+
+  pthread_mutex_t lock;
+
+  int shared; /* vertices are added concurrently */
+};
+
+/* create welded vertex pool */
+struct mesh* mesh_create (void);
+
+/* set whether vertices are added concurrently; not to be called while adding */
+void mesh_shared (struct mesh *mesh, int shared);
+
+/* return index of a vertex, adding it unless a bitwise equal one exists */
+int mesh_vertex (struct mesh *mesh, REAL point [3]);
+
+/* return hash of vertex bits */
+static inline unsigned int mesh_hash (REAL point [3])
+{
+  unsigned long long h = 0;
+  unsigned int w [3 * sizeof (REAL) / sizeof (unsigned int)];
+
+  memcpy (w, point, sizeof (REAL [3]));
+
+  for (size_t i = 0; i < sizeof (w) / sizeof (unsigned int); i ++) h = (h ^ w[i]) * 0x9E3779B97F4A7C15ULL;
+
+  return (unsigned int) (h >> 32);
+}
+
+/* return vertex coordinates */
+static inline REAL* mesh_point (struct mesh *mesh, int i)
+{
+  return mesh->chunk [i >> MESH_CHUNK_BITS][i & ((1 << MESH_CHUNK_BITS) - 1)];
+}
+
+/* return memory used by the pool in bytes */
+size_t mesh_bytes (struct mesh *mesh);
+
+/* free welded vertex pool */
+void mesh_destroy (struct mesh *mesh);
+
+#endif
@@ -0,0 +1,436 @@
+/*
+ * mls.c
+ * -----
+ * moving least squares leaves with a uniform grid point index
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include "oaktree.h"
+#include "error.h"
+#include "alg.h"
+
+#define CELLS_PER_POINT 4 /* grid size limit relative to the number of points */
+
+#define AGGREGATE 8 /* cells with more points are bounded as a whole */
+
+/* grid cell coordinate of a point coordinate */
+inline static int coordinate (struct mls *mls, REAL x, int k)
+{
+  REAL v = (x - mls->lo[k]) / mls->h;
+
+  if (v < 0.0) return -1;
+  else if (v >= (REAL) mls->n[k]) return mls->n[k];
+  else return (int) v;
+}
+
+/* grid cell ranges overlapping a sphere; return 0 if there is none */
+static int cells (struct mls *mls, REAL c [3], REAL r, int lo [3], int hi [3])
+{
+  for (int k = 0; k < 3; k ++)
+  {
+    lo [k] = MAX (coordinate (mls, c[k] - r, k), 0);
+    hi [k] = MIN (coordinate (mls, c[k] + r, k), mls->n[k] - 1);
+    if (lo [k] > hi [k]) return 0;
+  }
+
+  return 1;
+}
+
+/* grid cell ranges that may hold points within a sphere; a single cell is taken whole, as the truncation test rejects its far points */
+inline static int near (struct mls *mls, REAL c [3], REAL r, int lo [3], int hi [3])
+{
+  if (mls->n[0] * mls->n[1] * mls->n[2] == 1)
+  {
+    SET (lo, 0);
+    SET (hi, 0);
+    return 1;
+  }
+
+  return cells (mls, c, r, lo, hi);
+}
+
+/* grid cell containing a point or the nearest boundary cell */
+inline static int clamped (struct mls *mls, REAL *point)
+{
+  int x [3];
+
+  for (int k = 0; k < 3; k ++) x [k] = MAX (MIN (coordinate (mls, point[k], k), mls->n[k] - 1), 0);
+
+  return (x[2] * mls->n[1] + x[1]) * mls->n[0] + x[0];
+}
+
+/* loop over points of grid cells overlapping a sphere; the x-rows of cells are contiguous */
+#define FOR_POINTS_NEAR(mls, c, r, i)\
+  int lo [3], hi [3], row;\
+  if (near (mls, c, r, lo, hi))\
+  for (int k = lo[2]; k <= hi[2]; k ++)\
+  for (int j = lo[1]; j <= hi[1]; j ++)\
+  for (row = (k*mls->n[1] + j)*mls->n[0], i = mls->cell [row+lo[0]]; i < mls->cell [row+hi[0]+1]; i ++)
+
+/* grid cell center */
+inline static void center (struct mls *mls, int i, int j, int k, REAL c [3])
+{
+  c [0] = mls->lo[0] + ((REAL)i + 0.5) * mls->h;
+  c [1] = mls->lo[1] + ((REAL)j + 0.5) * mls->h;
+  c [2] = mls->lo[2] + ((REAL)k + 0.5) * mls->h;
+}
+
+/* assign to each grid cell a seed point: its own point nearest to the cell center or one flooded from the closest nonempty cells */
+static void seeds (struct mls *mls)
+{
+  int i, j, k, l, m, o, *queue, head, tail, x [3];
+  REAL c [3], z [3], d, v;
+
+  m = mls->n[0] * mls->n[1] * mls->n[2];
+
+  ERRMEM (mls->seed = malloc (m * sizeof (int)));
+  ERRMEM (queue = malloc (m * sizeof (int)));
+
+  for (head = tail = o = 0, k = 0; k < mls->n[2]; k ++)
+  for (j = 0; j < mls->n[1]; j ++)
+  for (i = 0; i < mls->n[0]; i ++, o ++)
+  {
+    mls->seed [o] = -1;
+
+    center (mls, i, j, k, c);
+
+    for (d = FLT_MAX, l = mls->cell[o]; l < mls->cell[o+1]; l ++)
+    {
+      SUB (c, mls->op[l], z);
+      v = DOT (z, z);
+      if (v < d)
+      {
+	d = v;
+	mls->seed [o] = l;
+      }
+    }
+
+    if (mls->seed [o] >= 0) queue [tail ++] = o;
+  }
+
+  while (head < tail) /* breadth first flooding of empty cells */
+  {
+    o = queue [head ++];
+    x [0] = o % mls->n[0];
+    x [1] = (o / mls->n[0]) % mls->n[1];
+    x [2] = o / (mls->n[0] * mls->n[1]);
+
+    for (k = 0; k < 6; k ++)
+    {
+      l = k / 2;
+      x [l] += k % 2 ? 1 : -1;
+
+      if (x[l] >= 0 && x[l] < mls->n[l])
+      {
+	i = (x[2] * mls->n[1] + x[1]) * mls->n[0] + x[0];
+
+	if (mls->seed [i] < 0)
+	{
+	  mls->seed [i] = mls->seed [o];
+	  queue [tail ++] = i;
+	}
+      }
+
+      x [l] -= k % 2 ? 1 : -1;
+    }
+  }
+
+  free (queue);
+}
+
+/* compute per cell bounds of normals and of normal projections of points relative to the cell center */
+static void bounds (struct mls *mls)
+{
+  int i, j, k, l, o;
+  REAL c [3], z [3], v, *b, *p;
+
+  o = mls->n[0] * mls->n[1] * mls->n[2];
+
+  ERRMEM (mls->bound = malloc (o * sizeof (REAL [8])));
+
+  for (o = 0, k = 0; k < mls->n[2]; k ++)
+  for (j = 0; j < mls->n[1]; j ++)
+  for (i = 0; i < mls->n[0]; i ++, o ++)
+  {
+    b = mls->bound [o];
+
+    SET (b, FLT_MAX);
+    SET (b+3, -FLT_MAX);
+    b [6] = FLT_MAX;
+    b [7] = -FLT_MAX;
+
+    center (mls, i, j, k, c);
+
+    for (l = mls->cell[o]; l < mls->cell[o+1]; l ++)
+    {
+      p = mls->op[l];
+      SUB (p, c, z);
+      v = DOT (p+3, z);
+      b [0] = MIN (b[0], p[3]);
+      b [1] = MIN (b[1], p[4]);
+      b [2] = MIN (b[2], p[5]);
+      b [3] = MAX (b[3], p[3]);
+      b [4] = MAX (b[4], p[4]);
+      b [5] = MAX (b[5], p[5]);
+      b [6] = MIN (b[6], v);
+      b [7] = MAX (b[7], v);
+    }
+  }
+}
+
+/* (re)build point index; this reorders points */
+void mls_index (struct mls *mls)
+{
+  REAL hi [3], (*op) [6];
+  int i, k, m, *id;
+
+  free (mls->cell);
+  free (mls->seed);
+  free (mls->bound);
+
+  mls->cell = mls->seed = NULL;
+  mls->bound = NULL;
+
+  if (mls->t <= 0.0) return; /* no truncation: brute force evaluation */
+
+  COPY (mls->op[0], mls->lo);
+  COPY (mls->op[0], hi);
+
+  for (i = 1; i < mls->nop; i ++)
+  {
+    for (k = 0; k < 3; k ++)
+    {
+      mls->lo [k] = MIN (mls->lo[k], mls->op[i][k]);
+      hi [k] = MAX (hi[k], mls->op[i][k]);
+    }
+  }
+
+  for (mls->h = mls->t * mls->r; ; mls->h *= 2.0) /* cells span the truncation radius unless that makes too many of them */
+  {
+    for (k = 0; k < 3; k ++) mls->n [k] = (int) ((hi[k] - mls->lo[k]) / mls->h) + 1;
+
+    if ((double) mls->n[0] * mls->n[1] * mls->n[2] <= (double) CELLS_PER_POINT * mls->nop + 64) break;
+  }
+
+  m = mls->n[0] * mls->n[1] * mls->n[2];
+
+  ERRMEM (mls->cell = calloc (m + 1, sizeof (int)));
+  ERRMEM (id = malloc (mls->nop * sizeof (int)));
+  ERRMEM (op = malloc (mls->nop * sizeof (REAL [6])));
+
+  for (i = 0; i < mls->nop; i ++) /* counting sort of points by cell */
+  {
+    REAL *p = mls->op[i];
+
+    id [i] = (MIN (coordinate (mls, p[2], 2), mls->n[2]-1) * mls->n[1] +
+              MIN (coordinate (mls, p[1], 1), mls->n[1]-1)) * mls->n[0] +
+              MIN (coordinate (mls, p[0], 0), mls->n[0]-1);
+
+    mls->cell [id[i]+1] ++;
+  }
+
+  for (i = 0; i < m; i ++) mls->cell [i+1] += mls->cell [i];
+
+  for (i = 0; i < mls->nop; i ++)
+  {
+    COPY6 (mls->op[i], op[mls->cell[id[i]]]);
+    mls->cell [id[i]] ++;
+  }
+
+  for (i = m; i > 0; i --) mls->cell [i] = mls->cell [i-1]; /* restore cell starts */
+
+  mls->cell [0] = 0;
+
+  free (mls->op);
+  free (id);
+
+  mls->op = op;
+
+  seeds (mls);
+
+  bounds (mls);
+}
+
+/* return distance to an MLS leaf at given point */
+REAL mls_evaluate (struct mls *mls, REAL *point)
+{
+  REAL a, b, v, q, t, *p, z [3];
+  int i;
+
+  a = b = 0.0;
+  q = mls->r * mls->r;
+
+  if (mls->cell)
+  {
+    t = mls->t * mls->r;
+
+    FOR_POINTS_NEAR (mls, point, t, i)
+    {
+      SUB (point, mls->op[i], z);
+      v = DOT (z, z);
+      if (v < t*t)
+      {
+	v = exp (- v / q);
+	a += DOT (mls->op[i]+3, z) * v;
+	b += v;
+      }
+    }
+
+    if (b == 0.0) /* beyond truncation radius use the linear function of the cell seed */
+    {
+      p = mls->op [mls->seed [clamped (mls, point)]];
+      SUB (point, p, z);
+      return mls->s * DOT (p+3, z);
+    }
+  }
+  else for (i = 0; i < mls->nop; i ++)
+  {
+    SUB (point, mls->op[i], z);
+    v = DOT (z, z);
+    v = exp (- v / q);
+    a += DOT (mls->op[i]+3, z) * v;
+    b += v;
+  }
+
+  return mls->s * a / b;
+}
+
+/* compute MLS leaf normal at given point */
+void mls_normal (struct mls *mls, REAL *point, REAL *normal)
+{
+  REAL b, v, q, t, z [3];
+  int i;
+
+  b = 0.0;
+  SET (normal, 0);
+  q = mls->r * mls->r;
+
+  if (mls->cell)
+  {
+    t = mls->t * mls->r;
+
+    FOR_POINTS_NEAR (mls, point, t, i)
+    {
+      SUB (point, mls->op[i], z);
+      v = DOT (z, z);
+      if (v < t*t)
+      {
+	v = exp (- v / q);
+	ADDMUL (normal, v, mls->op[i]+3, normal);
+	b += v;
+      }
+    }
+
+    if (b == 0.0)
+    {
+      COPY (mls->op [mls->seed [clamped (mls, point)]]+3, normal);
+      b = 1.0;
+    }
+  }
+  else for (i = 0; i < mls->nop; i ++)
+  {
+    SUB (point, mls->op[i], z);
+    v = DOT (z, z);
+    v = exp (- v / q);
+    ADDMUL (normal, v, mls->op[i]+3, normal);
+    b += v;
+  }
+
+  DIV (normal, b, normal);
+  SCALE (normal, mls->s);
+}
+
+/* extend range by the bounds of a point's linear function over a box */
+inline static void linear (REAL *p, REAL c [3], REAL h [3], REAL range [2])
+{
+  REAL a, b, z [3];
+
+  SUB (c, p, z);
+  a = DOT (z, p+3);
+  b = fabs (p[3])*h[0] + fabs (p[4])*h[1] + fabs (p[5])*h[2];
+  range [0] = MIN (range[0], a - b);
+  range [1] = MAX (range[1], a + b);
+}
+
+/* extend range by the bounds of linear functions of a cell's points over a box */
+static void aggregate (struct mls *mls, int i, int j, int k, REAL c [3], REAL h [3], REAL range [2])
+{
+  REAL *b = mls->bound [(k*mls->n[1] + j)*mls->n[0] + i], p [3], u, v, w [4], lo, hi;
+
+  center (mls, i, j, k, p);
+
+  for (lo = hi = 0.0, k = 0; k < 3; k ++) /* n . (x - p) with n and x bounded */
+  {
+    u = c[k] - h[k] - p[k];
+    v = c[k] + h[k] - p[k];
+    w [0] = b[k] * u;
+    w [1] = b[k] * v;
+    w [2] = b[k+3] * u;
+    w [3] = b[k+3] * v;
+    lo += MIN (MIN (w[0], w[1]), MIN (w[2], w[3]));
+    hi += MAX (MAX (w[0], w[1]), MAX (w[2], w[3]));
+  }
+
+  range [0] = MIN (range[0], lo - b[7]);
+  range [1] = MAX (range[1], hi - b[6]);
+}
+
+/* bound MLS leaf distance over a box given by center and half extents */
+void mls_interval (struct mls *mls, REAL c [3], REAL h [3], REAL range [2])
+{
+  int i, j, k, l, o, lo [3], hi [3];
+  REAL a, b, r, z [3];
+
+  range [0] = FLT_MAX;
+  range [1] = -FLT_MAX;
+
+  if (mls->cell) /* weighted average of linear functions of points within truncation radius or of cell seeds */
+  {
+    r = mls->t * mls->r + LEN (h);
+
+    if (cells (mls, c, r, lo, hi))
+    {
+      for (k = lo[2]; k <= hi[2]; k ++)
+      for (j = lo[1]; j <= hi[1]; j ++)
+      for (i = lo[0]; i <= hi[0]; i ++)
+      {
+	o = (k*mls->n[1] + j)*mls->n[0] + i;
+
+	if (mls->cell[o+1] - mls->cell[o] > AGGREGATE) aggregate (mls, i, j, k, c, h, range);
+	else for (l = mls->cell[o]; l < mls->cell[o+1]; l ++)
+	{
+	  SUB (c, mls->op[l], z);
+	  if (DOT (z, z) <= r*r) linear (mls->op[l], c, h, range);
+	}
+      }
+    }
+
+    SUB (c, h, z); /* seeds of cells containing box points */
+    l = clamped (mls, z);
+    ADD (c, h, z);
+    o = clamped (mls, z);
+    lo [0] = l % mls->n[0];
+    lo [1] = (l / mls->n[0]) % mls->n[1];
+    lo [2] = l / (mls->n[0] * mls->n[1]);
+    hi [0] = o % mls->n[0];
+    hi [1] = (o / mls->n[0]) % mls->n[1];
+    hi [2] = o / (mls->n[0] * mls->n[1]);
+
+    for (k = lo[2]; k <= hi[2]; k ++)
+    for (j = lo[1]; j <= hi[1]; j ++)
+    for (i = lo[0]; i <= hi[0]; i ++)
+    {
+      linear (mls->op [mls->seed [(k*mls->n[1] + j)*mls->n[0] + i]], c, h, range);
+    }
+  }
+  else for (i = 0; i < mls->nop; i ++) linear (mls->op[i], c, h, range);
+
+  a = mls->s * range [0];
+  b = mls->s * range [1];
+  range [0] = MIN (a, b);
+  range [1] = MAX (a, b);
+}
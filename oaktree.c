@@ -3,6 +3,8 @@
  * ---------
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -11,27 +13,59 @@
 #include "viewer.h"
 #include "render.h"
 #include "input.h"
+#include "export.h"
+#include "raster.h"
+#include "preview.h"
+#include "image.h"
+#include "capture.h"
 #include "timer.h"
+#include "stats.h"
 #include "error.h"
 #include "alg.h"
 
 /* global simulations list */
 struct simulation *simulation = NULL;
 
+static int threads = 1; /* refinement threads */
+
+static size_t budget = 0; /* streaming memory budget in bytes; zero for in-memory meshing */
+
+static int statson = 0; /* statistics flag */
+
+static char *statspath = NULL; /* statistics JSON output path or NULL */
+
+static REAL rootedge; /* root octant edge of the streamed simulation */
+
+static int width = 512, height = 512; /* initial window or snapshot width and height */
+
+static char *snapshotpath = NULL; /* headless snapshot file name within output directories or NULL */
+
+static int frames = 72; /* turntable frames of AVI snapshots */
+
+static int quality = 0; /* AVI JPEG quality or zero for uncompressed frames */
+
+static int previewon = 0; /* trace shapes instead of meshing them */
+
 #if OPENGL
 #if __APPLE__
   #include <GLUT/glut.h>
 #else
+  #define GL_GLEXT_PROTOTYPES
   #include <GL/glut.h>
   #include <GL/glext.h>
 #endif
 
-static int vieweron = 0, width = 512, height = 512;  /* viewer flag, initial window width and height */
+static int vieweron = 0;  /* viewer flag */
 enum {MENU_SIMULATION = 0, MENU_RENDER, MENU_LAST}; /* menu identifiers */
 static char* menu_name [MENU_LAST];  /* menu names */
 static int menu_code [MENU_LAST]; /* menu codes */
-enum {SIMULATION_NEXT, SIMULATION_PREVIOUS, RENDER_DOMAINS, RENDER_CELLS, RENDER_OCTREE}; /* menu items */
-static enum {DOMAINS = 1 << 0, CELLS = 1 << 1, OCTREE = 1 << 2} render_item = DOMAINS; /* render item */
+enum {SIMULATION_NEXT, SIMULATION_PREVIOUS, RENDER_DOMAINS, RENDER_CELLS, RENDER_OCTREE, RENDER_PROXIES, RENDER_PREVIEW}; /* menu items */
+static enum {DOMAINS = 1 << 0, CELLS = 1 << 1, OCTREE = 1 << 2, PREVIEW = 1 << 3} render_item = DOMAINS; /* render item */
+static int proxies = 1; /* draw distant subtrees as bounding boxes */
+static struct preview *preview = NULL; /* sphere tracer of the previewed simulation */
+static struct simulation *previewed = NULL;
+static void *previewrgb = NULL; /* traced image */
+static int previewsize [2];
 
 /* simulation menu callback */
 static void menu_simulation (int item)
@@ -68,6 +102,14 @@ static void menu_render (int item)
     if (render_item & OCTREE) render_item &= ~OCTREE;
     else render_item |= OCTREE;
     break;
+  case RENDER_PROXIES:
+    proxies = !proxies;
+    render_lod (proxies ? 2.0 : 0.0);
+    break;
+  case RENDER_PREVIEW:
+    if (render_item & PREVIEW) render_item &= ~PREVIEW;
+    else render_item |= PREVIEW;
+    break;
   }
 
   viewer_redraw_all ();
@@ -88,6 +130,8 @@ static int  menu (char ***names, int **codes)
   glutAddMenuEntry ("domains /d/", RENDER_DOMAINS);
   glutAddMenuEntry ("cells /c/", RENDER_CELLS);
   glutAddMenuEntry ("octree /o/", RENDER_OCTREE);
+  glutAddMenuEntry ("proxies /l/", RENDER_PROXIES);
+  glutAddMenuEntry ("preview /p/", RENDER_PREVIEW);
 
   *names = menu_name;
   *codes = menu_code;
@@ -97,9 +141,16 @@ static int  menu (char ***names, int **codes)
 /* init callback */
 static void init ()
 {
+  struct simulation *s;
+
   if (simulation)
   {
     viewer_update_extents (simulation->extents);
+
+    for (s = simulation; s; s = s->next)
+    {
+      if (s->octree) render_update (s->octree); /* meshes are static once initialized */
+    }
   }
 }
 
@@ -112,6 +163,52 @@ static int  idle ()
 /* quit callback */
 static void quit ()
 {
+  if (preview) preview_destroy (preview);
+  if (previewrgb) rgb_free (previewrgb);
+}
+
+/* trace the current simulation for the current view and draw it into the viewport */
+static void render_preview ()
+{
+  double p [16], m [16], c [16];
+  GLint viewport [4];
+  int i, j, k;
+
+  if (previewed != simulation)
+  {
+    if (preview) preview_destroy (preview);
+    preview = preview_create (simulation->domain, simulation->extents, threads);
+    previewed = simulation;
+  }
+
+  glGetIntegerv (GL_VIEWPORT, viewport);
+  glGetDoublev (GL_PROJECTION_MATRIX, p);
+  glGetDoublev (GL_MODELVIEW_MATRIX, m);
+
+  for (i = 0; i < 4; i ++)
+  {
+    for (j = 0; j < 4; j ++)
+    {
+      for (c [4*i+j] = 0.0, k = 0; k < 4; k ++) c [4*i+j] += p [4*k+j] * m [4*i+k];
+    }
+  }
+
+  if (viewport [2] != previewsize [0] || viewport [3] != previewsize [1])
+  {
+    if (previewrgb) rgb_free (previewrgb);
+    previewrgb = rgb_alloc (viewport [2], viewport [3]);
+    previewsize [0] = viewport [2];
+    previewsize [1] = viewport [3];
+  }
+
+  preview_render (preview, c, viewport [2], viewport [3], previewrgb);
+
+  glPushAttrib (GL_ENABLE_BIT);
+  glDisable (GL_LIGHTING);
+  glDisable (GL_DEPTH_TEST);
+  glWindowPos2i (viewport [0], viewport [1]);
+  glDrawPixels (viewport [2], viewport [3], GL_RGB, GL_UNSIGNED_BYTE, previewrgb);
+  glPopAttrib ();
 }
 
 /* render callback */
@@ -119,6 +216,10 @@ static void render ()
 {
   if (simulation)
   {
+    if (render_item & PREVIEW) render_preview ();
+
+    if (!simulation->octree) return; /* shapes were not meshed */
+
     if (render_item & DOMAINS) render_domains (simulation->octree);
 
     if (render_item & CELLS)
@@ -171,6 +272,12 @@ static void key (int key, int x, int y)
   case 'o':
     menu_render (RENDER_OCTREE);
     break;
+  case 'l':
+    menu_render (RENDER_PROXIES);
+    break;
+  case 'p':
+    menu_render (RENDER_PREVIEW);
+    break;
   }
 }
 
@@ -195,15 +302,84 @@ static void passive (int x, int y)
 }
 #endif
 
+/* return output path of a domain mesh with a given extension */
+static char* domain_path (struct simulation *simulation, struct domain *domain, int i, const char *ext)
+{
+  char *path;
+
+  ERRMEM (path = malloc (strlen (simulation->outpath) + (domain->label ? strlen (domain->label) : 0) + strlen (ext) + 64));
+
+  if (domain->label) sprintf (path, "%s/%s.%s", simulation->outpath, domain->label, ext);
+  else sprintf (path, "%s/domain%d.%s", simulation->outpath, i, ext);
+
+  return path;
+}
+
+/* streamed subtree callback */
+static void stream_output (struct octree *octree, void *data)
+{
+  double start = stats_begin ();
+
+  export_subtree (data, octree);
+
+  stats_end (0, STATS_EXPORT, start);
+
+  stats_octree (octree, rootedge);
+}
+
+/* streamed octant completion callback */
+static void stream_complete (REAL extents [6], void *data)
+{
+  export_complete (data, extents);
+}
+
+/* mesh domains one subtree at a time, streaming them to the output directory */
+static void stream (struct simulation *simulation)
+{
+  struct domain *domain;
+  struct export *export;
+  char *stl, *ply;
+  size_t bytes = 0;
+  int i, n = 0;
+
+  if (!export_directory (simulation->outpath))
+  {
+    fprintf (stderr, "Creating output directory %s has failed\n", simulation->outpath);
+    return;
+  }
+
+  rootedge = simulation->extents[3] - simulation->extents[0];
+
+  for (i = 0, domain = simulation->domain; domain; domain = domain->next, i ++)
+  {
+    stl = domain_path (simulation, domain, i, "stl");
+    ply = domain_path (simulation, domain, i, "ply");
+
+    export = export_open (domain, stl, ply, 2.0*simulation->cutoff); /* split () perturbs points less than that outside of octants */
+    n += octree_stream_domain (simulation->extents, domain, simulation->cutoff, threads, budget, stream_output, stream_complete, export);
+    bytes += export_close (export);
+
+    free (stl);
+    free (ply);
+  }
+
+  printf ("Streamed %.1f MB of meshes in %d subtrees.\n", bytes / 1048576.0, n);
+}
+
 /* initialize simulation */
 static void initialize (struct simulation *simulation)
 {
+  struct domain *domain;
+  double refinement, adjacency;
+  long lookups, hits;
   REAL e [6], g [6];
   struct timing t;
-  double dt;
+  double dt, start;
 
   timerstart (&t);
 
+  start = stats_begin ();
+
   g [0] =  FLT_MAX;
   g [1] =  FLT_MAX;
   g [2] =  FLT_MAX;
@@ -212,8 +388,6 @@ static void initialize (struct simulation *simulation)
   g [5] = -FLT_MAX;
 
 #if 1
-  struct domain *domain;
-
   for (domain = simulation->domain; domain; domain = domain->next)
   {
     shape_extents (domain->shape, e);
@@ -245,18 +419,23 @@ static void initialize (struct simulation *simulation)
   g [5] = e[2] + e[3];
   COPY6 (g, simulation->extents); /* centered cube */
 
-  simulation->octree = octree_create (simulation->extents);
-
-  for (domain = simulation->domain; domain; domain = domain->next)
+  if (previewon) simulation->octree = NULL; /* shapes are traced without meshing */
+  else if (budget) stream (simulation);
+  else
   {
-    octree_insert_domain (simulation->octree, domain, simulation->cutoff);
+    simulation->octree = octree_create (simulation->extents);
+
+    for (domain = simulation->domain; domain; domain = domain->next)
+    {
+      octree_insert_domain (simulation->octree, domain, simulation->cutoff, threads);
+    }
   }
 #else
 
   REAL *triang, *p, cutoff = 1;
   int count;
 
-  triang = stlread ("inp/part.stl", &count);
+  triang = stlread ("inp/part.stl", &count, threads);
 
   for (p = triang; p < triang+count*9; p += 3)
   {
@@ -289,18 +468,164 @@ static void initialize (struct simulation *simulation)
 
   simulation->octree = octree_create (simulation->extents);
 
-  //octree_insert_triangles (simulation->octree, triang+1045*9, 5, cutoff);
-  octree_insert_triangles (simulation->octree, triang, count, cutoff);
+  //octree_insert_triangles (simulation->octree, triang+1045*9, 5, cutoff, threads);
+  octree_insert_triangles (simulation->octree, triang, count, cutoff, threads);
 #endif
 
+  stats_end (0, STATS_INITIALIZE, start);
+
+  if (simulation->octree) stats_octree (simulation->octree, simulation->extents[3] - simulation->extents[0]);
+
   dt = timerend (&t);
 
   printf ("Simulation [%s] initialized in %g s.\n", simulation->outpath, dt);
+
+  for (refinement = adjacency = 0.0, lookups = hits = 0, domain = simulation->domain; domain; domain = domain->next)
+  {
+    refinement += domain->refinement;
+    adjacency += domain->adjacency;
+    lookups += domain->lookups;
+    hits += domain->hits;
+  }
+
+  printf ("Refinement took %g s and cell adjacency %g s.\n", refinement, adjacency);
+
+  if (lookups) printf ("Corner value cache hit rate %.1f%% of %ld lookups.\n", 100.0 * hits / lookups, lookups);
+}
+
+/* export domain boundary meshes */
+static void output (struct simulation *simulation)
+{
+  struct domain *domain;
+  size_t bytes = 0;
+  struct timing t;
+  double dt, start;
+  char *path;
+  int i;
+
+  if (!export_directory (simulation->outpath))
+  {
+    fprintf (stderr, "Creating output directory %s has failed\n", simulation->outpath);
+    return;
+  }
+
+  timerstart (&t);
+
+  start = stats_begin ();
+
+  for (i = 0, domain = simulation->domain; domain; domain = domain->next, i ++)
+  {
+    path = domain_path (simulation, domain, i, "stl");
+    bytes += export_stl (simulation->octree, domain, path);
+    free (path);
+
+    path = domain_path (simulation, domain, i, "ply");
+    bytes += export_ply (simulation->octree, domain, path);
+    free (path);
+  }
+
+  stats_end (0, STATS_EXPORT, start);
+
+  dt = timerend (&t);
+
+  printf ("Exported %.1f MB of meshes in %g s (%.1f MB/s).\n", bytes / 1048576.0, dt, dt > 0.0 ? bytes / 1048576.0 / dt : 0.0);
+}
+
+/* render a turntable frame by rasterizing meshes or tracing shapes */
+static void frame (struct simulation *simulation, struct raster *raster, struct preview *preview, REAL angle, void *rgb)
+{
+  struct camera camera;
+  double m [16];
+
+  raster_camera (&camera, simulation->extents, angle);
+
+  if (preview)
+  {
+    raster_matrix (&camera, width, height, m);
+    preview_render (preview, m, width, height, rgb);
+  }
+  else raster_render (raster, &camera, width, height, rgb);
+}
+
+/* render domain boundaries headless into a bitmap or a turntable movie */
+static void snapshot (struct simulation *simulation)
+{
+  struct raster *raster = NULL;
+  struct preview *preview = NULL;
+  struct capture *avi = NULL;
+  struct timing t;
+  int i, n, len, full;
+  char *path;
+  void *rgb;
+  double dt;
+
+  if (!simulation->octree && !previewon)
+  {
+    fprintf (stderr, "Snapshots of streamed meshes are not supported\n");
+    return;
+  }
+
+  if (!export_directory (simulation->outpath))
+  {
+    fprintf (stderr, "Creating output directory %s has failed\n", simulation->outpath);
+    return;
+  }
+
+  ERRMEM (path = malloc (strlen (simulation->outpath) + strlen (snapshotpath) + 8));
+  sprintf (path, "%s/%s", simulation->outpath, snapshotpath);
+  len = strlen (path);
+
+  if (len > 4 && strcmp (path + len - 4, ".avi") == 0) n = MAX (frames, 1);
+  else
+  {
+    if (len < 4 || strcmp (path + len - 4, ".bmp")) strcat (path, ".bmp");
+    n = 1;
+  }
+
+  timerstart (&t);
+
+  if (previewon) preview = preview_create (simulation->domain, simulation->extents, threads);
+  else raster = raster_create (simulation->octree, threads);
+
+  if (n > 1)
+  {
+    avi = capture_open (width, height, 24, quality, MAX (threads, 2), path); /* frames are written while the next ones render */
+
+    for (i = 0; i < n; i ++)
+    {
+      frame (simulation, raster, preview, 360.0 * i / n, capture_buffer (avi));
+      capture_submit (avi);
+    }
+
+    full = capture_close (avi);
+  }
+  else
+  {
+    rgb = rgb_alloc (width, height);
+    frame (simulation, raster, preview, 0.0, rgb);
+    bmp_output (width, height, rgb, path);
+    rgb_free (rgb);
+    full = 0;
+  }
+
+  if (preview) preview_destroy (preview);
+  else raster_destroy (raster);
+
+  dt = timerend (&t);
+
+  printf ("Rendered %d frame(s) of %dx%d pixels into %s in %g s (%.1f frames/s", n, width, height, path, dt, dt > 0.0 ? n / dt : 0.0);
+  if (full) printf (", writer behind %d times", full);
+  printf (").\n");
+
+  free (path);
 }
 
 /* run simulation */
 static void run (struct simulation *simulation)
 {
+  if (simulation->octree) output (simulation); /* streamed meshes are already written */
+
+  if (snapshotpath) snapshot (simulation);
 }
 
 /* finalize simulation */
@@ -322,8 +647,28 @@ static char* getfile (int argc, char **argv)
       path = argv [n];
       fclose (f);
     }
-#if OPENGL
-    else if (strcmp (argv [n], "-v") == 0) vieweron = 1;
+    else if (strcmp (argv [n], "--threads") == 0)
+    {
+      if (++ n < argc)
+      {
+	sscanf (argv [n], "%d", &threads);
+      }
+    }
+    else if (strcmp (argv [n], "--stream") == 0)
+    {
+      double mb = 0.0;
+
+      if (++ n < argc && sscanf (argv [n], "%lf", &mb) == 1 && mb > 0.0) budget = (size_t) (mb * 1048576.0);
+    }
+    else if (strcmp (argv [n], "--stats") == 0) statson = 1;
+    else if (strcmp (argv [n], "--stats-json") == 0)
+    {
+      if (++ n < argc)
+      {
+	statspath = argv [n];
+	statson = 1;
+      }
+    }
     else if (strcmp (argv [n], "-g") == 0)
     {
       if (++ n < argc)
@@ -331,6 +676,28 @@ static char* getfile (int argc, char **argv)
 	sscanf (argv [n], "%dx%d", &width, &height);
       }
     }
+    else if (strcmp (argv [n], "--snapshot") == 0)
+    {
+      if (++ n < argc) snapshotpath = argv [n];
+    }
+    else if (strcmp (argv [n], "--frames") == 0)
+    {
+      if (++ n < argc)
+      {
+	sscanf (argv [n], "%d", &frames);
+      }
+    }
+    else if (strcmp (argv [n], "--preview") == 0) previewon = 1;
+    else if (strcmp (argv [n], "--quality") == 0)
+    {
+      if (++ n < argc)
+      {
+	sscanf (argv [n], "%d", &quality);
+	quality = MAX (0, MIN (quality, 100));
+      }
+    }
+#if OPENGL
+    else if (strcmp (argv [n], "-v") == 0) vieweron = 1;
 #endif
   }
 
@@ -344,12 +711,16 @@ int main (int argc, char **argv)
   int inputerror;
 
 #if OPENGL
-  char *synopsis = "SYNOPSIS: oaktree [-v] [-g WIDTHxHEIGHT] path\n";
+  char *synopsis = "SYNOPSIS: oaktree [-v] [-g WIDTHxHEIGHT] [--threads N] [--stream MB] [--stats] [--stats-json FILE]\n"
+                   "                 [--snapshot NAME.bmp|NAME.avi] [--frames N] [--quality Q] [--preview] path\n";
 #else
-  char *synopsis = "SYNOPSIS: oaktree path\n";
+  char *synopsis = "SYNOPSIS: oaktree [-g WIDTHxHEIGHT] [--threads N] [--stream MB] [--stats] [--stats-json FILE]\n"
+                   "                 [--snapshot NAME.bmp|NAME.avi] [--frames N] [--quality Q] [--preview] path\n";
 #endif
   char *path = getfile (argc, argv);
 
+  if (statson) stats_create (threads);
+
   if (!path) printf ("%s", synopsis);
   else inputerror = input (path);
 
@@ -362,10 +733,14 @@ int main (int argc, char **argv)
   }
 
 #if OPENGL
-  if (vieweron && !inputerror)
+  if (vieweron && !inputerror && (!budget || previewon)) /* streamed meshes are not kept for viewing */
   {
     REAL extents [6] = {-1, -1, -1, 1, 1, 1};
 
+    viewer_avi_quality (quality);
+
+    if (previewon) render_item = PREVIEW;
+
     viewer (&argc, argv, "oeaktree", width, height, extents, menu,
       init, idle, quit, render, key, keyspec, mouse, motion, passive);
   }
@@ -378,6 +753,15 @@ int main (int argc, char **argv)
     }
   }
 
+  if (stats)
+  {
+    stats_print (stdout);
+
+    if (statspath && !stats_json (statspath)) fprintf (stderr, "Writing statistics to %s has failed\n", statspath);
+
+    stats_destroy ();
+  }
+
   for (s = simulation; s; s = n)
   {
     n = s->next;
@@ -29,10 +29,38 @@ struct cylinder
 
 struct mls
 {
-  REAL (*op) [6], r, s;
+  REAL (*op) [6], r, s, t; /* t: truncation radius as a multiple of r, non-positive for none */
 
   int nop;
 
+  REAL lo [3], h; /* uniform grid index: lower corner and cell size */
+
+  int n [3], *cell, *seed; /* grid size, first point of each cell (points are sorted by cell) and far field point of each cell */
+
+  REAL (*bound) [8]; /* per cell normal bounds and normal projection bounds of points relative to cell center */
+
+  short scolor;
+};
+
+struct bnode /* bounding volume hierarchy node; inner nodes have count zero, left child next and right child at first */
+{
+  REAL box [6];
+
+  int first, count;
+};
+
+struct trimesh
+{
+  REAL (*p) [3], s, o; /* welded vertices, sign and offset */
+
+  int (*t) [3], np, nt; /* triangle vertex indices (sorted by hierarchy leaf) and counts */
+
+  REAL (*n) [3], (*en) [3][3], (*vn) [3]; /* face, edge and vertex pseudo-normals */
+
+  struct bnode *node; /* hierarchy nodes in pre-order */
+
+  int nnode;
+
   short scolor;
 };
 
@@ -43,12 +71,38 @@ struct fillet
   short scolor;
 };
 
+struct instruction
+{
+  short what;
+
+  union
+  {
+    struct halfspace halfspace;
+    struct sphere sphere;
+    struct cylinder cylinder;
+    struct mls *mls;
+    struct trimesh *trimesh;
+    struct fillet fillet;
+  } data; /* inlined leaf parameters */
+};
+
+struct tape
+{
+  struct instruction *code; /* post-order instructions */
+
+  int size, depth; /* instructions count and evaluation stack depth */
+
+  short root; /* code owner flag */
+};
+
 struct shape
 {
-  enum {ADD, MUL, HSP, SPH, CYL, MLS, FLT} what;
+  enum {ADD, MUL, HSP, SPH, CYL, MLS, FLT, MESH} what;
 
   void *data;
 
+  struct tape *tape; /* evaluation tape of an inner node or NULL */
+
   struct shape *up, *left, *right;
 };
 
@@ -73,6 +127,18 @@ void shape_fillet (struct shape *shape, REAL c [3], REAL r, REAL fillet, short s
 /* return distance to shape at given point */
 REAL shape_evaluate (struct shape *shape, REAL *point);
 
+/* return distances to shape at n points */
+void shape_evaluate_batch (struct shape *shape, REAL (*points) [3], int n, REAL *out);
+
+/* bound shape distance over an axis-aligned box */
+void shape_interval (struct shape *shape, REAL box [6], REAL range [2]);
+
+/* return shape with branches dominated within a box removed; unchanged branches are shared with the input */
+struct shape* shape_prune (struct shape *shape, REAL box [6]);
+
+/* free pruned shape nodes that are not shared with the input shape */
+void shape_prune_destroy (struct shape *pruned, struct shape *shape);
+
 /* compute shape extents */
 void shape_extents (struct shape *shape, REAL *extents);
 
@@ -88,6 +154,51 @@ int shape_leaf_in_union (struct shape *leaf);
 /* free shape memory */
 void shape_destroy (struct shape *shape);
 
+/* (re)build MLS point index; this reorders points */
+void mls_index (struct mls *mls);
+
+/* return distance to an MLS leaf at given point */
+REAL mls_evaluate (struct mls *mls, REAL *point);
+
+/* compute MLS leaf normal at given point */
+void mls_normal (struct mls *mls, REAL *point, REAL *normal);
+
+/* bound MLS leaf distance over a box given by center and half extents */
+void mls_interval (struct mls *mls, REAL c [3], REAL h [3], REAL range [2]);
+
+/* create mesh leaf from count triangles given by vertex coordinates; NULL if all are degenerate */
+struct trimesh* trimesh_create (REAL *triang, int count);
+
+/* (re)build mesh leaf hierarchy and pseudo-normals; this reorders triangles */
+void trimesh_index (struct trimesh *mesh);
+
+/* return distance to a mesh leaf at given point */
+REAL trimesh_evaluate (struct trimesh *mesh, REAL *point);
+
+/* compute mesh leaf normal at given point */
+void trimesh_normal (struct trimesh *mesh, REAL *point, REAL *normal);
+
+/* bound mesh leaf distance over a box given by center and half extents */
+void trimesh_interval (struct trimesh *mesh, REAL c [3], REAL h [3], REAL range [2]);
+
+/* compute mesh leaf extents */
+void trimesh_extents (struct trimesh *mesh, REAL *extents);
+
+/* copy mesh leaf */
+struct trimesh* trimesh_copy (struct trimesh *mesh);
+
+/* free mesh leaf */
+void trimesh_destroy (struct trimesh *mesh);
+
+/* compile shape into an evaluation tape; the shape must not be modified afterwards */
+void shape_compile (struct shape *shape);
+
+/* return distance to a compiled shape at given point */
+REAL tape_evaluate (struct tape *tape, REAL *point);
+
+/* free tape memory */
+void tape_destroy (struct tape *tape);
+
 struct domain
 {
   struct shape *shape;
@@ -96,6 +207,10 @@ struct domain
 
   REAL grid;
 
+  long lookups, hits; /* corner value cache statistics */
+
+  double refinement, adjacency; /* phase wall times */
+
   struct domain *prev, *next;
 };
 
@@ -107,15 +222,20 @@ struct face
 
   REAL area;
 
-  REAL (*t) [3][3];
+  int (*t) [3]; /* triangle vertex indices into the octree mesh; shared by twin internal faces */
 
   short n;
 
+  char flip; /* triangles are wound in reverse */
+
   struct cell *adj;
 
   struct face *next;
 };
 
+/* return mesh index of vertex j of face triangle i in the face's own winding */
+#define FACE_VERTEX(face, i, j) ((face)->t [i][(face)->flip ? 2-(j) : (j)])
+
 struct cell
 {
   struct octree *octree;
@@ -134,20 +254,64 @@ struct octree
   struct cell *cell;
 
   struct octree *up, *down [8];
+
+  struct arena *arena; /* nodes, cells, faces and triangles of the whole tree */
+
+  struct mesh *mesh; /* welded vertices of the whole tree */
 };
 
 /* create octree */
 struct octree* octree_create (REAL extents [6]);
 
-/* insert domain and refine octree down to a cutoff edge length */
-void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cutoff);
+/* insert domain and refine octree down to a cutoff edge length using a number of threads */
+void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cutoff, int threads);
 
-/* insert triangles into octree */
-void octree_insert_triangles (struct octree *octree, REAL *triang, int count, REAL cutoff);
+/* mesh a domain one subtree at a time, keeping every refined subtree within a memory budget in bytes where possible;
+ * finished subtrees are passed to output before being freed and complete is called once an octant is done; return the number of subtrees */
+int octree_stream_domain (REAL extents [6], struct domain *domain, REAL cutoff, int threads, size_t budget,
+  void (*output) (struct octree *octree, void *data), void (*complete) (REAL extents [6], void *data), void *data);
 
-/* free octree memory */
+/* insert triangles into octree using a number of threads; triangles go to every leaf octant they overlap */
+void octree_insert_triangles (struct octree *octree, REAL *triang, int count, REAL cutoff, int threads);
+
+/* free octree memory in one go; given a root */
 void octree_destroy (struct octree *octree);
 
+#define LINEAR_BITS 21 /* lattice bits per axis of Morton keys */
+
+struct lnode
+{
+  unsigned long long key; /* Morton key of the lower corner on the finest lattice */
+
+  int level;
+
+  struct cell *cell;
+};
+
+struct linear
+{
+  REAL extents [6];
+
+  int depth, size;
+
+  struct lnode *node; /* pre-order, sorted by (key, level) */
+};
+
+/* create linear octree from a pointer octree */
+struct linear* linear_create (struct octree *octree);
+
+/* compute node extents from its key and level */
+void linear_extents (struct linear *linear, struct lnode *node, REAL extents [6]);
+
+/* return index of the node following a node's subtree */
+int linear_next (struct linear *linear, int i);
+
+/* return index of the face neighbour (direction 0..5 for -x, +x, -y, +y, -z, +z) at the same or a coarser level, or -1 */
+int linear_neighbour (struct linear *linear, int i, int direction);
+
+/* free linear octree */
+void linear_destroy (struct linear *linear);
+
 struct simulation
 {
   char *outpath;
@@ -170,7 +334,7 @@ struct simulation
 /* global simulations list */
 extern struct simulation *simulation;
 
-/* STL read */
-REAL* stlread (const char *path, int *count);
+/* read binary or ASCII STL into an array of count triangles, parsing ASCII with a number of threads; NULL if unreadable */
+REAL* stlread (const char *path, int *count, int threads);
 
 #endif
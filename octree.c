@@ -3,30 +3,229 @@
  * --------
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <string.h>
 #include <stdlib.h>
 #include <float.h>
 #include <stdio.h>
+#include <math.h>
 #include "polygon.h"
 #include "oaktree.h"
+#include "arena.h"
+#include "mesh.h"
+#include "pool.h"
+#include "timer.h"
+#include "stats.h"
 #include "error.h"
-#include "sort.h"
 #include "alg.h"
 
 #define PRIMITIVES_PER_OCTANT 24
 
+#define LATTICE_BITS 21 /* bits per lattice coordinate of the corner value cache */
+
+#define CACHED_TAPE_SIZE 16 /* shapes with shorter tapes and no MLS are evaluated rather than cached */
+
+#define SPAWN_SIZE 8 /* octants with half edges above SPAWN_SIZE * cutoff refine their children as parallel tasks */
+
+#define BIN_SPAWN 1024 /* octants binning more triangles than this bin their children as parallel tasks */
+
+#define STREAM_BUDGET (1 << 20) /* smallest streaming budget; an empty subtree takes about 150 KB */
+
+struct corner /* cached shape value at a lattice point */
+{
+  unsigned long long key; /* packed lattice coordinates plus one; zero marks empty slots */
+
+  struct shape *shape;
+
+  REAL value;
+};
+
+struct cache /* corner value cache */
+{
+  struct corner *table;
+
+  int size, count; /* size is a power of two */
+
+  REAL lo [3], h [3]; /* lattice origin and spacing */
+
+  long lookups, hits;
+};
+
+struct refine /* domain refinement context */
+{
+  struct domain *domain;
+
+  struct pool *pool; /* NULL for serial refinement */
+
+  struct cache **cache; /* per worker */
+
+  struct edges **edges; /* per worker, shared-edge vertices; NULL entries without a corner lattice */
+
+  REAL cutoff;
+
+  size_t budget; /* memory of a streamed subtree; zero for no limit */
+
+  int workers;
+
+  char *over; /* per worker flags of an exceeded budget */
+};
+
+struct job /* subtree refinement task */
+{
+  struct octree *octree;
+
+  struct shape *up;
+
+  struct refine *refine;
+};
+
+/* create corner value cache with the lattice of the finest octants below a root octant */
+static struct cache* cache_create (REAL extents [6], REAL cutoff)
+{
+  struct cache *cache;
+  int k, l;
+
+  ERRMEM (cache = calloc (1, sizeof (struct cache)));
+
+  for (k = 0; k < 3; k ++)
+  {
+    cache->lo [k] = extents [k];
+    cache->h [k] = extents [k+3] - extents [k];
+    for (l = 0; cache->h [k] > 0.5*cutoff; l ++) cache->h [k] *= 0.5; /* octants are not split below cutoff */
+
+    if (l >= LATTICE_BITS) /* too deep: disable caching */
+    {
+      free (cache);
+      return NULL;
+    }
+  }
+
+  cache->size = 1024;
+  ERRMEM (cache->table = calloc (cache->size, sizeof (struct corner)));
+
+  return cache;
+}
+
+/* cache slot of a shape value at a lattice key */
+static struct corner* slot (struct cache *cache, unsigned long long key, struct shape *shape)
+{
+  unsigned long long hash = (key ^ (unsigned long long) (size_t) shape) * 0x9E3779B97F4A7C15ULL;
+  int i = (int) (hash >> 40) & (cache->size - 1);
+
+  while (cache->table[i].key && (cache->table[i].key != key || cache->table[i].shape != shape))
+  {
+    i = (i + 1) & (cache->size - 1); /* linear probing */
+  }
+
+  return &cache->table [i];
+}
+
+/* double cache table size */
+static void grow (struct cache *cache)
+{
+  struct corner *old = cache->table, *c;
+  int i, size = cache->size;
+
+  cache->size *= 2;
+  ERRMEM (cache->table = calloc (cache->size, sizeof (struct corner)));
+
+  for (i = 0; i < size; i ++)
+  {
+    if (old[i].key)
+    {
+      c = slot (cache, old[i].key, old[i].shape);
+      *c = old [i];
+    }
+  }
+
+  free (old);
+}
+
+/* non-zero lattice key of a point */
+static unsigned long long lattice (struct cache *cache, REAL p [3])
+{
+  unsigned long long key;
+  int j, k;
+
+  for (key = k = 0; k < 3; k ++)
+  {
+    j = (int) floor ((p[k] - cache->lo[k]) / cache->h[k] + 0.5);
+    key = (key << LATTICE_BITS) | (unsigned long long) j;
+  }
+
+  return key + 1;
+}
+
+/* return distances to shape at n octant corners, evaluating only those not cached yet */
+static void cached (struct cache *cache, struct shape *shape, REAL (*p) [3], int n, REAL *out)
+{
+  REAL miss [8][3], v [8];
+  struct corner *c [8];
+  unsigned long long key;
+  int i, m, w [8];
+
+  if (!cache || !(shape->what == MLS || (shape->tape && shape->tape->size >= CACHED_TAPE_SIZE))) /* cheap to evaluate */
+  {
+    shape_evaluate_batch (shape, p, n, out);
+    return;
+  }
+
+  if (2 * (cache->count + n) > cache->size) grow (cache);
+
+  for (m = i = 0; i < n; i ++)
+  {
+    key = lattice (cache, p[i]);
+
+    c [i] = slot (cache, key, shape);
+
+    if (c[i]->key) out [i] = c[i]->value;
+    else
+    {
+      c[i]->key = key;
+      c[i]->shape = shape;
+      COPY (p[i], miss [m]);
+      c [m] = c [i]; /* misses are compacted at the front */
+      w [m ++] = i;
+    }
+  }
+
+  cache->lookups += n;
+  cache->hits += n - m;
+  cache->count += m;
+
+  if (m)
+  {
+    shape_evaluate_batch (shape, miss, m, v);
+
+    for (i = 0; i < m; i ++) out [w[i]] = c[i]->value = v [i];
+  }
+}
+
 /* accuracy test */
-static int accurate (REAL q [3], REAL d [8], struct shape *shape, REAL cutoff)
+static int accurate (REAL q [3], REAL d [8], struct shape *shape, struct cache *cache, REAL cutoff)
 {
   REAL u, v, w;
 
   u = 0.125 * (d[0]+d[1]+d[2]+d[3]+d[4]+d[5]+d[6]+d[7]);
-  v = shape_evaluate (shape, q);
+  cached (cache, shape, (REAL (*)[3]) q, 1, &v);
   w = u - v;
   if (fabs (w) > cutoff) return 0;
   else return 1;
 }
 
+/* test whether a leaf is proven not to cross an octant and to pass its accuracy test */
+static int irrelevant (struct shape *leaf, REAL *x, REAL cutoff)
+{
+  REAL r [2];
+
+  shape_interval (leaf, x, r);
+
+  if (r[0] <= 0.0 && r[1] >= 0.0) return 0;
+
+  return leaf->what == HSP || r[1] - r[0] <= 0.5 * cutoff; /* the corner mean of a linear or nearly constant leaf is close to its centre value */
+}
+
 /* find zero point for u * v < 0 */
 inline static void zeropoint (REAL a [3], REAL b [3], REAL u, REAL v, REAL z [3])
 {
@@ -100,9 +299,7 @@ static void split (struct shape *src, REAL t [3][3], struct shape **leaf, int k,
   }
   else
   {
-    d [0] = shape_evaluate (leaf[0], t[0]);
-    d [1] = shape_evaluate (leaf[0], t[1]);
-    d [2] = shape_evaluate (leaf[0], t[2]);
+    shape_evaluate_batch (leaf[0], t, 3, d);
 
     if (fabs (d[0]) < cutoff)
     {
@@ -223,64 +420,84 @@ done:
   }
 }
 
+/* store triangles into a face as welded vertex index triples and return their area */
+static REAL weld (struct octree *octree, REAL (*s) [3][3], int m, struct face *face, int worker)
+{
+  REAL a, area = 0.0;
+  int i, j;
+
+  face->t = arena_alloc (octree->arena, worker, m * sizeof (int [3]));
+
+  for (i = 0; i < m; i ++)
+  {
+    for (j = 0; j < 3; j ++) face->t [i][j] = mesh_vertex (octree->mesh, s [i][j]);
+    TRIANGLE_AREA (s[i][0], s[i][1], s[i][2], a);
+    area += a;
+  }
+
+  face->n = m;
+
+  return area;
+}
+
 /* trim internal face of a boundary cell and return its area */
-static REAL trim (struct cell *cell, REAL *x, int type, REAL cutoff, struct face *face)
+static REAL trim (struct cell *cell, REAL *x, int type, REAL cutoff, struct face *face, int worker)
 {
   struct shape *leaf [PRIMITIVES_PER_OCTANT];
-  REAL t0 [3][3], t1 [3][3], (*s) [3][3];
-  REAL a, area = 0.0;
+  REAL t [2][3][3], (*s) [3][3];
+  REAL area = 0.0;
   int n, m, size;
   struct face *f;
 
   switch (type)
   {
   case -3: /* -xy */
-    t0[0][0] = x[0]; t0[0][1] = x[1]; t0[0][2] = x[2];
-    t0[1][0] = x[0]; t0[1][1] = x[4]; t0[1][2] = x[2];
-    t0[2][0] = x[3]; t0[2][1] = x[1]; t0[2][2] = x[2];
-    t1[0][0] = x[0]; t1[0][1] = x[4]; t1[0][2] = x[2];
-    t1[1][0] = x[3]; t1[1][1] = x[4]; t1[1][2] = x[2];
-    t1[2][0] = x[3]; t1[2][1] = x[1]; t1[2][2] = x[2];
+    t[0][0][0] = x[0]; t[0][0][1] = x[1]; t[0][0][2] = x[2];
+    t[0][1][0] = x[0]; t[0][1][1] = x[4]; t[0][1][2] = x[2];
+    t[0][2][0] = x[3]; t[0][2][1] = x[1]; t[0][2][2] = x[2];
+    t[1][0][0] = x[0]; t[1][0][1] = x[4]; t[1][0][2] = x[2];
+    t[1][1][0] = x[3]; t[1][1][1] = x[4]; t[1][1][2] = x[2];
+    t[1][2][0] = x[3]; t[1][2][1] = x[1]; t[1][2][2] = x[2];
   break;
   case -2: /* -xz */
-    t0[0][0] = x[0]; t0[0][1] = x[1]; t0[0][2] = x[2];
-    t0[1][0] = x[3]; t0[1][1] = x[1]; t0[1][2] = x[5];
-    t0[2][0] = x[0]; t0[2][1] = x[1]; t0[2][2] = x[5];
-    t1[0][0] = x[0]; t1[0][1] = x[1]; t1[0][2] = x[2];
-    t1[1][0] = x[3]; t1[1][1] = x[1]; t1[1][2] = x[2];
-    t1[2][0] = x[3]; t1[2][1] = x[1]; t1[2][2] = x[5];
+    t[0][0][0] = x[0]; t[0][0][1] = x[1]; t[0][0][2] = x[2];
+    t[0][1][0] = x[3]; t[0][1][1] = x[1]; t[0][1][2] = x[5];
+    t[0][2][0] = x[0]; t[0][2][1] = x[1]; t[0][2][2] = x[5];
+    t[1][0][0] = x[0]; t[1][0][1] = x[1]; t[1][0][2] = x[2];
+    t[1][1][0] = x[3]; t[1][1][1] = x[1]; t[1][1][2] = x[2];
+    t[1][2][0] = x[3]; t[1][2][1] = x[1]; t[1][2][2] = x[5];
   break;
   case -1: /* -yz */
-    t0[0][0] = x[0]; t0[0][1] = x[4]; t0[0][2] = x[2];
-    t0[1][0] = x[0]; t0[1][1] = x[1]; t0[1][2] = x[5];
-    t0[2][0] = x[0]; t0[2][1] = x[4]; t0[2][2] = x[5];
-    t1[0][0] = x[0]; t1[0][1] = x[4]; t1[0][2] = x[2];
-    t1[1][0] = x[0]; t1[1][1] = x[1]; t1[1][2] = x[2];
-    t1[2][0] = x[0]; t1[2][1] = x[1]; t1[2][2] = x[5];
+    t[0][0][0] = x[0]; t[0][0][1] = x[4]; t[0][0][2] = x[2];
+    t[0][1][0] = x[0]; t[0][1][1] = x[1]; t[0][1][2] = x[5];
+    t[0][2][0] = x[0]; t[0][2][1] = x[4]; t[0][2][2] = x[5];
+    t[1][0][0] = x[0]; t[1][0][1] = x[4]; t[1][0][2] = x[2];
+    t[1][1][0] = x[0]; t[1][1][1] = x[1]; t[1][1][2] = x[2];
+    t[1][2][0] = x[0]; t[1][2][1] = x[1]; t[1][2][2] = x[5];
   break;
   case 1: /* yz */
-    t0[0][0] = x[3]; t0[0][1] = x[4]; t0[0][2] = x[2];
-    t0[1][0] = x[3]; t0[1][1] = x[4]; t0[1][2] = x[5];
-    t0[2][0] = x[3]; t0[2][1] = x[1]; t0[2][2] = x[5];
-    t1[0][0] = x[3]; t1[0][1] = x[4]; t1[0][2] = x[2];
-    t1[1][0] = x[3]; t1[1][1] = x[1]; t1[1][2] = x[5];
-    t1[2][0] = x[3]; t1[2][1] = x[1]; t1[2][2] = x[2];
+    t[0][0][0] = x[3]; t[0][0][1] = x[4]; t[0][0][2] = x[2];
+    t[0][1][0] = x[3]; t[0][1][1] = x[4]; t[0][1][2] = x[5];
+    t[0][2][0] = x[3]; t[0][2][1] = x[1]; t[0][2][2] = x[5];
+    t[1][0][0] = x[3]; t[1][0][1] = x[4]; t[1][0][2] = x[2];
+    t[1][1][0] = x[3]; t[1][1][1] = x[1]; t[1][1][2] = x[5];
+    t[1][2][0] = x[3]; t[1][2][1] = x[1]; t[1][2][2] = x[2];
   break;
   case 2: /* xz */
-    t0[0][0] = x[0]; t0[0][1] = x[4]; t0[0][2] = x[2];
-    t0[1][0] = x[0]; t0[1][1] = x[4]; t0[1][2] = x[5];
-    t0[2][0] = x[3]; t0[2][1] = x[4]; t0[2][2] = x[5];
-    t1[0][0] = x[0]; t1[0][1] = x[4]; t1[0][2] = x[2];
-    t1[1][0] = x[3]; t1[1][1] = x[4]; t1[1][2] = x[5];
-    t1[2][0] = x[3]; t1[2][1] = x[4]; t1[2][2] = x[2];
+    t[0][0][0] = x[0]; t[0][0][1] = x[4]; t[0][0][2] = x[2];
+    t[0][1][0] = x[0]; t[0][1][1] = x[4]; t[0][1][2] = x[5];
+    t[0][2][0] = x[3]; t[0][2][1] = x[4]; t[0][2][2] = x[5];
+    t[1][0][0] = x[0]; t[1][0][1] = x[4]; t[1][0][2] = x[2];
+    t[1][1][0] = x[3]; t[1][1][1] = x[4]; t[1][1][2] = x[5];
+    t[1][2][0] = x[3]; t[1][2][1] = x[4]; t[1][2][2] = x[2];
   break;
   case 3: /* xy */
-    t0[0][0] = x[0]; t0[0][1] = x[1]; t0[0][2] = x[5];
-    t0[1][0] = x[3]; t0[1][1] = x[1]; t0[1][2] = x[5];
-    t0[2][0] = x[0]; t0[2][1] = x[4]; t0[2][2] = x[5];
-    t1[0][0] = x[0]; t1[0][1] = x[4]; t1[0][2] = x[5];
-    t1[1][0] = x[3]; t1[1][1] = x[1]; t1[1][2] = x[5];
-    t1[2][0] = x[3]; t1[2][1] = x[4]; t1[2][2] = x[5];
+    t[0][0][0] = x[0]; t[0][0][1] = x[1]; t[0][0][2] = x[5];
+    t[0][1][0] = x[3]; t[0][1][1] = x[1]; t[0][1][2] = x[5];
+    t[0][2][0] = x[0]; t[0][2][1] = x[4]; t[0][2][2] = x[5];
+    t[1][0][0] = x[0]; t[1][0][1] = x[4]; t[1][0][2] = x[5];
+    t[1][1][0] = x[3]; t[1][1][1] = x[1]; t[1][1][2] = x[5];
+    t[1][2][0] = x[3]; t[1][2][1] = x[4]; t[1][2][2] = x[5];
   break;
   }
 
@@ -295,218 +512,314 @@ static REAL trim (struct cell *cell, REAL *x, int type, REAL cutoff, struct face
     size = 8;
     ERRMEM (s = malloc (size * sizeof (REAL [3][3])));
 
-    split (NULL, t0, leaf, n, cell->domain->shape, cutoff, &s, &m, &size);
-    split (NULL, t1, leaf, n, cell->domain->shape, cutoff, &s, &m, &size);
-
-    if (m != 0)
-    {
-      ERRMEM (face->t = malloc (m * sizeof (REAL [3][3])))
-
-      for (n = 0; n < m; n ++)
-      {
-	COPY (s [n][0], face->t [n][0]);
-	COPY (s [n][1], face->t [n][1]);
-	COPY (s [n][2], face->t [n][2]);
-	TRIANGLE_AREA (s[n][0], s[n][1], s[n][2], a);
-	area += a;
-      }
+    split (NULL, t[0], leaf, n, cell->domain->shape, cutoff, &s, &m, &size);
+    split (NULL, t[1], leaf, n, cell->domain->shape, cutoff, &s, &m, &size);
 
-      face->n = m;
-    }
+    if (m != 0) area = weld (cell->octree, s, m, face, worker);
 
     free (s);
   }
-  else
-  {
-    ERRMEM (face->t = malloc (2 * sizeof (REAL [3][3])))
-
-    COPY (t0 [0], face->t [0][0]);
-    COPY (t0 [1], face->t [0][1]);
-    COPY (t0 [2], face->t [0][2]);
-    TRIANGLE_AREA (t0[0], t0[1], t0[2], a);
-    area += a;
-    COPY (t1 [0], face->t [1][0]);
-    COPY (t1 [1], face->t [1][1]);
-    COPY (t1 [2], face->t [1][2]);
-    TRIANGLE_AREA (t1[0], t1[1], t1[2], a);
-    area += a;
-
-    face->n = 2;
-  }
+  else area = weld (cell->octree, t, 2, face, worker);
 
   return area;
 }
 
-/* invert input face into output face and return its area */
+/* make output face the twin of input face, sharing its triangles in reverse winding, and return its area */
 static REAL invert (struct face *in, struct face *out)
 {
-  int i;
-
   out->normal [0] = -in->normal[0];
   out->normal [1] = -in->normal[1];
   out->normal [2] = -in->normal[2];
 
-  if (in->t)
-  {
-    ERRMEM (out->t = malloc (in->n * sizeof (REAL [3][3])));
+  out->t = in->t;
+  out->n = in->n;
+  out->flip = !in->flip;
 
-    for (i = 0; i < in->n; i ++)
-    {
-      COPY (in->t[i][0], out->t[i][2]);
-      COPY (in->t[i][1], out->t[i][1]);
-      COPY (in->t[i][2], out->t[i][0]);
-    }
+  return in->area;
+}
+
+/* return type of the face through which octant x touches an overlapping same or coarser octant y and set its normal, or return 0 */
+static int touch (REAL *x, REAL *y, REAL n [3])
+{
+  REAL p [3];
+  int i = 0;
+
+  MID (x, x+3, p);
+
+  if (p[0] > y[0] && p[0] < y[3]) i |= 0x1;
+  if (p[1] > y[1] && p[1] < y[4]) i |= 0x2;
+  if (p[2] > y[2] && p[2] < y[5]) i |= 0x4;
 
-    out->n = in->n;
+  switch (i)
+  {
+  case 3: /* xy */
+  if (p[2] < y[2]) { VECTOR (n, 0, 0, 1); return 3; }
+  else { VECTOR (n, 0, 0, -1); return -3; }
+  case 5: /* xz */
+  if (p[1] < y[1]) { VECTOR (n, 0, 1, 0); return 2; }
+  else { VECTOR (n, 0, -1, 0); return -2; }
+  case 6: /* yz */
+  if (p[0] < y[0]) { VECTOR (n, 1, 0, 0); return 1; }
+  else { VECTOR (n, -1, 0, 0); return -1; }
   }
 
-  return in->area;
+  return 0; /* x and y don't overlap through face */
 }
 
-/* drop (c, y) down the tree and complete adjacency */
-static void drop (struct octree *octree, struct domain *domain, REAL cutoff, struct cell *c, REAL *y)
+/* adjacency of domain cells */
+struct adjacency
 {
-  struct cell *cell = octree->cell; /* current domain cells can only be the heads of octree cell lists  */
-  REAL *x = octree->extents, p [3], n [3];
-  struct face *face;
-  int i, type;
+  struct linear *linear;
+  struct domain *domain;
+  REAL cutoff;
+  int *item; /* linear indices of domain cells */
+  struct face **pending; /* per item list of face pairs awaiting linking */
+  int size;
+};
 
-  if (y[3] < x[0] || y[4] < x[1] || y[5] < x[2] || y[0] > x[3] || y[1] > x[4] || y[2] > x[5]) return; /* doesn't overlap */
+/* adjacency task over a range of items */
+struct range
+{
+  struct adjacency *adjacency;
+  int from, to;
+};
 
-  if (cell == c) return; /* slef */
+#define RANGE 64 /* items per adjacency task */
 
-  if (cell && cell->domain == domain) /* c and cell overlap in the same domain */
-  {
-    MID (x, x+3, p);
+/* find face pairs between the cell at linear index i and its same domain neighbours of the same or a finer level */
+static struct face* neighbours (struct adjacency *adjacency, int i, int worker)
+{
+  struct linear *linear = adjacency->linear;
+  struct cell *c = linear->node[i].cell, *cell;
+  struct face *pending = NULL, *face;
+  REAL x [6], y [6], n [3];
+  int d, j, k, end, type;
+  double start;
+
+  linear_extents (linear, &linear->node [i], y);
 
-    i = 0;
+  for (d = 0; d < 6; d ++)
+  {
+    j = linear_neighbour (linear, i, d);
 
-    if (p[0] > y[0] && p[0] < y[3]) i |= 0x1;
-    if (p[1] > y[1] && p[1] < y[4]) i |= 0x2;
-    if (p[2] > y[2] && p[2] < y[5]) i |= 0x4;
+    if (j < 0 || linear->node[j].level < linear->node[i].level) continue; /* coarser neighbour cells own the shared face */
 
-    switch (i)
+    for (k = j, end = linear_next (linear, j); k < end;) /* subtree of the same level neighbour */
     {
-    case 3: /* xy */
-    if (p[2] < y[2]) { VECTOR (n, 0, 0, 1); type = 3; }
-    else { VECTOR (n, 0, 0, -1); type = -3; }
-    break;
-    case 5: /* xz */
-    if (p[1] < y[1]) { VECTOR (n, 0, 1, 0); type = 2; }
-    else { VECTOR (n, 0, -1, 0); type = -2; }
-    break;
-    case 6: /* yz */
-    if (p[0] < y[0]) { VECTOR (n, 1, 0, 0); type = 1; }
-    else { VECTOR (n, -1, 0, 0); type = -1; }
-    break;
-    default:
-    return; /* c and cell don't overlap through face */
-    }
+      linear_extents (linear, &linear->node [k], x);
+
+      if (y[3] < x[0] || y[4] < x[1] || y[5] < x[2] || y[0] > x[3] || y[1] > x[4] || y[2] > x[5]) /* doesn't overlap */
+      {
+	k = linear_next (linear, k);
+	continue;
+      }
 
-    ERRMEM (face = calloc (1, sizeof (struct face)));
+      cell = linear->node[k].cell; /* current domain cells can only be the heads of octree cell lists  */
 
-    face->area = trim (cell, x, type, cutoff, face);
+      if (cell && cell->domain == adjacency->domain)
+      {
+	if ((type = touch (x, y, n)))
+	{
+	  face = arena_alloc (c->octree->arena, worker, 2 * sizeof (struct face)); /* the pair is abandoned below if empty */
 
-    if (face->area > 0.0)
-    {
-      COPY (n, face->normal);
-      face->leaf = NULL;
-      face->adj = c;
-      face->next = cell->face;
-      cell->face = face;
+	  start = stats_begin ();
 
-      ERRMEM (face = calloc  (1, sizeof (struct face)));
-      face->area = invert (cell->face, face);
-      face->leaf = NULL;
-      face->adj = cell;
-      face->next = c->face;
-      c->face = face;
+	  face->area = trim (cell, x, type, adjacency->cutoff, face, worker);
+
+	  stats_end (worker, STATS_TRIM, start);
+
+	  if (face->area > 0.0)
+	  {
+	    COPY (n, face->normal);
+	    face->adj = c;
+	    face[1].area = invert (face, face+1);
+	    face[1].adj = cell;
+	    face->next = pending;
+	    pending = face;
+	  }
+	}
+
+	k = linear_next (linear, k);
+      }
+      else k ++;
     }
-    else free (face);
-  }
-  else if (octree->down [0])
-  {
-    for (i = 0; i < 8; i ++) drop (octree->down [i], domain, cutoff, c, y);
   }
+
+  return pending;
 }
 
-/* auxiliary item */
-struct item
+/* adjacency task */
+static void adjacent (void *data, int worker)
 {
-  struct cell *cell;
-  REAL *extents;
-  short level;
-  struct item *next;
-};
+  struct range *range = data;
+  struct adjacency *adjacency = range->adjacency;
 
-/* collect cells from given domain into items list */
-static void collect_items (struct octree *octree, short level, struct domain *domain, struct item **list)
+  for (int i = range->from; i < range->to; i ++) adjacency->pending [i] = neighbours (adjacency, adjacency->item [i], worker);
+
+  free (range);
+}
+
+/* create cell adjacency */
+static void create_cell_adjacency (struct octree *octree, struct domain *domain, REAL cutoff, struct pool *pool)
 {
-  struct cell *cell = octree->cell;
-  struct item *item;
+  struct adjacency adjacency;
+  struct face *face, *next;
+  struct range *range;
+  struct group group;
+  struct cell *c;
+  double start;
   int i;
 
-  if (cell && cell->domain == domain)
-  {
-    ERRMEM (item = malloc (sizeof (struct item)));
+  start = stats_begin ();
 
-    item->extents = octree->extents;
-    item->cell = cell;
-    item->level = level;
+  adjacency.linear = linear_create (octree);
+  adjacency.domain = domain;
+  adjacency.cutoff = cutoff;
+  ERRMEM (adjacency.item = malloc (adjacency.linear->size * sizeof (int)));
 
-    item->next = *list;
-    *list = item;
-  }
-  else if (octree->down [0])
+  for (adjacency.size = i = 0; i < adjacency.linear->size;) /* domain cells */
   {
-    for (i = 0; i < 8; i ++) collect_items (octree->down [i], level+1, domain, list);
-  }
-}
+    c = adjacency.linear->node[i].cell;
 
-/* sort items by levels */
-#define LE(i, j) (i)->level <= (j)->level
-IMPLEMENT_LIST_SORT (SINGLE_LINKED, sort_items, struct item, prev, next, LE)
+    if (c && c->domain == domain)
+    {
+      adjacency.item [adjacency.size ++] = i;
+      i = linear_next (adjacency.linear, i);
+    }
+    else i ++;
+  }
 
-/* create cell adjacency */
-static void create_cell_adjacency (struct octree *octree, struct domain *domain, REAL cutoff)
-{
-  struct item *item = NULL, *next;
+  ERRMEM (adjacency.pending = malloc (adjacency.size * sizeof (struct face*)));
 
-  collect_items (octree, 0, domain, &item);
+  stats_end (0, STATS_LINEAR, start);
 
-  item = sort_items (item);
+  group.pending = 0;
 
-  for (; item; item = next)
+  for (i = 0; i < adjacency.size; i += RANGE) /* cells find their face pairs independently */
   {
-    next = item->next;
+    ERRMEM (range = malloc (sizeof (struct range)));
+    range->adjacency = &adjacency;
+    range->from = i;
+    range->to = MIN (i + RANGE, adjacency.size);
 
-    drop (octree, domain, cutoff, item->cell, item->extents);
+    if (pool) pool_spawn (pool, 0, &group, adjacent, range);
+    else adjacent (range, 0);
+  }
+
+  if (pool) pool_wait (pool, 0, &group);
+
+  start = stats_begin ();
 
-    free (item);
+  for (i = 0; i < adjacency.size; i ++) /* link face pairs in item order */
+  {
+    for (face = adjacency.pending [i]; face; face = next)
+    {
+      next = face->next;
+      c = face[1].adj;
+      face->next = c->face;
+      c->face = face;
+      c = face->adj;
+      face[1].next = c->face;
+      c->face = face+1;
+    }
   }
+
+  stats_end (0, STATS_LINK, start);
+
+  free (adjacency.pending);
+  free (adjacency.item);
+  linear_destroy (adjacency.linear);
 }
 
 /* create octree down to a cutoff edge length */
 struct octree* octree_create (REAL extents [6])
 {
+  struct arena *arena = arena_create (1);
   struct octree *octree;
 
-  ERRMEM (octree = calloc (1, sizeof (struct octree)));
+  octree = arena_alloc (arena, 0, sizeof (struct octree));
 
   COPY6 (extents, octree->extents);
 
+  octree->arena = arena;
+  octree->mesh = mesh_create ();
+
   return octree;
 }
 
-/* insert domain and refine octree down to a cutoff edge length */
-void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cutoff)
+/* create eight children next to each other given the lower, middle and upper corners */
+static void children (struct octree *octree, REAL p [3], REAL q [3], REAL r [3], int worker)
+{
+  static const char upper [8][3] = {{0,0,0}, {0,1,0}, {1,1,0}, {1,0,0}, {0,0,1}, {0,1,1}, {1,1,1}, {1,0,1}};
+  struct octree *down;
+  int i, k;
+
+  down = arena_alloc (octree->arena, worker, 8 * sizeof (struct octree));
+
+  for (i = 0; i < 8; i ++)
+  {
+    for (k = 0; k < 3; k ++)
+    {
+      down[i].extents [k] = upper[i][k] ? q[k] : p[k];
+      down[i].extents [k+3] = upper[i][k] ? r[k] : q[k];
+    }
+
+    down[i].up = octree;
+    down[i].arena = octree->arena;
+    down[i].mesh = octree->mesh;
+    octree->down [i] = &down [i];
+  }
+}
+
+static void subtree (void *data, int worker);
+
+/* return memory used by a worker's arena chunks, corner values and edge crossings */
+static size_t worker_bytes (struct refine *refine, struct arena *arena, int worker)
 {
-  REAL t [5][3][3], p [8][3], q [2][3], (*d) [8], (*s) [3][3], *x = octree->extents, a;
+  size_t bytes = arena_bytes (arena, worker);
+
+  if (refine->cache [worker]) bytes += sizeof (struct cache) + refine->cache[worker]->size * sizeof (struct corner);
+
+  if (refine->edges [worker]) bytes += edges_bytes (refine->edges [worker]);
+
+  return bytes;
+}
+
+/* refine octree against a shape pruned to the parent octant */
+static void insert (struct octree *octree, struct shape *up, struct refine *refine, int worker)
+{
+  struct cache *cache = refine->cache [worker];
+  struct edges *edges = refine->edges [worker];
+  struct domain *domain = refine->domain;
+  unsigned long long key [8];
+  REAL cutoff = refine->cutoff;
+  struct group group;
+  struct job *job;
+  REAL t [5][3][3], p [8][3], q [2][3], (*d) [8], (*s) [3][3], *x = octree->extents, r [2], e [6];
   char allaccurate, inside, *flagged;
-  int i, j, k, l, n, m, o, size;
-  struct shape **leaf, **tmp;
+  int i, j, k, l, n, m, size;
+  struct shape **leaf, **tmp, *shape;
   struct face *list, *face;
   struct cell *cell;
+  double start;
+
+  if (refine->budget && worker_bytes (refine, octree->arena, worker) * refine->workers + mesh_bytes (octree->mesh) > refine->budget) /* streamed subtree too large; it will be discarded */
+  {
+    refine->over [worker] = 1;
+    return;
+  }
+
+  for (i = 0; i < 3; i ++) /* split () perturbs triangle points up to sqrt(2)*cutoff outside of the octant */
+  {
+    e [i] = x [i] - 2.0*cutoff;
+    e [i+3] = x [i+3] + 2.0*cutoff;
+  }
+
+  start = stats_begin ();
+
+  shape = shape_prune (up, e); /* drop branches dominated within the octant */
+
+  stats_end (worker, STATS_PRUNE, start);
 
   VECTOR (p[0], x[0], x[1], x[2]);
   VECTOR (p[1], x[0], x[4], x[2]);
@@ -520,14 +833,46 @@ void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cu
   MID (p[0], p[6], q[0]);
   SUB (q[0], p[0], q[1]);
 
-  n = shape_unique_leaves (domain->shape, q[0], LEN (q[1]), &leaf, &inside);
+  start = stats_begin ();
+
+  shape_interval (shape, x, r);
+
+  stats_end (worker, STATS_INTERVAL, start);
+
+  if (r[0] > 0.0 || r[1] < 0.0) /* octant proven outside or inside */
+  {
+    inside = r[1] < 0.0;
+    n = 0;
+  }
+  else
+  {
+    start = stats_begin ();
+
+    n = shape_unique_leaves (shape, q[0], LEN (q[1]), &leaf, &inside);
+
+    stats_end (worker, STATS_LEAVES, start);
+
+    start = stats_begin ();
+
+    for (i = k = 0; i < n; i ++) /* skip leaves that can change neither the triangles nor the accuracy test */
+    {
+      if (!irrelevant (leaf[i], x, cutoff)) leaf [k ++] = leaf [i];
+    }
+
+    stats_end (worker, STATS_INTERVAL, start);
+
+    if (n && !k) free (leaf);
+
+    n = k;
+  }
+
   if (n == 0)
   {
     if (inside)
     {
       if (q[1][0] > domain->grid) goto recurse; /* assumption of cubic octants */
 
-      ERRMEM (cell = calloc (1, sizeof (struct cell)));
+      cell = arena_alloc (octree->arena, worker, sizeof (struct cell));
       cell->octree = octree;
       cell->domain = domain;
       cell->face = NULL;
@@ -550,9 +895,15 @@ void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cu
 
   for (l = i = 0; i < n; i ++)
   {
-    for (j = 0; j < 8; j ++) d [i][j] = shape_evaluate (leaf[i], p[j]);
+    start = stats_begin ();
+
+    cached (cache, leaf[i], p, 8, d[i]);
+
+    j = accurate (q[0], d[i], leaf[i], cache, cutoff);
+
+    stats_end (worker, STATS_EVALUATE, start);
 
-    if (!accurate (q[0], d[i], leaf[i], cutoff))  /* but not accurate enough */
+    if (!j)  /* but not accurate enough */
     {
       allaccurate = 0;
     }
@@ -571,7 +922,11 @@ void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cu
   {
     x = (REAL*)t;
 
-    for (j = 0; j < 8; j ++)  x [j] = shape_evaluate (domain->shape, p[j]); /* sample shape */
+    start = stats_begin ();
+
+    cached (cache, domain->shape, p, 8, x); /* sample shape; the pruned shape evaluates identically within the octant */
+
+    stats_end (worker, STATS_EVALUATE, start);
 
     for (i = 0; i < n; i ++)
     {
@@ -603,6 +958,8 @@ void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cu
 
   if (allaccurate)
   {
+    if (edges) for (i = 0; i < 8; i ++) key [i] = lattice (cache, p[i]);
+
     for (i = 0; i < n; i ++)
     {
       if (flagged [i])
@@ -616,35 +973,36 @@ void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cu
 	  }
 	}
 
-	l = polygonise (p, d[i], 0.0, 0.01*cutoff, t);
+	start = stats_begin ();
+
+	if (edges) l = polygonise_shared (edges, leaf[i], key, p, d[i], 0.0, 0.01*cutoff, t);
+	else l = polygonise (p, d[i], 0.0, 0.01*cutoff, t);
+
+	stats_end (worker, STATS_POLYGONISE, start);
+
+	start = stats_begin ();
 
 	for (j = 0; j < l; j ++)
 	{
-	  split (leaf[i], t[j], tmp, k, domain->shape, cutoff, &s, &m, &size); /* split against all other flagged leaves */
+	  split (leaf[i], t[j], tmp, k, shape, cutoff, &s, &m, &size); /* split against all other flagged leaves */
         }
 
+	stats_end (worker, STATS_SPLIT, start);
+
 	if (m)
 	{
-	  ERRMEM (face = calloc (1, sizeof (struct face)));
+	  face = arena_alloc (octree->arena, worker, sizeof (struct face));
 
-	  ERRMEM (face->t = malloc (m * sizeof (REAL [3][3])));
+	  start = stats_begin ();
 
-	  face->area = 0;
+	  face->area = weld (octree, s, m, face, worker);
 
-	  for (o = 0; o < m; o ++)
-	  {
-	    COPY (s [o][0], face->t [o][0]);
-	    COPY (s [o][1], face->t [o][1]);
-	    COPY (s [o][2], face->t [o][2]);
-	    TRIANGLE_AREA (s[o][0], s[o][1], s[o][2], a);
-	    face->area += a;
-	  }
+	  stats_end (worker, STATS_WELD, start);
 
 	  leaf_normal (leaf[i], q[0], face->normal);
 	  NORMALIZE (face->normal);
 	  face->leaf = leaf[i];
 	  face->adj = NULL;
-	  face->n = m;
 	  face->next = list;
 	  list = face;
 	}
@@ -660,7 +1018,7 @@ void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cu
 
   if (list || (allaccurate && inside)) /* triangulation was created or inner octant */
   {
-    ERRMEM (cell = calloc (1, sizeof (struct cell)));
+    cell = arena_alloc (octree->arena, worker, sizeof (struct cell));
     cell->octree = octree;
     cell->face = list;
     cell->domain = domain;
@@ -674,215 +1032,433 @@ recurse:
     {
       if (q[1][0] <= cutoff) goto done; /* assumption of cubic octants */
 
-      x = (REAL*) t;
-
-      VECTOR (x, p[0][0], p[0][1], p[0][2]);
-      VECTOR (x+3, q[0][0], q[0][1], q[0][2]);
-      octree->down [0] = octree_create (x);
-      octree->down [0]->up = octree;
-
-      VECTOR (x, p[0][0], q[0][1], p[0][2]);
-      VECTOR (x+3, q[0][0], p[6][1], q[0][2]);
-      octree->down [1] = octree_create (x);
-      octree->down [1]->up = octree;
-
-      VECTOR (x, q[0][0], q[0][1], p[0][2]);
-      VECTOR (x+3, p[6][0], p[6][1], q[0][2]);
-      octree->down [2] = octree_create (x);
-      octree->down [2]->up = octree;
-
-      VECTOR (x, q[0][0], p[0][1], p[0][2]);
-      VECTOR (x+3, p[6][0], q[0][1], q[0][2]);
-      octree->down [3] = octree_create (x);
-      octree->down [3]->up = octree;
-
-      VECTOR (x, p[0][0], p[0][1], q[0][2]);
-      VECTOR (x+3, q[0][0], q[0][1], p[6][2]);
-      octree->down [4] = octree_create (x);
-      octree->down [4]->up = octree;
-
-      VECTOR (x, p[0][0], q[0][1], q[0][2]);
-      VECTOR (x+3, q[0][0], p[6][1], p[6][2]);
-      octree->down [5] = octree_create (x);
-      octree->down [5]->up = octree;
-
-      VECTOR (x, q[0][0], q[0][1], q[0][2]);
-      VECTOR (x+3, p[6][0], p[6][1], p[6][2]);
-      octree->down [6] = octree_create (x);
-      octree->down [6]->up = octree;
-
-      VECTOR (x, q[0][0], p[0][1], q[0][2]);
-      VECTOR (x+3, p[6][0], q[0][1], p[6][2]);
-      octree->down [7] = octree_create (x);
-      octree->down [7]->up = octree;
+      children (octree, p[0], q[0], p[6], worker);
     }
 
-    for (i = 0; i < 8; i ++) octree_insert_domain (octree->down [i], domain, cutoff);
+    if (refine->pool && q[1][0] > SPAWN_SIZE * cutoff) /* large subtrees are refined in parallel */
+    {
+      group.pending = 0;
+
+      for (i = 0; i < 8; i ++)
+      {
+	ERRMEM (job = malloc (sizeof (struct job)));
+	job->octree = octree->down [i];
+	job->up = shape;
+	job->refine = refine;
+	pool_spawn (refine->pool, worker, &group, subtree, job);
+      }
+
+      pool_wait (refine->pool, worker, &group); /* children share the pruned shape */
+    }
+    else for (i = 0; i < 8; i ++) insert (octree->down [i], shape, refine, worker);
   }
 
 done:
-  if (!octree->up) create_cell_adjacency (octree, domain, cutoff);
+  shape_prune_destroy (shape, up);
+}
+
+/* refinement task */
+static void subtree (void *data, int worker)
+{
+  struct job *job = data;
+
+  insert (job->octree, job->up, job->refine, worker);
+
+  free (job);
 }
 
-/* insert triangles into octree */
-void octree_insert_triangles (struct octree *octree, REAL *triang, int count, REAL cutoff)
+/* set up refinement of a domain below a root octant */
+static void refine_begin (struct refine *refine, struct octree *octree, struct domain *domain, REAL cutoff, int threads, struct pool *pool)
 {
-  REAL p [8][3], q [2][3], y[6], *copy, *x = octree->extents, *t, *c;
-  int size, i, j, k;
+  int i;
+
+  refine->domain = domain;
+  refine->pool = pool;
+  arena_workers (octree->arena, threads);
+  mesh_shared (octree->mesh, threads > 1);
+  refine->cutoff = cutoff;
+  refine->budget = 0;
+  refine->workers = threads;
+  refine->over = NULL;
+  ERRMEM (refine->cache = malloc (threads * sizeof (struct cache*)));
+
+  ERRMEM (refine->edges = malloc (threads * sizeof (struct edges*)));
+
+  for (i = 0; i < threads; i ++)
+  {
+    refine->cache [i] = cache_create (octree->extents, cutoff);
+    refine->edges [i] = refine->cache [i] ? edges_create () : NULL;
+  }
+}
+
+/* free refinement context and accumulate cache statistics */
+static void refine_end (struct refine *refine)
+{
+  struct domain *domain = refine->domain;
+  int i;
+
+  for (i = 0; i < refine->workers; i ++)
+  {
+    struct cache *cache = refine->cache [i];
+
+    if (cache)
+    {
+      domain->lookups += cache->lookups;
+      domain->hits += cache->hits;
+      free (cache->table);
+      free (cache);
+      edges_destroy (refine->edges [i]);
+    }
+  }
+
+  free (refine->edges);
+  free (refine->cache);
+  free (refine->over);
+}
+
+/* insert domain and refine octree down to a cutoff edge length using a number of threads */
+void octree_insert_domain (struct octree *octree, struct domain *domain, REAL cutoff, int threads)
+{
+  struct refine refine;
+  struct timing t;
+  double start;
+
+  timerstart (&t);
+
+  shape_compile (domain->shape); /* flat evaluation tape */
+
+  threads = MAX (threads, 1);
+
+  refine_begin (&refine, octree, domain, cutoff, threads, threads > 1 ? pool_create (threads) : NULL);
+
+  start = stats_begin ();
+
+  insert (octree, domain->shape, &refine, 0);
+
+  stats_end (0, STATS_REFINE, start);
+
+  refine_end (&refine);
+
+  domain->refinement += timerend (&t);
+
+  timerstart (&t);
+
+  start = stats_begin ();
+
+  if (!octree->up) create_cell_adjacency (octree, domain, cutoff, refine.pool);
+
+  stats_end (0, STATS_ADJACENCY, start);
+
+  if (refine.pool) pool_destroy (refine.pool);
+
+  domain->adjacency += timerend (&t);
+}
+
+struct stream /* out-of-core refinement context */
+{
+  struct domain *domain;
+
+  struct pool *pool;
+
+  REAL cutoff;
+
+  int threads, subtrees;
+
+  size_t budget;
+
+  void (*output) (struct octree *octree, void *data);
+
+  void (*complete) (REAL extents [6], void *data);
+
+  void *data;
+};
+
+/* refine a root octant within the budget and output it, or stream its children instead when the budget is exceeded */
+static void streamed (struct stream *stream, REAL extents [6])
+{
+  struct octree *octree = octree_create (extents);
+  struct refine refine;
+  REAL down [8][6];
+  double start;
+  int i, over;
+
+  refine_begin (&refine, octree, stream->domain, stream->cutoff, stream->threads, stream->pool);
+  refine.budget = stream->budget;
+  ERRMEM (refine.over = calloc (stream->threads, 1));
+
+  start = stats_begin ();
+
+  insert (octree, stream->domain->shape, &refine, 0);
+
+  stats_end (0, STATS_REFINE, start);
+
+  for (over = i = 0; i < stream->threads; i ++) over |= refine.over [i];
+
+  refine_end (&refine);
+
+  if (arena_bytes (octree->arena, -1) + mesh_bytes (octree->mesh) > stream->budget) over = 1; /* vertices are not checked while refining */
+
+  if (over && octree->down [0]) /* an exceeded budget implies that the octant itself was refined */
+  {
+    for (i = 0; i < 8; i ++) COPY6 (octree->down[i]->extents, down [i]);
+
+    octree_destroy (octree);
+
+    for (i = 0; i < 8; i ++) streamed (stream, down [i]);
+  }
+  else /* within the budget or not divisible */
+  {
+    stream->output (octree, stream->data);
+    stream->subtrees ++;
+    octree_destroy (octree);
+  }
+
+  stream->complete (extents, stream->data);
+}
+
+/* mesh a domain one subtree at a time, keeping every refined subtree within a memory budget in bytes where possible;
+ * finished subtrees are passed to output before being freed and complete is called once an octant is done; return the number of subtrees */
+int octree_stream_domain (REAL extents [6], struct domain *domain, REAL cutoff, int threads, size_t budget,
+  void (*output) (struct octree *octree, void *data), void (*complete) (REAL extents [6], void *data), void *data)
+{
+  struct stream s;
+  struct timing t;
+
+  timerstart (&t);
+
+  shape_compile (domain->shape);
+
+  s.domain = domain;
+  s.threads = MAX (threads, 1);
+  s.pool = s.threads > 1 ? pool_create (s.threads) : NULL;
+  s.cutoff = cutoff;
+  s.subtrees = 0;
+  s.budget = MAX (budget, STREAM_BUDGET);
+  s.output = output;
+  s.complete = complete;
+  s.data = data;
+
+  streamed (&s, extents);
+
+  if (s.pool) pool_destroy (s.pool);
+
+  domain->refinement += timerend (&t);
+
+  return s.subtrees;
+}
+
+/* test whether a triangle overlaps an axis-aligned box using separating axes */
+static int overlap (REAL *t, REAL box [6])
+{
+  REAL c [3], h [3], v [3][3], e [3][3], n [3], a [3], p0, p1, p2, lo, hi, r;
+  int i, j;
+
+  MID (box, box+3, c);
+  SUB (box+3, c, h);
+  SUB (t, c, v[0]);
+  SUB (t+3, c, v[1]);
+  SUB (t+6, c, v[2]);
+  SUB (v[1], v[0], e[0]);
+  SUB (v[2], v[1], e[1]);
+  SUB (v[0], v[2], e[2]);
+
+  for (i = 0; i < 3; i ++) /* edge cross box axis */
+  {
+    for (j = 0; j < 3; j ++)
+    {
+      SET (a, 0.0);
+      a [(j+1)%3] = -e[i][(j+2)%3];
+      a [(j+2)%3] = e[i][(j+1)%3];
+      p0 = DOT (a, v[0]);
+      p1 = DOT (a, v[1]);
+      p2 = DOT (a, v[2]);
+      lo = MIN (p0, MIN (p1, p2));
+      hi = MAX (p0, MAX (p1, p2));
+      r = h[0]*fabs (a[0]) + h[1]*fabs (a[1]) + h[2]*fabs (a[2]);
+      if (lo > r || hi < -r) return 0;
+    }
+  }
+
+  for (j = 0; j < 3; j ++) /* box faces */
+  {
+    lo = MIN (v[0][j], MIN (v[1][j], v[2][j]));
+    hi = MAX (v[0][j], MAX (v[1][j], v[2][j]));
+    if (lo > h[j] || hi < -h[j]) return 0;
+  }
+
+  PRODUCT (e[0], e[1], n); /* triangle plane */
+  p0 = DOT (n, v[0]);
+  r = h[0]*fabs (n[0]) + h[1]*fabs (n[1]) + h[2]*fabs (n[2]);
+
+  return fabs (p0) <= r;
+}
+
+struct bins /* triangle binning context */
+{
+  REAL *triang, cutoff;
+
+  struct pool *pool; /* NULL for serial binning */
+};
+
+struct bin /* octant binning task */
+{
+  struct octree *octree;
+
+  int *index, count;
+
+  struct bins *bins;
+};
+
+static void bin (void *data, int worker);
+
+/* insert indexed triangles into an octant and bin them into its children */
+static void binned (struct octree *octree, struct bins *bins, int *index, int count, int worker)
+{
+  static const char octant [2][2][2] = {{{0, 4}, {1, 5}}, {{3, 7}, {2, 6}}}; /* child by upper x, y, z halves */
+  REAL p [2][3], q [2][3], *x = octree->extents, *t, lo, hi;
+  int i, j, k, l, *down, size [8], side [3][2], n;
+  struct group group;
+  struct bin *job;
 
   VECTOR (p[0], x[0], x[1], x[2]);
-  VECTOR (p[1], x[0], x[4], x[2]);
-  VECTOR (p[2], x[3], x[4], x[2]);
-  VECTOR (p[3], x[3], x[1], x[2]);
-  VECTOR (p[4], x[0], x[1], x[5]);
-  VECTOR (p[5], x[0], x[4], x[5]);
-  VECTOR (p[6], x[3], x[4], x[5]);
-  VECTOR (p[7], x[3], x[1], x[5]);
+  VECTOR (p[1], x[3], x[4], x[5]);
 
-  MID (p[0], p[6], q[0]);
+  MID (p[0], p[1], q[0]);
   SUB (q[0], p[0], q[1]);
 
-  if (count < PRIMITIVES_PER_OCTANT || q[1][0] <= cutoff) /* assumption of cubic octants */
+  if (count < PRIMITIVES_PER_OCTANT || q[1][0] <= bins->cutoff) /* assumption of cubic octants */
   {
     struct cell *cell;
     struct face *face;
 
-    ERRMEM (cell = calloc (1, sizeof (struct cell)));
+    cell = arena_alloc (octree->arena, worker, sizeof (struct cell));
     cell->octree = octree;
     cell->next = octree->cell;
     octree->cell = cell;
 
-    for (i = 0, t = triang; i < count; i ++, t += 9)
+    for (i = 0; i < count; i ++)
     {
-      ERRMEM (face = calloc (1, sizeof (struct face)));
-      ERRMEM (face->t = malloc (sizeof (REAL [3][3])));
+      t = bins->triang + 9 * index [i];
+
+      face = arena_alloc (octree->arena, worker, sizeof (struct face));
       face->leaf = (struct shape*) 1; /* mock pointer to pass test in render_domains */
       face->next = cell->face;
       cell->face = face;
-      face->n = 1;
 
-      COPY (t, face->t[0][0]);
-      COPY (t+3, face->t[0][1]);
-      COPY (t+6, face->t[0][2]);
+      weld (octree, (REAL (*) [3][3]) t, 1, face, worker);
 
       NORMAL (t,t+3,t+6, face->normal);
     }
+
+    return;
   }
-  else
+
+  if (!octree->down [0])
   {
-    if (!octree->down [0])
+    children (octree, p[0], q[0], p[1], worker);
+  }
+
+  ERRMEM (down = malloc (8 * count * sizeof (int))); /* child i indices start at down + i*count */
+
+  for (i = 0; i < 8; i ++) size [i] = 0;
+
+  for (i = 0; i < count; i ++) /* one pass: box halves first, separating axes only for straddling triangles */
+  {
+    t = bins->triang + 9 * index [i];
+
+    for (k = 0; k < 3; k ++)
     {
-      VECTOR (y, p[0][0], p[0][1], p[0][2]);
-      VECTOR (y+3, q[0][0], q[0][1], q[0][2]);
-      octree->down [0] = octree_create (y);
-      octree->down [0]->up = octree;
-
-      VECTOR (y, p[0][0], q[0][1], p[0][2]);
-      VECTOR (y+3, q[0][0], p[6][1], q[0][2]);
-      octree->down [1] = octree_create (y);
-      octree->down [1]->up = octree;
-
-      VECTOR (y, q[0][0], q[0][1], p[0][2]);
-      VECTOR (y+3, p[6][0], p[6][1], q[0][2]);
-      octree->down [2] = octree_create (y);
-      octree->down [2]->up = octree;
-
-      VECTOR (y, q[0][0], p[0][1], p[0][2]);
-      VECTOR (y+3, p[6][0], q[0][1], q[0][2]);
-      octree->down [3] = octree_create (y);
-      octree->down [3]->up = octree;
-
-      VECTOR (y, p[0][0], p[0][1], q[0][2]);
-      VECTOR (y+3, q[0][0], q[0][1], p[6][2]);
-      octree->down [4] = octree_create (y);
-      octree->down [4]->up = octree;
-
-      VECTOR (y, p[0][0], q[0][1], q[0][2]);
-      VECTOR (y+3, q[0][0], p[6][1], p[6][2]);
-      octree->down [5] = octree_create (y);
-      octree->down [5]->up = octree;
-
-      VECTOR (y, q[0][0], q[0][1], q[0][2]);
-      VECTOR (y+3, p[6][0], p[6][1], p[6][2]);
-      octree->down [6] = octree_create (y);
-      octree->down [6]->up = octree;
-
-      VECTOR (y, q[0][0], p[0][1], q[0][2]);
-      VECTOR (y+3, p[6][0], q[0][1], p[6][2]);
-      octree->down [7] = octree_create (y);
-      octree->down [7]->up = octree;
+      lo = MIN (t[k], MIN (t[3+k], t[6+k]));
+      hi = MAX (t[k], MAX (t[3+k], t[6+k]));
+      side [k][0] = lo <= q[0][k];
+      side [k][1] = hi >= q[0][k];
     }
 
-    ERRMEM (copy = malloc (count * sizeof (REAL [9])));
+    n = (side[0][0] + side[0][1]) * (side[1][0] + side[1][1]) * (side[2][0] + side[2][1]);
 
-    for (i = 0; i < 8; i ++)
+    for (j = 0; j < 8; j ++)
     {
-      x = octree->down[i]->extents;
+      int a = j & 1, b = (j >> 1) & 1, c = (j >> 2) & 1;
 
-      size = 0;
-      c = copy;
+      if (!side[0][a] || !side[1][b] || !side[2][c]) continue;
 
-      for (j = 0, t = triang; j < count; j ++, t += 9)
-      {
-	y [0] =  FLT_MAX;
-	y [1] =  FLT_MAX;
-	y [2] =  FLT_MAX;
-	y [3] = -FLT_MAX;
-	y [4] = -FLT_MAX;
-	y [5] = -FLT_MAX;
-
-	for (k = 0; k < 3; k ++)
-	{
-	  if (t[3*k+0] < y[0]) y[0] = t[3*k+0];
-	  if (t[3*k+1] < y[1]) y[1] = t[3*k+1];
-	  if (t[3*k+2] < y[2]) y[2] = t[3*k+2];
-	  if (t[3*k+0] > y[3]) y[3] = t[3*k+0];
-	  if (t[3*k+1] > y[4]) y[4] = t[3*k+1];
-	  if (t[3*k+2] > y[5]) y[5] = t[3*k+2];
-        }
+      l = octant [a][b][c];
 
-	if (y[0] > x[3] ||
-	    y[1] > x[4] ||
-	    y[2] > x[5] ||
-	    y[3] < x[0] ||
-	    y[4] < x[1] ||
-	    y[5] < x[2]) continue;
-	else
-	{
-          COPY9(t, c);
-	  size ++;
-	  c += 9; 
-	}
-      }
+      if (n > 1 && !overlap (t, octree->down[l]->extents)) continue;
 
-      if (size) octree_insert_triangles (octree->down [i], copy, size, cutoff);
+      down [l*count + size[l] ++] = index [i];
     }
+  }
 
-    free (copy);
+  if (bins->pool && count > BIN_SPAWN) /* large octants bin their children in parallel */
+  {
+    group.pending = 0;
+
+    for (i = 0; i < 8; i ++)
+    {
+      if (size [i] == 0) continue;
+
+      ERRMEM (job = malloc (sizeof (struct bin)));
+      job->octree = octree->down [i];
+      job->index = down + i*count;
+      job->count = size [i];
+      job->bins = bins;
+      pool_spawn (bins->pool, worker, &group, bin, job);
+    }
+
+    pool_wait (bins->pool, worker, &group); /* children share the index buffer */
+  }
+  else for (i = 0; i < 8; i ++)
+  {
+    if (size [i]) binned (octree->down [i], bins, down + i*count, size [i], worker);
   }
+
+  free (down);
 }
 
-/* free octree memory */
-void octree_destroy (struct octree *octree)
+/* binning task */
+static void bin (void *data, int worker)
 {
-  struct cell *cell;
-  struct face *face;
-  void *next;
-  int i;
+  struct bin *job = data;
 
-  if (octree->down [0]) for (i = 0; i < 8; i ++) octree_destroy (octree->down [i]);
+  binned (job->octree, job->bins, job->index, job->count, worker);
 
-  for (cell = octree->cell; cell; cell = next)
-  {
-    for (face = cell->face; face; face = next)
-    {
-      next = face->next;
-      free (face->t);
-      free (face);
-    }
-    next = cell->next;
-    free (cell);
-  }
+  free (job);
+}
+
+/* insert triangles into octree using a number of threads */
+void octree_insert_triangles (struct octree *octree, REAL *triang, int count, REAL cutoff, int threads)
+{
+  struct bins bins;
+  int i, *index;
+
+  if (count <= 0) return;
+
+  threads = MAX (threads, 1);
+
+  arena_workers (octree->arena, threads);
+  mesh_shared (octree->mesh, threads > 1);
+
+  bins.triang = triang;
+  bins.cutoff = cutoff;
+  bins.pool = threads > 1 ? pool_create (threads) : NULL;
+
+  ERRMEM (index = malloc (count * sizeof (int)));
+
+  for (i = 0; i < count; i ++) index [i] = i;
+
+  binned (octree, &bins, index, count, 0);
+
+  free (index);
+
+  if (bins.pool) pool_destroy (bins.pool);
+}
+
+/* free octree memory in one go; given a root */
+void octree_destroy (struct octree *octree)
+{
+  ASSERT (!octree->up, "Only a whole octree can be destroyed");
 
-  free (octree);
+  mesh_destroy (octree->mesh);
+  arena_destroy (octree->arena);
 }
@@ -4,35 +4,13 @@
  * polygonizer by Paul Brouke: http://paulbourke.net/geometry/polygonise/
  */
 
+#include <stdlib.h>
+#include <stdio.h>
 #include "polygon.h"
 #include "error.h"
 #include "alg.h"
 
-/* linearly interpolate the position where an isosurface cuts
- * an edge between two vertices, each with their own scalar value */
-static void vertexinterp (REAL isolevel, REAL cutoff, REAL p1 [3], REAL p2 [3], REAL valp1, REAL valp2, REAL *out)
-{
-  if (fabs (isolevel-valp1) < cutoff) { COPY (p1, out); }
-  else if (fabs (isolevel-valp2) < cutoff) { COPY (p2, out); }
-  else if (fabs (valp1-valp2) < cutoff) { COPY (p1, out); }
-  else
-  {
-    REAL mu = (isolevel - valp1) / (valp2 - valp1);
-    out [0] = p1 [0] + mu * (p2 [0] - p1 [0]);
-    out [1] = p1 [1] + mu * (p2 [1] - p1 [1]);
-    out [2] = p1 [2] + mu * (p2 [2] - p1 [2]);
-  }
-}
-
-/* polygonise a grid cell (p, val) into up to five triangles (number returned);
- * zero is returned if the grid cell is either above or below the specified isolevel */
-int polygonise (REAL p [8][3], REAL val [8], REAL isolevel, REAL cutoff, REAL triangles [5][3][3])
-{
-  REAL vertlist [12][3];
-  int i, ntriang;
-  int cubeindex;
-
-  int edgeTable [256] = {
+static const int edgeTable [256] = {
   0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
   0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
   0x190, 0x99 , 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
@@ -66,7 +44,7 @@ int polygonise (REAL p [8][3], REAL val [8], REAL isolevel, REAL cutoff, REAL tr
   0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c,
   0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0   };
 
-  int triTable [256][16] =
+static const signed char triTable [256][16] =
   {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
   {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
   {0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
@@ -324,47 +302,198 @@ int polygonise (REAL p [8][3], REAL val [8], REAL isolevel, REAL cutoff, REAL tr
   {0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
   {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}};
 
-  /*
-   * Determine the index into the edge table which
-   * tells us which vertices are inside of the surface
-   */
-  cubeindex = 0;
-  if (val[0] < isolevel) cubeindex |= 1;
-  if (val[1] < isolevel) cubeindex |= 2;
-  if (val[2] < isolevel) cubeindex |= 4;
-  if (val[3] < isolevel) cubeindex |= 8;
-  if (val[4] < isolevel) cubeindex |= 16;
-  if (val[5] < isolevel) cubeindex |= 32;
-  if (val[6] < isolevel) cubeindex |= 64;
-  if (val[7] < isolevel) cubeindex |= 128;
+/* corners of the cube edges */
+static const int edgeCorners [12][2] = {{0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6}, {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
 
-  /* Cube is entirely in/out of the surface */
-  if (edgeTable[cubeindex] == 0)
-    return(0);
+struct vertex /* cached edge crossing */
+{
+  unsigned long long a, b; /* edge end keys, a < b; zero marks empty slots */
 
-  /* Find the vertices where the surface intersects the cube */
-  if (edgeTable[cubeindex] & 1) vertexinterp (isolevel, cutoff, p[0], p[1], val[0], val[1], vertlist[0]);
-  if (edgeTable[cubeindex] & 2) vertexinterp (isolevel, cutoff, p[1], p[2], val[1], val[2], vertlist[1]);
-  if (edgeTable[cubeindex] & 4) vertexinterp (isolevel, cutoff, p[2], p[3], val[2], val[3], vertlist[2]);
-  if (edgeTable[cubeindex] & 8) vertexinterp (isolevel, cutoff, p[3], p[0], val[3], val[0], vertlist[3]);
-  if (edgeTable[cubeindex] & 16) vertexinterp (isolevel, cutoff, p[4], p[5], val[4], val[5], vertlist[4]);
-  if (edgeTable[cubeindex] & 32) vertexinterp (isolevel, cutoff, p[5], p[6], val[5], val[6], vertlist[5]);
-  if (edgeTable[cubeindex] & 64) vertexinterp (isolevel, cutoff, p[6], p[7], val[6], val[7], vertlist[6]);
-  if (edgeTable[cubeindex] & 128) vertexinterp (isolevel, cutoff, p[7], p[4], val[7], val[4], vertlist[7]);
-  if (edgeTable[cubeindex] & 256) vertexinterp (isolevel, cutoff, p[0], p[4], val[0], val[4], vertlist[8]);
-  if (edgeTable[cubeindex] & 512) vertexinterp (isolevel, cutoff, p[1], p[5], val[1], val[5], vertlist[9]);
-  if (edgeTable[cubeindex] & 1024) vertexinterp (isolevel, cutoff, p[2], p[6], val[2], val[6], vertlist[10]);
-  if (edgeTable[cubeindex] & 2048) vertexinterp (isolevel, cutoff, p[3], p[7], val[3], val[7], vertlist[11]);
-
-  /* Create the triangle */
-  ntriang = 0;
-  for (i = 0; triTable [cubeindex][i] != -1; i += 3)
+  const void *tag;
+
+  REAL point [3];
+};
+
+struct edges /* shared-edge vertex cache */
+{
+  struct vertex *table;
+
+  int size, count; /* size is a power of two */
+};
+
+/* linearly interpolate the position where an isosurface cuts
+ * an edge between two vertices, each with their own scalar value;
+ * the lexicographically lower vertex is used as the origin so that
+ * cells sharing an edge compute exactly the same crossing */
+static void vertexinterp (REAL isolevel, REAL cutoff, const REAL *p1, const REAL *p2, REAL valp1, REAL valp2, REAL *out)
+{
+  if (p2[0] < p1[0] || (p2[0] == p1[0] && (p2[1] < p1[1] || (p2[1] == p1[1] && p2[2] < p1[2]))))
+  {
+    const REAL *p = p1;
+    REAL v = valp1;
+    p1 = p2;
+    p2 = p;
+    valp1 = valp2;
+    valp2 = v;
+  }
+
+  if (fabs (isolevel-valp1) < cutoff) { COPY (p1, out); }
+  else if (fabs (isolevel-valp2) < cutoff) { COPY (p2, out); }
+  else if (fabs (valp1-valp2) < cutoff) { COPY (p1, out); }
+  else
+  {
+    REAL mu = (isolevel - valp1) / (valp2 - valp1);
+    out [0] = p1 [0] + mu * (p2 [0] - p1 [0]);
+    out [1] = p1 [1] + mu * (p2 [1] - p1 [1]);
+    out [2] = p1 [2] + mu * (p2 [2] - p1 [2]);
+  }
+}
+
+/* index into the edge table telling which vertices are inside of the surface */
+static int cubeindex (REAL val [8], REAL isolevel)
+{
+  int i, index = 0;
+
+  for (i = 0; i < 8; i ++)
+  {
+    if (val[i] < isolevel) index |= 1 << i;
+  }
+
+  return index;
+}
+
+/* create the triangles from the edge vertices */
+static int triangulate (int index, REAL vertlist [12][3], REAL triangles [5][3][3])
+{
+  const signed char *t = triTable [index];
+  int i, ntriang = 0;
+
+  for (i = 0; t[i] != -1; i += 3)
   {
-    COPY (vertlist[triTable[cubeindex][i  ]], triangles[ntriang][0]);
-    COPY (vertlist[triTable[cubeindex][i+1]], triangles[ntriang][1]);
-    COPY (vertlist[triTable[cubeindex][i+2]], triangles[ntriang][2]);
+    COPY (vertlist[t[i  ]], triangles[ntriang][0]);
+    COPY (vertlist[t[i+1]], triangles[ntriang][1]);
+    COPY (vertlist[t[i+2]], triangles[ntriang][2]);
     ntriang++;
   }
 
   return ntriang;
 }
+
+/* polygonise a grid cell (p, val) into up to five triangles (number returned);
+ * zero is returned if the grid cell is either above or below the specified isolevel */
+int polygonise (REAL p [8][3], REAL val [8], REAL isolevel, REAL cutoff, REAL triangles [5][3][3])
+{
+  int i, index = cubeindex (val, isolevel), edges = edgeTable [index];
+  REAL vertlist [12][3];
+
+  /* Cube is entirely in/out of the surface */
+  if (edges == 0) return 0;
+
+  /* Find the vertices where the surface intersects the cube */
+  for (i = 0; i < 12; i ++)
+  {
+    if (edges & (1 << i))
+    {
+      const int *e = edgeCorners [i];
+      vertexinterp (isolevel, cutoff, p[e[0]], p[e[1]], val[e[0]], val[e[1]], vertlist[i]);
+    }
+  }
+
+  return triangulate (index, vertlist, triangles);
+}
+
+/* create shared-edge vertex cache */
+struct edges* edges_create (void)
+{
+  struct edges *edges;
+
+  ERRMEM (edges = malloc (sizeof (struct edges)));
+  edges->size = 1024;
+  edges->count = 0;
+  ERRMEM (edges->table = calloc (edges->size, sizeof (struct vertex)));
+
+  return edges;
+}
+
+/* cache slot of an edge crossing */
+static struct vertex* slot (struct edges *edges, unsigned long long a, unsigned long long b, const void *tag)
+{
+  unsigned long long hash = (a * 0x9E3779B97F4A7C15ULL) ^ (b * 0xC2B2AE3D27D4EB4FULL) ^ (unsigned long long) (size_t) tag;
+  int i = (int) ((hash * 0x9E3779B97F4A7C15ULL) >> 40) & (edges->size - 1);
+
+  while (edges->table[i].a && (edges->table[i].a != a || edges->table[i].b != b || edges->table[i].tag != tag))
+  {
+    i = (i + 1) & (edges->size - 1); /* linear probing */
+  }
+
+  return &edges->table [i];
+}
+
+/* double cache table size */
+static void grow (struct edges *edges)
+{
+  struct vertex *old = edges->table;
+  int i, size = edges->size;
+
+  edges->size *= 2;
+  ERRMEM (edges->table = calloc (edges->size, sizeof (struct vertex)));
+
+  for (i = 0; i < size; i ++)
+  {
+    if (old[i].a) *slot (edges, old[i].a, old[i].b, old[i].tag) = old [i];
+  }
+
+  free (old);
+}
+
+/* polygonise a grid cell as above, with non-zero unique corner keys, reusing edge crossings of other cells of the same tag */
+int polygonise_shared (struct edges *edges, const void *tag, unsigned long long key [8],
+  REAL p [8][3], REAL val [8], REAL isolevel, REAL cutoff, REAL triangles [5][3][3])
+{
+  int i, index = cubeindex (val, isolevel), crossed = edgeTable [index];
+  unsigned long long a, b;
+  REAL vertlist [12][3];
+  struct vertex *v;
+
+  if (crossed == 0) return 0;
+
+  if (2 * (edges->count + 12) > edges->size) grow (edges);
+
+  for (i = 0; i < 12; i ++)
+  {
+    if (crossed & (1 << i))
+    {
+      const int *e = edgeCorners [i];
+
+      a = MIN (key[e[0]], key[e[1]]);
+      b = MAX (key[e[0]], key[e[1]]);
+      v = slot (edges, a, b, tag);
+
+      if (v->a) { COPY (v->point, vertlist[i]); }
+      else
+      {
+	vertexinterp (isolevel, cutoff, p[e[0]], p[e[1]], val[e[0]], val[e[1]], vertlist[i]);
+	v->a = a;
+	v->b = b;
+	v->tag = tag;
+	COPY (vertlist[i], v->point);
+	edges->count ++;
+      }
+    }
+  }
+
+  return triangulate (index, vertlist, triangles);
+}
+
+/* return memory used by the cache in bytes */
+size_t edges_bytes (struct edges *edges)
+{
+  return sizeof (struct edges) + edges->size * sizeof (struct vertex);
+}
+
+/* free shared-edge vertex cache */
+void edges_destroy (struct edges *edges)
+{
+  free (edges->table);
+  free (edges);
+}
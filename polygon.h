@@ -3,6 +3,8 @@
  * ---------
  */
 
+#include <stddef.h>
+
 #ifndef __polygon__
 #define __polygon__
 
@@ -10,4 +12,19 @@
  * zero is returned if the grid cell is either above or below the specified isolevel */
 int polygonise (REAL p[8][3], REAL val [8], REAL isolevel, REAL cutoff, REAL triangles [5][3][3]);
 
+struct edges; /* shared-edge vertex cache */
+
+/* create shared-edge vertex cache */
+struct edges* edges_create (void);
+
+/* polygonise a grid cell as above, with non-zero unique corner keys, reusing edge crossings of other cells of the same tag */
+int polygonise_shared (struct edges *edges, const void *tag, unsigned long long key [8],
+  REAL p [8][3], REAL val [8], REAL isolevel, REAL cutoff, REAL triangles [5][3][3]);
+
+/* return memory used by the cache in bytes */
+size_t edges_bytes (struct edges *edges);
+
+/* free shared-edge vertex cache */
+void edges_destroy (struct edges *edges);
+
 #endif
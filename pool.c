@@ -0,0 +1,236 @@
+/*
+ * pool.c
+ * ------
+ * work-stealing thread pool: each worker pushes and pops tasks at the bottom
+ * of its own deque and idle workers steal from the top of the others
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sched.h>
+#include "pool.h"
+#include "error.h"
+
+struct task
+{
+  void (*run) (void*, int);
+
+  void *arg;
+
+  struct group *group;
+};
+
+struct deque /* circular task array */
+{
+  struct task *task;
+
+  int size, top, bottom; /* size is a power of two; top <= bottom */
+
+  pthread_mutex_t lock;
+};
+
+struct worker
+{
+  struct pool *pool;
+
+  int index;
+};
+
+struct pool
+{
+  int size;
+
+  struct deque *deque;
+
+  struct worker *worker;
+
+  pthread_t *thread;
+
+  int queued, quit;
+
+  pthread_mutex_t lock;
+
+  pthread_cond_t wake;
+};
+
+/* push task at deque bottom */
+static void push (struct deque *deque, struct task *task)
+{
+  struct task *old;
+  int i, n;
+
+  pthread_mutex_lock (&deque->lock);
+
+  n = deque->bottom - deque->top;
+
+  if (n == deque->size) /* full: double */
+  {
+    old = deque->task;
+    ERRMEM (deque->task = malloc (2 * deque->size * sizeof (struct task)));
+    for (i = 0; i < n; i ++) deque->task [i] = old [(deque->top + i) & (deque->size - 1)];
+    free (old);
+    deque->size *= 2;
+    deque->top = 0;
+    deque->bottom = n;
+  }
+
+  deque->task [deque->bottom & (deque->size - 1)] = *task;
+  deque->bottom ++;
+
+  pthread_mutex_unlock (&deque->lock);
+}
+
+/* take task from deque bottom (owner) or top (thief); return 0 if empty */
+static int take (struct deque *deque, struct task *task, int bottom)
+{
+  int ok = 0;
+
+  pthread_mutex_lock (&deque->lock);
+
+  if (deque->bottom > deque->top)
+  {
+    if (bottom) *task = deque->task [(-- deque->bottom) & (deque->size - 1)];
+    else *task = deque->task [(deque->top ++) & (deque->size - 1)];
+    ok = 1;
+  }
+
+  pthread_mutex_unlock (&deque->lock);
+
+  return ok;
+}
+
+/* find a task for a worker: own deque first, then the others */
+static int find (struct pool *pool, int worker, struct task *task)
+{
+  int i;
+
+  if (take (&pool->deque [worker], task, 1)) goto found;
+
+  for (i = 1; i < pool->size; i ++)
+  {
+    if (take (&pool->deque [(worker + i) % pool->size], task, 0)) goto found;
+  }
+
+  return 0;
+
+found:
+  __atomic_sub_fetch (&pool->queued, 1, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+/* run task and signal its group */
+static void execute (struct task *task, int worker)
+{
+  task->run (task->arg, worker);
+
+  __atomic_sub_fetch (&task->group->pending, 1, __ATOMIC_SEQ_CST);
+}
+
+/* worker thread loop */
+static void* loop (void *data)
+{
+  struct worker *worker = data;
+  struct pool *pool = worker->pool;
+  struct task task;
+
+  for (;;)
+  {
+    if (find (pool, worker->index, &task)) execute (&task, worker->index);
+    else
+    {
+      pthread_mutex_lock (&pool->lock);
+      while (!pool->quit && !__atomic_load_n (&pool->queued, __ATOMIC_SEQ_CST)) pthread_cond_wait (&pool->wake, &pool->lock);
+      pthread_mutex_unlock (&pool->lock);
+
+      if (pool->quit) break;
+    }
+  }
+
+  return NULL;
+}
+
+/* create work-stealing pool of threads; the calling thread joins as worker 0 when waiting */
+struct pool* pool_create (int threads)
+{
+  struct pool *pool;
+  int i;
+
+  ERRMEM (pool = calloc (1, sizeof (struct pool)));
+  ERRMEM (pool->deque = calloc (threads, sizeof (struct deque)));
+  ERRMEM (pool->worker = calloc (threads, sizeof (struct worker)));
+  ERRMEM (pool->thread = calloc (threads, sizeof (pthread_t)));
+
+  pool->size = threads;
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->wake, NULL);
+
+  for (i = 0; i < threads; i ++)
+  {
+    pool->deque[i].size = 64;
+    ERRMEM (pool->deque[i].task = malloc (64 * sizeof (struct task)));
+    pthread_mutex_init (&pool->deque[i].lock, NULL);
+    pool->worker[i].pool = pool;
+    pool->worker[i].index = i;
+  }
+
+  for (i = 1; i < threads; i ++)
+  {
+    ASSERT (pthread_create (&pool->thread [i], NULL, loop, &pool->worker [i]) == 0, "Thread creation has failed");
+  }
+
+  return pool;
+}
+
+/* spawn task into calling worker's queue; the task is run as run (arg, worker) */
+void pool_spawn (struct pool *pool, int worker, struct group *group, void (*run) (void*, int), void *arg)
+{
+  struct task task = {run, arg, group};
+
+  __atomic_add_fetch (&group->pending, 1, __ATOMIC_SEQ_CST);
+
+  push (&pool->deque [worker], &task);
+
+  pthread_mutex_lock (&pool->lock);
+  __atomic_add_fetch (&pool->queued, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_signal (&pool->wake);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* wait for group tasks, running queued or stolen tasks meanwhile */
+void pool_wait (struct pool *pool, int worker, struct group *group)
+{
+  struct task task;
+
+  while (__atomic_load_n (&group->pending, __ATOMIC_SEQ_CST))
+  {
+    if (find (pool, worker, &task)) execute (&task, worker);
+    else sched_yield (); /* remaining group tasks run on other workers */
+  }
+}
+
+/* stop threads and free pool memory */
+void pool_destroy (struct pool *pool)
+{
+  int i;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast (&pool->wake);
+  pthread_mutex_unlock (&pool->lock);
+
+  for (i = 1; i < pool->size; i ++) pthread_join (pool->thread [i], NULL);
+
+  for (i = 0; i < pool->size; i ++)
+  {
+    pthread_mutex_destroy (&pool->deque[i].lock);
+    free (pool->deque[i].task);
+  }
+
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->wake);
+  free (pool->deque);
+  free (pool->worker);
+  free (pool->thread);
+  free (pool);
+}
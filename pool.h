@@ -0,0 +1,28 @@
+/*
+ * pool.h
+ * ------
+ */
+
+#ifndef __pool__
+#define __pool__
+
+struct pool;
+
+struct group /* tasks awaited together */
+{
+  int pending;
+};
+
+/* create work-stealing pool of threads; the calling thread joins as worker 0 when waiting */
+struct pool* pool_create (int threads);
+
+/* spawn task into calling worker's queue; the task is run as run (arg, worker) */
+void pool_spawn (struct pool *pool, int worker, struct group *group, void (*run) (void*, int), void *arg);
+
+/* wait for group tasks, running queued or stolen tasks meanwhile */
+void pool_wait (struct pool *pool, int worker, struct group *group);
+
+/* stop threads and free pool memory */
+void pool_destroy (struct pool *pool);
+
+#endif
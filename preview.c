@@ -0,0 +1,597 @@
+/*
+ * preview.c
+ * ---------
+ * sphere tracing of domain shapes without meshing: rays of a screen tile are marched together through depth slices,
+ * within each of which the shapes are pruned to the slice box, empty slices are skipped and distances are evaluated in batches
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include "preview.h"
+#include "image.h"
+#include "pool.h"
+#include "error.h"
+#include "alg.h"
+
+#define TILE 16 /* tile edge in pixels */
+
+#define SLICES 16 /* depth slices of a tile */
+
+#define STEPS 256 /* march steps after which a ray is taken as a miss */
+
+#define REFINE 8 /* bisection steps of rays that overshoot the surface */
+
+enum {ACTIVE, HIT, MISS}; /* ray states */
+
+struct ray
+{
+  REAL o [3], d [3]; /* near plane origin and unit direction */
+
+  REAL len; /* near to far plane distance; t / len is the depth fraction shared by a slice */
+
+  REAL t, prev, end; /* current, previous and scene exit distances */
+
+  int steps, state;
+};
+
+struct job /* tile */
+{
+  struct preview *preview;
+
+  int tile;
+};
+
+struct preview
+{
+  struct shape **shape; /* compiled domain shapes */
+
+  int count;
+
+  REAL lipschitz; /* bound of distance gradients: steps are distances divided by it */
+
+  REAL extents [6];
+
+  struct pool *pool;
+
+  int threads;
+
+  double inv [16]; /* clip to world matrix of the current frame */
+
+  REAL footprint [2]; /* pixel size at distance t is footprint [0] + footprint [1] * t */
+
+  int width, height, tiles [2], row;
+
+  unsigned char *rgb;
+};
+
+static const float palette [8][3] = /* surface colours by scolor */
+{
+  {0.50, 0.50, 0.50},
+  {0.75, 0.45, 0.30},
+  {0.35, 0.55, 0.80},
+  {0.45, 0.70, 0.35},
+  {0.80, 0.70, 0.30},
+  {0.65, 0.40, 0.75},
+  {0.30, 0.70, 0.65},
+  {0.80, 0.40, 0.55}
+};
+
+/* bound shape distance gradient length */
+static REAL lipschitz (struct shape *shape)
+{
+  switch (shape->what)
+  {
+  case ADD:
+  case MUL:
+    return MAX (lipschitz (shape->left), lipschitz (shape->right));
+  case FLT: /* the blend of two unit gradients is at most sqrt (2) long */
+    return sqrt (2.0) * MAX (lipschitz (shape->left), lipschitz (shape->right));
+  default:
+    return 1.0;
+  }
+}
+
+/* return surface colour of a leaf */
+static short scolor (struct shape *leaf)
+{
+  switch (leaf->what)
+  {
+  case HSP: return ((struct halfspace*) leaf->data)->scolor;
+  case SPH: return ((struct sphere*) leaf->data)->scolor;
+  case CYL: return ((struct cylinder*) leaf->data)->scolor;
+  case MLS: return ((struct mls*) leaf->data)->scolor;
+  case MESH: return ((struct trimesh*) leaf->data)->scolor;
+  case FLT: return ((struct fillet*) leaf->data)->scolor;
+  default: return 0;
+  }
+}
+
+/* return the leaf whose distance is the shape distance at a point */
+static struct shape* nearest (struct shape *shape, REAL *point, REAL *value)
+{
+  struct shape *l, *r;
+  REAL a, b;
+
+  switch (shape->what)
+  {
+  case ADD:
+  case MUL:
+    l = nearest (shape->left, point, &a);
+    r = nearest (shape->right, point, &b);
+    if ((shape->what == ADD) == (a < b))
+    {
+      *value = a;
+      return l;
+    }
+    *value = b;
+    return r;
+  default:
+    *value = shape_evaluate (shape, point);
+    return shape;
+  }
+}
+
+/* invert a column major 4x4 matrix by Gauss-Jordan elimination; return 0 if singular */
+static int invert (double *m, double *inv)
+{
+  double a [4][8], q;
+  int i, j, k, p;
+
+  for (i = 0; i < 4; i ++)
+  {
+    for (j = 0; j < 4; j ++)
+    {
+      a [i][j] = m [4*j+i];
+      a [i][j+4] = i == j ? 1.0 : 0.0;
+    }
+  }
+
+  for (k = 0; k < 4; k ++)
+  {
+    for (p = k, i = k + 1; i < 4; i ++) if (fabs (a [i][k]) > fabs (a [p][k])) p = i;
+
+    if (a [p][k] == 0.0) return 0;
+
+    for (j = 0; j < 8; j ++)
+    {
+      q = a [k][j];
+      a [k][j] = a [p][j];
+      a [p][j] = q;
+    }
+
+    for (q = 1.0 / a [k][k], j = 0; j < 8; j ++) a [k][j] *= q;
+
+    for (i = 0; i < 4; i ++)
+    {
+      if (i == k) continue;
+      for (q = a [i][k], j = 0; j < 8; j ++) a [i][j] -= q * a [k][j];
+    }
+  }
+
+  for (i = 0; i < 4; i ++)
+  {
+    for (j = 0; j < 4; j ++) inv [4*j+i] = a [i][j+4];
+  }
+
+  return 1;
+}
+
+/* map normalized device coordinates to a world point */
+static void unproject (double *inv, double x, double y, double z, REAL *point)
+{
+  double c [4];
+  int i;
+
+  for (i = 0; i < 4; i ++) c [i] = inv [i] * x + inv [4+i] * y + inv [8+i] * z + inv [12+i];
+
+  for (i = 0; i < 3; i ++) point [i] = c [i] / c [3];
+}
+
+/* map a window point to its near and far plane points */
+static void window (struct preview *preview, double x, double y, REAL *near, REAL *far)
+{
+  x = 2.0 * x / preview->width - 1.0;
+  y = 2.0 * y / preview->height - 1.0;
+
+  unproject (preview->inv, x, y, -1.0, near);
+  unproject (preview->inv, x, y, 1.0, far);
+}
+
+/* set up the ray between near and far plane points and clip it to the scene; return 0 if it misses the scene */
+static int ray_setup (struct preview *preview, REAL *near, REAL *far, struct ray *ray)
+{
+  REAL a, b, q;
+  int i;
+
+  COPY (near, ray->o);
+  SUB (far, near, ray->d);
+  ray->len = LEN (ray->d);
+  DIV (ray->d, ray->len, ray->d);
+
+  ray->t = ray->prev = 0.0;
+  ray->end = ray->len;
+  ray->steps = 0;
+  ray->state = MISS;
+
+  for (i = 0; i < 3; i ++) /* slab test */
+  {
+    if (fabs (ray->d [i]) < 1E-10)
+    {
+      if (ray->o [i] < preview->extents [i] || ray->o [i] > preview->extents [i+3]) return 0;
+      continue;
+    }
+
+    a = (preview->extents [i] - ray->o [i]) / ray->d [i];
+    b = (preview->extents [i+3] - ray->o [i]) / ray->d [i];
+    if (a > b)
+    {
+      q = a;
+      a = b;
+      b = q;
+    }
+
+    ray->t = MAX (ray->t, a);
+    ray->end = MIN (ray->end, b);
+  }
+
+  if (ray->t >= ray->end) return 0;
+
+  ray->prev = ray->t;
+  ray->state = ACTIVE;
+
+  return 1;
+}
+
+/* bound the part of a tile between depth fractions s0 and s1 by a box within the scene */
+static void tile_box (struct preview *preview, struct ray **corner, REAL s0, REAL s1, REAL box [6])
+{
+  REAL q [3];
+  int i, j;
+
+  for (i = 0; i < 3; i ++)
+  {
+    box [i] = FLT_MAX;
+    box [i+3] = -FLT_MAX;
+  }
+
+  for (i = 0; i < 8; i ++) /* depth fraction planes are parallel, so the tile's corner rays span them */
+  {
+    ADDMUL (corner [i&3]->o, (i < 4 ? s0 : s1) * corner [i&3]->len, corner [i&3]->d, q);
+
+    for (j = 0; j < 3; j ++)
+    {
+      box [j] = MIN (box [j], q [j]);
+      box [j+3] = MAX (box [j+3], q [j]);
+    }
+  }
+
+  for (j = 0; j < 3; j ++)
+  {
+    box [j] = MAX (box [j], preview->extents [j]);
+    box [j+3] = MIN (box [j+3], preview->extents [j+3]);
+  }
+}
+
+/* prune shapes to a box, leaving NULL where a shape has no surface within it; return the number of non-empty shapes */
+static int prune (struct shape **in, int count, REAL box [6], struct shape **out)
+{
+  REAL range [2];
+  int i, n;
+
+  for (n = i = 0; i < count; i ++)
+  {
+    out [i] = NULL;
+
+    if (in [i] == NULL) continue;
+
+    shape_interval (in [i], box, range);
+
+    if (range [0] > 0.0) continue; /* outside everywhere */
+
+    out [i] = shape_prune (in [i], box);
+
+    n ++;
+  }
+
+  return n;
+}
+
+/* free pruned shapes */
+static void unprune (struct shape **pruned, int count, struct shape **in)
+{
+  int i;
+
+  for (i = 0; i < count; i ++)
+  {
+    if (pruned [i]) shape_prune_destroy (pruned [i], in [i]);
+  }
+}
+
+/* return the least distance of shapes at a point */
+static REAL distance (struct shape **shape, int count, REAL *point)
+{
+  REAL v, w;
+  int i;
+
+  for (v = FLT_MAX, i = 0; i < count; i ++)
+  {
+    if (shape [i] && (w = shape_evaluate (shape [i], point)) < v) v = w;
+  }
+
+  return v;
+}
+
+/* shade a ray hitting shapes with a headlight on a material of the leaf's colour */
+static void shade (struct shape **shape, int count, struct ray *ray, unsigned char *pixel)
+{
+  struct shape *leaf, *best = NULL;
+  REAL q [3], n [3], v, w, c;
+  const float *colour;
+  int i;
+
+  ADDMUL (ray->o, ray->t, ray->d, q);
+
+  for (w = FLT_MAX, i = 0; i < count; i ++)
+  {
+    if (shape [i] && (leaf = nearest (shape [i], q, &v)) && v < w)
+    {
+      w = v;
+      best = leaf;
+    }
+  }
+
+  leaf_normal (best, q, n);
+  v = LEN (n);
+  c = 0.2;
+  if (v > 0.0) c += fabs (DOT (n, ray->d)) / v; /* two sided: at creases the hit may be closer to the leaf facing away */
+
+  colour = palette [((scolor (best) % 8) + 8) % 8];
+
+  for (i = 0; i < 3; i ++) pixel [i] = (unsigned char) (MIN (colour [i] * c, 1.0) * 255.0 + 0.5);
+}
+
+/* trace a tile */
+static void tile (void *arg, int worker)
+{
+  struct job *job = arg;
+  struct preview *p = job->preview;
+  int tx = job->tile % p->tiles [0], ty = job->tile / p->tiles [0], x0 = tx * TILE, y0 = ty * TILE,
+      x1 = MIN (x0 + TILE, p->width) - 1, y1 = MIN (y0 + TILE, p->height) - 1, w = x1 - x0 + 1, h = y1 - y0 + 1,
+      active [TILE*TILE], i, j, k, l, m, n, x, y;
+  REAL point [TILE*TILE][3], value [TILE*TILE], v [TILE*TILE], box [6], s0, s1, sa, sb, lo, hi, t,
+       o [3][3], f [3][3], dx [2][3], dy [2][3], near [3], far [3];
+  struct shape **outer, **inner;
+  struct ray ray [TILE*TILE], *r, *corner [4];
+  unsigned char *pixel;
+
+  for (y = y0; y <= y1; y ++) memset (p->rgb + y * p->row + 3 * x0, 255, 3 * w);
+
+  s0 = FLT_MAX;
+  s1 = -FLT_MAX;
+
+  window (p, x0 + 0.5, y0 + 0.5, o [0], f [0]); /* near and far plane points are affine in window coordinates */
+  window (p, x0 + 1.5, y0 + 0.5, o [1], f [1]);
+  window (p, x0 + 0.5, y0 + 1.5, o [2], f [2]);
+  SUB (o [1], o [0], dx [0]);
+  SUB (f [1], f [0], dx [1]);
+  SUB (o [2], o [0], dy [0]);
+  SUB (f [2], f [0], dy [1]);
+
+  for (n = 0, y = y0; y <= y1; y ++)
+  {
+    for (x = x0; x <= x1; x ++, n ++)
+    {
+      for (i = 0; i < 3; i ++)
+      {
+	near [i] = o [0][i] + (x - x0) * dx [0][i] + (y - y0) * dy [0][i];
+	far [i] = f [0][i] + (x - x0) * dx [1][i] + (y - y0) * dy [1][i];
+      }
+
+      if (ray_setup (p, near, far, &ray [n]))
+      {
+	s0 = MIN (s0, ray [n].t / ray [n].len);
+	s1 = MAX (s1, ray [n].end / ray [n].len);
+      }
+    }
+  }
+
+  if (s0 >= s1) return; /* the tile misses the scene */
+
+  corner [0] = &ray [0];
+  corner [1] = &ray [w-1];
+  corner [2] = &ray [(h-1)*w];
+  corner [3] = &ray [h*w-1];
+
+  ERRMEM (outer = malloc (2 * p->count * sizeof (struct shape*)));
+  inner = outer + p->count;
+
+  tile_box (p, corner, s0, s1, box);
+
+  if (prune (p->shape, p->count, box, outer))
+  {
+    for (k = 0; k < SLICES; k ++)
+    {
+      sa = s0 + (s1 - s0) * k / SLICES;
+      sb = k < SLICES - 1 ? s0 + (s1 - s0) * (k + 1) / SLICES : s1;
+
+      tile_box (p, corner, sa, sb, box);
+
+      if (prune (outer, p->count, box, inner) == 0) /* no surface in the slice: skip it */
+      {
+	for (i = 0; i < n; i ++)
+	{
+	  r = &ray [i];
+	  if (r->state == ACTIVE && r->t < sb * r->len) r->t = sb * r->len;
+	  if (r->state == ACTIVE && r->t >= r->end) r->state = MISS;
+	}
+
+	continue;
+      }
+
+      for (m = i = 0; i < n; i ++)
+      {
+	if (ray [i].state == ACTIVE && ray [i].t < sb * ray [i].len) active [m ++] = i;
+      }
+
+      while (m) /* march rays within the slice together, dropping those that finish or leave it */
+      {
+	for (i = 0; i < m; i ++)
+	{
+	  r = &ray [active [i]];
+	  ADDMUL (r->o, r->t, r->d, point [i]);
+	  value [i] = FLT_MAX;
+	}
+
+	for (j = 0; j < p->count; j ++)
+	{
+	  if (inner [j] == NULL) continue;
+	  shape_evaluate_batch (inner [j], point, m, v);
+	  for (i = 0; i < m; i ++) value [i] = MIN (value [i], v [i]);
+	}
+
+	for (l = i = 0; i < m; i ++)
+	{
+	  r = &ray [active [i]];
+
+	  if (value [i] < 0.5 * (p->footprint [0] + p->footprint [1] * r->t)) /* within half a pixel */
+	  {
+	    if (value [i] < 0.0 && r->steps) /* overshot where the gradient bound does not hold */
+	    {
+	      for (lo = r->prev, hi = r->t, j = 0; j < REFINE; j ++)
+	      {
+		r->t = 0.5 * (lo + hi);
+		ADDMUL (r->o, r->t, r->d, point [0]);
+		if (distance (inner, p->count, point [0]) < 0.0) hi = r->t;
+		else lo = r->t;
+	      }
+	      r->t = hi;
+	    }
+
+	    r->state = HIT;
+	    pixel = p->rgb + (y0 + active [i] / w) * p->row + 3 * (x0 + active [i] % w);
+	    shade (inner, p->count, r, pixel);
+	  }
+	  else
+	  {
+	    t = r->t + value [i] / p->lipschitz;
+	    r->prev = r->t;
+	    r->t = t;
+	    if (++ r->steps > STEPS || r->t >= r->end) r->state = MISS;
+	    else if (r->t < sb * r->len) active [l ++] = active [i];
+	  }
+	}
+
+	m = l;
+      }
+
+      unprune (inner, p->count, outer);
+    }
+  }
+
+  unprune (outer, p->count, p->shape);
+
+  free (outer);
+}
+
+/* run jobs on the pool or inline */
+static void run (struct preview *preview, struct job *job, int n)
+{
+  struct group group;
+  int i;
+
+  if (preview->pool && n > 1)
+  {
+    group.pending = 0;
+    for (i = 0; i < n; i ++) pool_spawn (preview->pool, 0, &group, tile, &job [i]);
+    pool_wait (preview->pool, 0, &group);
+  }
+  else for (i = 0; i < n; i ++) tile (&job [i], 0);
+}
+
+/* prepare domain shapes within scene extents for sphere tracing with a number of threads */
+struct preview* preview_create (struct domain *domain, REAL extents [6], int threads)
+{
+  struct preview *preview;
+  struct domain *d;
+  int i;
+
+  ERRMEM (preview = calloc (1, sizeof (struct preview)));
+
+  for (d = domain; d; d = d->next) preview->count ++;
+
+  ERRMEM (preview->shape = malloc (MAX (preview->count, 1) * sizeof (struct shape*)));
+
+  preview->lipschitz = 1.0;
+
+  for (i = 0, d = domain; d; d = d->next, i ++)
+  {
+    shape_compile (d->shape); /* pruned shapes share compiled branches */
+    preview->shape [i] = d->shape;
+    preview->lipschitz = MAX (preview->lipschitz, lipschitz (d->shape));
+  }
+
+  COPY6 (extents, preview->extents);
+
+  preview->threads = MAX (threads, 1);
+
+  if (preview->threads > 1) preview->pool = pool_create (preview->threads);
+
+  return preview;
+}
+
+/* trace domain shapes coloured by scolor for a column major world to clip matrix into an RGB buffer from rgb_alloc */
+void preview_render (struct preview *preview, double *matrix, int width, int height, void *rgb)
+{
+  REAL o [2][3], f [2][3], q [3];
+  struct ray a, b;
+  struct job *job;
+  int i, n;
+
+  preview->width = width;
+  preview->height = height;
+  preview->tiles [0] = (width + TILE - 1) / TILE;
+  preview->tiles [1] = (height + TILE - 1) / TILE;
+  preview->row = rgb_row (width);
+  preview->rgb = rgb;
+  n = preview->tiles [0] * preview->tiles [1];
+
+  if (!invert (matrix, preview->inv))
+  {
+    for (i = 0; i < height; i ++) memset (preview->rgb + i * preview->row, 255, 3 * width);
+    return;
+  }
+
+  window (preview, 0.5 * width, 0.5 * height, o [0], f [0]); /* neighbouring rays give the pixel footprint */
+  window (preview, 0.5 * width + 1.0, 0.5 * height, o [1], f [1]);
+  ray_setup (preview, o [0], f [0], &a);
+  ray_setup (preview, o [1], f [1], &b);
+  SUB (b.o, a.o, q);
+  preview->footprint [0] = LEN (q);
+  SUB (b.d, a.d, q);
+  preview->footprint [1] = LEN (q);
+
+  ERRMEM (job = malloc (n * sizeof (struct job)));
+
+  for (i = 0; i < n; i ++)
+  {
+    job [i].preview = preview;
+    job [i].tile = i;
+  }
+
+  run (preview, job, n);
+
+  free (job);
+}
+
+/* free preview memory */
+void preview_destroy (struct preview *preview)
+{
+  if (preview->pool) pool_destroy (preview->pool);
+
+  free (preview->shape);
+
+  free (preview);
+}
@@ -0,0 +1,22 @@
+/*
+ * preview.h
+ * ---------
+ */
+
+#include "oaktree.h"
+
+#ifndef __preview__
+#define __preview__
+
+struct preview;
+
+/* prepare domain shapes within scene extents for sphere tracing with a number of threads */
+struct preview* preview_create (struct domain *domain, REAL extents [6], int threads);
+
+/* trace domain shapes coloured by scolor for a column major world to clip matrix into an RGB buffer from rgb_alloc */
+void preview_render (struct preview *preview, double *matrix, int width, int height, void *rgb);
+
+/* free preview memory */
+void preview_destroy (struct preview *preview);
+
+#endif
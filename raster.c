@@ -0,0 +1,468 @@
+/*
+ * raster.c
+ * --------
+ * tile based software rasterizer of domain boundary triangles: triangles are set up in parallel chunks,
+ * binned to screen tiles and the tiles are filled in parallel with fixed point edge functions and a depth buffer
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include "raster.h"
+#include "image.h"
+#include "mesh.h"
+#include "pool.h"
+#include "error.h"
+#include "alg.h"
+
+#define TILE 64 /* tile edge in pixels */
+
+#define SUBPIXEL 8 /* fractional bits of fixed point window coordinates */
+
+#define GUARD 8192 /* triangles reaching further than this many pixels outside of the image are dropped */
+
+#define CHUNK 4096 /* triangles per setup task */
+
+struct source /* world space triangle */
+{
+  float p [3][3], n [3];
+};
+
+struct setup /* window space triangle */
+{
+  long long area; /* twice the area in fixed point units */
+
+  int x [3], y [3]; /* fixed point window coordinates */
+
+  float z [3], c [3]; /* window depth and shade */
+
+  int box [4]; /* covered pixel range clipped to the image; empty when culled */
+};
+
+struct job /* setup chunk or tile */
+{
+  struct raster *raster;
+
+  int begin, end;
+};
+
+struct raster
+{
+  struct source *tri;
+
+  int count, size;
+
+  struct setup *setup;
+
+  int *bin, *first, binsize; /* triangle indices of tiles and their offsets */
+
+  struct pool *pool;
+
+  int threads;
+
+  double m [16]; /* world to clip matrix of the current frame */
+
+  float eye [3]; /* light position */
+
+  int width, height, tiles [2], row;
+
+  unsigned char *rgb;
+};
+
+/* gather domain boundary triangles */
+static void gather (struct raster *raster, struct octree *octree)
+{
+  struct source *t;
+  struct cell *cell;
+  struct face *face;
+  int i, j;
+
+  if (octree->down [0])
+  {
+    for (i = 0; i < 8; i ++) gather (raster, octree->down [i]);
+  }
+
+  for (cell = octree->cell; cell; cell = cell->next)
+  {
+    for (face = cell->face; face; face = face->next)
+    {
+      if (face->leaf == NULL) continue;
+
+      for (i = 0; i < face->n; i ++)
+      {
+	if (raster->count == raster->size)
+	{
+	  raster->size = 2 * raster->size + 1024;
+	  ERRMEM (raster->tri = realloc (raster->tri, raster->size * sizeof (struct source)));
+	}
+
+	t = &raster->tri [raster->count ++];
+
+	for (j = 0; j < 3; j ++) COPY (mesh_point (octree->mesh, FACE_VERTEX (face, i, j)), t->p [j]);
+
+	COPY (face->normal, t->n);
+      }
+    }
+  }
+}
+
+/* set up a chunk of triangles */
+static void setup (void *arg, int worker)
+{
+  struct job *job = arg;
+  struct raster *r = job->raster;
+  double *m = r->m, c [4], x, y, lx, hx, ly, hy, l [3];
+  struct source *t;
+  struct setup *s;
+  float n [3];
+  int i, j;
+
+  for (i = job->begin; i < job->end; i ++)
+  {
+    t = &r->tri [i];
+    s = &r->setup [i];
+    s->box [0] = s->box [2] = 0;
+    s->box [1] = s->box [3] = -1;
+
+    lx = ly = DBL_MAX;
+    hx = hy = -DBL_MAX;
+
+    for (j = 0; j < 3; j ++)
+    {
+      c [0] = m[0]*t->p[j][0] + m[4]*t->p[j][1] + m[8]*t->p[j][2] + m[12];
+      c [1] = m[1]*t->p[j][0] + m[5]*t->p[j][1] + m[9]*t->p[j][2] + m[13];
+      c [2] = m[2]*t->p[j][0] + m[6]*t->p[j][1] + m[10]*t->p[j][2] + m[14];
+      c [3] = m[3]*t->p[j][0] + m[7]*t->p[j][1] + m[11]*t->p[j][2] + m[15];
+
+      if (c [3] <= 0.0) break; /* behind the eye */
+
+      x = 0.5 * (c[0] / c[3] + 1.0) * r->width;
+      y = 0.5 * (c[1] / c[3] + 1.0) * r->height;
+
+      if (x < -GUARD || x > r->width + GUARD || y < -GUARD || y > r->height + GUARD) break;
+
+      s->x [j] = (int) lround (x * (1 << SUBPIXEL));
+      s->y [j] = (int) lround (y * (1 << SUBPIXEL));
+      s->z [j] = 0.5 * (c[2] / c[3] + 1.0);
+
+      lx = MIN (lx, x);
+      hx = MAX (hx, x);
+      ly = MIN (ly, y);
+      hy = MAX (hy, y);
+    }
+
+    if (j < 3) continue;
+
+    s->area = (long long) (s->x[1] - s->x[0]) * (s->y[2] - s->y[0]) - (long long) (s->x[2] - s->x[0]) * (s->y[1] - s->y[0]);
+
+    if (s->area <= 0) continue; /* back facing or degenerate */
+
+    s->box [0] = MAX (0, (int) ceil (lx - 0.5));
+    s->box [1] = MIN (r->width - 1, (int) floor (hx - 0.5));
+    s->box [2] = MAX (0, (int) ceil (ly - 0.5));
+    s->box [3] = MIN (r->height - 1, (int) floor (hy - 0.5));
+
+    COPY (t->n, n);
+    NORMALIZE (n);
+
+    for (j = 0; j < 3; j ++) /* fixed function lighting of render_domains: grey 0.5 colour material, 0.2 ambient, light at the eye */
+    {
+      SUB (r->eye, t->p [j], l);
+      NORMALIZE (l);
+      s->c [j] = 0.1 + 0.5 * MAX (DOT (n, l), 0.0);
+    }
+  }
+}
+
+/* fill a tile */
+static void tile (void *arg, int worker)
+{
+  struct job *job = arg;
+  struct raster *r = job->raster;
+  int tx = job->begin % r->tiles [0], ty = job->begin / r->tiles [0], x0 = tx * TILE, y0 = ty * TILE,
+      x1 = MIN (x0 + TILE, r->width) - 1, y1 = MIN (y0 + TILE, r->height) - 1, i, k, a, b, x, y, lx, hx, ly, hy;
+  long long e [3], row [3], dx [3], dy [3], bias [3];
+  float depth [TILE*TILE], *d, z, l [3], inv;
+  unsigned char *p;
+  struct setup *s;
+
+  for (i = 0; i < TILE*TILE; i ++) depth [i] = 1.0;
+
+  for (y = y0; y <= y1; y ++) memset (r->rgb + y * r->row + 3 * x0, 255, 3 * (x1 - x0 + 1));
+
+  for (i = r->first [job->begin]; i < r->first [job->begin + 1]; i ++)
+  {
+    s = &r->setup [r->bin [i]];
+
+    lx = MAX (s->box [0], x0);
+    hx = MIN (s->box [1], x1);
+    ly = MAX (s->box [2], y0);
+    hy = MIN (s->box [3], y1);
+
+    if (lx > hx || ly > hy) continue;
+
+    inv = 1.0 / (float) s->area;
+
+    for (k = 0; k < 3; k ++) /* edge k is opposite to vertex k and its function is the barycentric weight of the vertex */
+    {
+      a = (k + 1) % 3;
+      b = (k + 2) % 3;
+      dx [k] = (long long) (s->y [a] - s->y [b]) * (1 << SUBPIXEL); /* multiplied since edge deltas may be negative */
+      dy [k] = (long long) (s->x [b] - s->x [a]) * (1 << SUBPIXEL);
+      row [k] = (long long) (s->x [b] - s->x [a]) * ((long long) ly * (1 << SUBPIXEL) + (1 << (SUBPIXEL-1)) - s->y [a]) -
+		(long long) (s->y [b] - s->y [a]) * ((long long) lx * (1 << SUBPIXEL) + (1 << (SUBPIXEL-1)) - s->x [a]);
+      bias [k] = (s->y [b] < s->y [a] || (s->y [b] == s->y [a] && s->x [b] < s->x [a])) ? 0 : -1; /* top-left fill rule */
+    }
+
+    for (y = ly; y <= hy; y ++)
+    {
+      COPY (row, e);
+      d = depth + (y - y0) * TILE + (lx - x0);
+      p = r->rgb + y * r->row + 3 * lx;
+
+      for (x = lx; x <= hx; x ++, d ++, p += 3)
+      {
+	if (e [0] + bias [0] >= 0 && e [1] + bias [1] >= 0 && e [2] + bias [2] >= 0)
+	{
+	  l [0] = (float) e [0] * inv;
+	  l [1] = (float) e [1] * inv;
+	  l [2] = 1.0 - l [0] - l [1];
+
+	  z = l [0] * s->z [0] + l [1] * s->z [1] + l [2] * s->z [2];
+
+	  if (z >= 0.0 && z < *d)
+	  {
+	    *d = z;
+	    p [0] = p [1] = p [2] = (unsigned char) (MIN (DOT (l, s->c), 1.0) * 255.0 + 0.5);
+	  }
+	}
+
+	ADD (e, dx, e);
+      }
+
+      ADD (row, dy, row);
+    }
+  }
+}
+
+/* run jobs on the pool or inline */
+static void run (struct raster *raster, struct job *job, int n, void (*task) (void*, int))
+{
+  struct group group;
+  int i;
+
+  if (raster->pool && n > 1)
+  {
+    group.pending = 0;
+    for (i = 0; i < n; i ++) pool_spawn (raster->pool, 0, &group, task, &job [i]);
+    pool_wait (raster->pool, 0, &group);
+  }
+  else for (i = 0; i < n; i ++) task (&job [i], 0);
+}
+
+/* set up the default viewer camera for scene extents, turned about the vertical axis by an angle in degrees */
+void raster_camera (struct camera *camera, REAL *extents, REAL angle)
+{
+  REAL a [3], b [3], rhs [3], c, s, rl, tb, nf, mx;
+
+  c = cos (ALG_PI * angle / 180.0);
+  s = sin (ALG_PI * angle / 180.0);
+  VECTOR (a, c - s, s + c, 1.0); /* viewer's initial direction (1, 1, 1) turned about z */
+  NORMALIZE (a);
+
+  MID (extents, extents + 3, camera->to);
+  SUB (extents + 3, extents, b);
+  mx = LEN (b);
+  ADDMUL (camera->to, mx, a, camera->from);
+
+  SCALE (a, -1.0);
+  VECTOR (b, 0.0, 0.0, 1.0);
+  PRODUCT (a, b, rhs);
+  PRODUCT (rhs, a, camera->up);
+  NORMALIZE (camera->up);
+
+  rl = extents [3] - extents [0];
+  tb = extents [4] - extents [1];
+  nf = extents [5] - extents [2];
+  mx = MAX (rl, MAX (tb, nf));
+  camera->left = -0.5*mx;
+  camera->right = 0.5*mx;
+  camera->bottom = -0.5*mx;
+  camera->top = 0.5*mx;
+  camera->fardst = 1000.0 * mx;
+  camera->neardst = 0.001 * MIN (rl, MIN (tb, nf));
+  camera->perspective = 0;
+}
+
+/* return column major matrix mapping world to clip coordinates for an image size, as the viewer sets it up */
+void raster_matrix (struct camera *camera, int width, int height, double *matrix)
+{
+  double p [16], v [16], f [3], s [3], u [3], aspect = (double) width / (double) height, l, r, b, t, n, d, q;
+  int i, j, k;
+
+  for (i = 0; i < 16; i ++) p [i] = v [i] = 0.0;
+
+  n = camera->neardst;
+  d = camera->fardst;
+
+  if (camera->perspective) /* gluPerspective */
+  {
+    q = 1.0 / tan (ALG_PI * 35.0 / 180.0);
+    p [0] = q / aspect;
+    p [5] = q;
+    p [10] = (d + n) / (n - d);
+    p [11] = -1.0;
+    p [14] = 2.0 * d * n / (n - d);
+  }
+  else /* glOrtho stretched along the longer image side */
+  {
+    l = camera->left;
+    r = camera->right;
+    b = camera->bottom;
+    t = camera->top;
+
+    if (width <= height)
+    {
+      b /= aspect;
+      t /= aspect;
+    }
+    else
+    {
+      l *= aspect;
+      r *= aspect;
+    }
+
+    p [0] = 2.0 / (r - l);
+    p [5] = 2.0 / (t - b);
+    p [10] = -2.0 / (d - n);
+    p [12] = -(r + l) / (r - l);
+    p [13] = -(t + b) / (t - b);
+    p [14] = -(d + n) / (d - n);
+    p [15] = 1.0;
+  }
+
+  SUB (camera->to, camera->from, f); /* gluLookAt */
+  NORMALIZE (f);
+  PRODUCT (f, camera->up, s);
+  NORMALIZE (s);
+  PRODUCT (s, f, u);
+
+  for (i = 0; i < 3; i ++)
+  {
+    v [4*i] = s [i];
+    v [4*i+1] = u [i];
+    v [4*i+2] = -f [i];
+  }
+
+  v [12] = -DOT (s, camera->from);
+  v [13] = -DOT (u, camera->from);
+  v [14] = DOT (f, camera->from);
+  v [15] = 1.0;
+
+  for (i = 0; i < 4; i ++)
+  {
+    for (j = 0; j < 4; j ++)
+    {
+      for (matrix [4*i+j] = 0.0, k = 0; k < 4; k ++) matrix [4*i+j] += p [4*k+j] * v [4*i+k];
+    }
+  }
+}
+
+/* gather domain boundary triangles of an octree for rendering with a number of threads */
+struct raster* raster_create (struct octree *octree, int threads)
+{
+  struct raster *raster;
+
+  ERRMEM (raster = calloc (1, sizeof (struct raster)));
+
+  gather (raster, octree);
+
+  ERRMEM (raster->setup = malloc (MAX (raster->count, 1) * sizeof (struct setup)));
+
+  raster->threads = MAX (threads, 1);
+
+  if (raster->threads > 1) raster->pool = pool_create (raster->threads);
+
+  return raster;
+}
+
+/* render domain boundary triangles shaded as by render_domains into an RGB buffer from rgb_alloc */
+void raster_render (struct raster *raster, struct camera *camera, int width, int height, void *rgb)
+{
+  int i, n, tx, ty, ntiles, *count;
+  struct setup *s;
+  struct job *job;
+
+  raster_matrix (camera, width, height, raster->m);
+  COPY (camera->from, raster->eye);
+  raster->width = width;
+  raster->height = height;
+  raster->tiles [0] = (width + TILE - 1) / TILE;
+  raster->tiles [1] = (height + TILE - 1) / TILE;
+  raster->row = rgb_row (width);
+  raster->rgb = rgb;
+  ntiles = raster->tiles [0] * raster->tiles [1];
+
+  n = (raster->count + CHUNK - 1) / CHUNK;
+  ERRMEM (job = malloc (MAX (n, ntiles) * sizeof (struct job)));
+
+  for (i = 0; i < n; i ++)
+  {
+    job [i].raster = raster;
+    job [i].begin = i * CHUNK;
+    job [i].end = MIN ((i + 1) * CHUNK, raster->count);
+  }
+
+  run (raster, job, n, setup);
+
+  ERRMEM (raster->first = realloc (raster->first, (ntiles + 1) * sizeof (int)));
+  ERRMEM (count = calloc (ntiles + 1, sizeof (int)));
+
+  for (s = raster->setup, i = 0; i < raster->count; i ++, s ++) /* count and then fill tile bins in triangle order */
+  {
+    for (ty = s->box [2] / TILE; ty <= s->box [3] / TILE && s->box [2] <= s->box [3]; ty ++)
+      for (tx = s->box [0] / TILE; tx <= s->box [1] / TILE && s->box [0] <= s->box [1]; tx ++) count [ty * raster->tiles [0] + tx] ++;
+  }
+
+  for (raster->first [0] = i = 0; i < ntiles; i ++)
+  {
+    raster->first [i+1] = raster->first [i] + count [i];
+    count [i] = raster->first [i];
+  }
+
+  if (raster->first [ntiles] > raster->binsize)
+  {
+    raster->binsize = raster->first [ntiles];
+    ERRMEM (raster->bin = realloc (raster->bin, raster->binsize * sizeof (int)));
+  }
+
+  for (s = raster->setup, i = 0; i < raster->count; i ++, s ++)
+  {
+    for (ty = s->box [2] / TILE; ty <= s->box [3] / TILE && s->box [2] <= s->box [3]; ty ++)
+      for (tx = s->box [0] / TILE; tx <= s->box [1] / TILE && s->box [0] <= s->box [1]; tx ++) raster->bin [count [ty * raster->tiles [0] + tx] ++] = i;
+  }
+
+  for (i = 0; i < ntiles; i ++)
+  {
+    job [i].raster = raster;
+    job [i].begin = i;
+  }
+
+  run (raster, job, ntiles, tile);
+
+  free (count);
+  free (job);
+}
+
+/* free raster memory */
+void raster_destroy (struct raster *raster)
+{
+  if (raster->pool) pool_destroy (raster->pool);
+  free (raster->tri);
+  free (raster->setup);
+  free (raster->first);
+  free (raster->bin);
+  free (raster);
+}
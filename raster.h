@@ -0,0 +1,39 @@
+/*
+ * raster.h
+ * --------
+ */
+
+#include "oaktree.h"
+
+#ifndef __raster__
+#define __raster__
+
+struct camera /* viewer conventions: look from a point at a target with orthographic or perspective projection */
+{
+  REAL from [3], to [3], up [3];
+
+  REAL left, right, bottom, top; /* orthographic view box at a square aspect ratio */
+
+  REAL neardst, fardst;
+
+  int perspective; /* 70 degree vertical field of view when set */
+};
+
+struct raster;
+
+/* set up the default viewer camera for scene extents, turned about the vertical axis by an angle in degrees */
+void raster_camera (struct camera *camera, REAL *extents, REAL angle);
+
+/* return column major matrix mapping world to clip coordinates for an image size, as the viewer sets it up */
+void raster_matrix (struct camera *camera, int width, int height, double *matrix);
+
+/* gather domain boundary triangles of an octree for rendering with a number of threads */
+struct raster* raster_create (struct octree *octree, int threads);
+
+/* render domain boundary triangles shaded as by render_domains into an RGB buffer from rgb_alloc */
+void raster_render (struct raster *raster, struct camera *camera, int width, int height, void *rgb);
+
+/* free raster memory */
+void raster_destroy (struct raster *raster);
+
+#endif
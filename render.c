@@ -1,95 +1,166 @@
 /*
  * render.c
  * --------
+ * octree items are packed into vertex arrays once per octree, in preorder so that every subtree is a contiguous range;
+ * the arrays live in vertex buffer objects when compiled with VBO; subtrees outside of the view frustum are skipped
+ * and subtrees smaller than a few pixels are drawn as their bounding boxes
  */
 
+#include <stdlib.h>
 #include <stdio.h>
+#include <float.h>
+#include <math.h>
 #if __APPLE__
   #include <GLUT/glut.h>
 #else
+  #define GL_GLEXT_PROTOTYPES
   #include <GL/glut.h>
   #include <GL/glext.h>
 #endif
 #include "render.h"
+#include "mesh.h"
 #include "error.h"
 #include "alg.h"
 
-/* render octree itself */
-void render_octree (struct octree *octree)
+struct node /* packed subtree in preorder */
 {
-  REAL *e;
-  int i;
+  GLint first; /* first vertex of the subtree */
 
-  if (octree->down [0])
-  {
-    for (i = 0; i < 8; i ++) render_octree (octree->down [i]);
-  }
-  else
-  {
-    glBegin (GL_LINES);
+  GLsizei count, own; /* vertices of the subtree and of the node itself, which come first */
+
+  GLint proxy; /* first vertex of the bounding box proxy or -1 */
+
+  int size; /* nodes in the subtree */
+
+  GLfloat bounds [6]; /* extents of subtree vertices */
+};
+
+struct batch /* packed vertices of a render item */
+{
+  GLfloat *data; /* interleaved normals and vertices, or vertices only for lines; NULL once uploaded */
+
+  int count, size; /* vertices and allocated floats */
+
+  GLuint buffer; /* vertex buffer object or zero */
 
-    glColor4f (0.1, 0.1, 0.1, 0.1);
+  struct node *node; /* octree nodes in preorder */
 
-    e = octree->extents;
+  int nodes, nodesize; /* nodes and allocated nodes */
 
-    /* lower base */
-    glVertex3f (e[0], e[1], e[2]);
-    glVertex3f (e[3], e[1], e[2]);
+  char packed;
+};
 
-    glVertex3f (e[0], e[1], e[2]);
-    glVertex3f (e[0], e[4], e[2]);
+struct item /* render item description */
+{
+  void (*pack) (struct octree*, struct batch*); /* pack vertices of a single octree node */
+
+  void (*proxy) (GLfloat*, struct batch*); /* pack a bounding box proxy */
 
-    glVertex3f (e[3], e[1], e[2]);
-    glVertex3f (e[3], e[4], e[2]);
+  int stride, proxycount; /* floats per vertex and vertices per proxy */
 
-    glVertex3f (e[0], e[4], e[2]);
-    glVertex3f (e[3], e[4], e[2]);
+  GLenum mode, format;
+};
 
-    /* upper base */
-    glVertex3f (e[0], e[1], e[5]);
-    glVertex3f (e[3], e[1], e[5]);
+struct cache /* render items of an octree */
+{
+  struct octree *octree;
 
-    glVertex3f (e[0], e[1], e[5]);
-    glVertex3f (e[0], e[4], e[5]);
+  struct batch domains, cells, lines;
 
-    glVertex3f (e[3], e[1], e[5]);
-    glVertex3f (e[3], e[4], e[5]);
+  struct cache *next;
+};
 
-    glVertex3f (e[0], e[4], e[5]);
-    glVertex3f (e[3], e[4], e[5]);
+struct view /* culling data of the current frame */
+{
+  double plane [6][4]; /* frustum planes with inward normals */
 
-    /* sides */
-    glVertex3f (e[0], e[1], e[2]);
-    glVertex3f (e[0], e[1], e[5]);
+  double w [4], scale; /* clip space w row and pixels per unit of w scaled distance */
+};
 
-    glVertex3f (e[3], e[1], e[2]);
-    glVertex3f (e[3], e[1], e[5]);
+static struct cache *caches = NULL; /* per octree render caches */
 
-    glVertex3f (e[3], e[4], e[2]);
-    glVertex3f (e[3], e[4], e[5]);
+static GLint *first = NULL; /* merged draw ranges */
+static GLsizei *count = NULL;
+static int ranges = 0, rangesize = 0;
 
-    glVertex3f (e[0], e[4], e[2]);
-    glVertex3f (e[0], e[4], e[5]);
+static double lod = 2.0; /* subtrees smaller than this many pixels are drawn as proxies; zero disables */
 
-    glEnd ();
+/* append floats to a batch */
+static void push (struct batch *batch, GLfloat *v, int n)
+{
+  if (!batch->data || n > batch->size - batch->count)
+  {
+    batch->size = 2 * batch->size + n + 1024;
+    ERRMEM (batch->data = realloc (batch->data, batch->size * sizeof (GLfloat)));
   }
+
+  for (int i = 0; i < n; i ++) batch->data [batch->count ++] = v [i];
 }
 
-/* render domains */
-void render_domains (struct octree *octree)
+/* box edge end points as extents indices */
+static const char edge [12][2][3] = {{{0,1,2},{3,1,2}}, {{0,1,2},{0,4,2}}, {{3,1,2},{3,4,2}}, {{0,4,2},{3,4,2}}, /* lower base */
+                                     {{0,1,5},{3,1,5}}, {{0,1,5},{0,4,5}}, {{3,1,5},{3,4,5}}, {{0,4,5},{3,4,5}}, /* upper base */
+                                     {{0,1,2},{0,1,5}}, {{3,1,2},{3,1,5}}, {{3,4,2},{3,4,5}}, {{0,4,2},{0,4,5}}}; /* sides */
+
+/* pack box edges as lines */
+static void pack_box_lines (GLfloat *e, struct batch *batch)
 {
-  struct cell *cell;
-  struct face *face;
-  int i;
+  GLfloat v [3];
+  int i, j, k;
 
-  if (octree->down [0])
+  for (i = 0; i < 12; i ++)
+  {
+    for (j = 0; j < 2; j ++)
+    {
+      for (k = 0; k < 3; k ++) v [k] = e [(int) edge[i][j][k]];
+      push (batch, v, 3);
+    }
+  }
+}
+
+/* pack box faces as triangles */
+static void pack_box_triangles (GLfloat *e, struct batch *batch)
+{
+  static const char face [6][4][3] = {{{0,1,2},{0,1,5},{0,4,5},{0,4,2}}, {{3,1,2},{3,4,2},{3,4,5},{3,1,5}},
+                                      {{0,1,2},{3,1,2},{3,1,5},{0,1,5}}, {{0,4,2},{0,4,5},{3,4,5},{3,4,2}},
+                                      {{0,1,2},{0,4,2},{3,4,2},{3,1,2}}, {{0,1,5},{3,1,5},{3,4,5},{0,4,5}}}; /* -x, +x, -y, +y, -z, +z */
+  static const char corner [6] = {0, 1, 2, 0, 2, 3};
+  GLfloat v [6];
+  int i, j, k;
+
+  for (i = 0; i < 6; i ++)
   {
-    for (i = 0; i < 8; i ++) render_domains (octree->down [i]);
+    SET (v, 0.0);
+    v [i/2] = i % 2 ? 1.0 : -1.0;
+
+    for (j = 0; j < 6; j ++)
+    {
+      for (k = 0; k < 3; k ++) v [3+k] = e [(int) face[i][(int) corner[j]][k]];
+      push (batch, v, 6);
+    }
   }
+}
 
-  glBegin (GL_TRIANGLES);
+/* pack octant edges of a leaf as lines */
+static void pack_lines (struct octree *octree, struct batch *batch)
+{
+  GLfloat e [6];
 
-  glColor3f (0.5, 0.5, 0.5);
+  if (octree->down [0] == NULL)
+  {
+    COPY6 (octree->extents, e);
+
+    pack_box_lines (e, batch);
+  }
+}
+
+/* pack domain boundary triangles of an octant with face normals */
+static void pack_domains (struct octree *octree, struct batch *batch)
+{
+  struct cell *cell;
+  struct face *face;
+  GLfloat v [6];
+  int i, j;
 
   for (cell = octree->cell; cell; cell = cell->next)
   {
@@ -97,59 +168,413 @@ void render_domains (struct octree *octree)
     {
       if (face->leaf == NULL) continue;
 
-      REAL (*t) [3][3] = face->t;
+      COPY (face->normal, v);
 
       for (i = 0; i < face->n; i ++)
       {
-	glNormal3f (face->normal[0], face->normal[1], face->normal[2]);
-	glVertex3f (t[i][0][0], t[i][0][1], t[i][0][2]);
-	glVertex3f (t[i][1][0], t[i][1][1], t[i][1][2]);
-	glVertex3f (t[i][2][0], t[i][2][1], t[i][2][2]);
+	for (j = 0; j < 3; j ++)
+	{
+	  COPY (mesh_point (octree->mesh, FACE_VERTEX (face, i, j)), v+3);
+	  push (batch, v, 6);
+	}
       }
     }
   }
-
-  glEnd ();
 }
 
-/* render cells */
-void render_cells (struct octree *octree)
+/* pack all cell triangles of an octant shrunk towards its center */
+static void pack_cells (struct octree *octree, struct batch *batch)
 {
   REAL p [3], q [3], *x;
   struct cell *cell;
   struct face *face;
+  GLfloat v [6];
   int i, j;
 
-  if (octree->down [0])
-  {
-    for (i = 0; i < 8; i ++) render_cells (octree->down [i]);
-  }
-
   x = octree->extents;
 
   MID (x, x+3, p);
 
   for (cell = octree->cell; cell; cell = cell->next)
   {
-    glBegin (GL_TRIANGLES);
-
-    glColor4f (0.6, 0.6, 0.6, 0.3);
-
     for (face = cell->face; face; face = face->next)
     {
-      glNormal3f (face->normal[0], face->normal[1], face->normal[2]);
+      COPY (face->normal, v);
 
       for (i = 0; i < face->n; i++)
       {
 	for (j = 0; j < 3; j ++)
 	{
-	  SUB (face->t[i][j], p, q);
+	  SUB (mesh_point (octree->mesh, FACE_VERTEX (face, i, j)), p, q);
 	  ADDMUL (p, 0.8, q, q);
-	  glVertex3f (q[0], q[1], q[2]);
+	  COPY (q, v+3);
+	  push (batch, v, 6);
 	}
       }
     }
+  }
+}
+
+static const struct item domains = {pack_domains, pack_box_triangles, 6, 36, GL_TRIANGLES, GL_N3F_V3F},
+                         cells = {pack_cells, pack_box_triangles, 6, 36, GL_TRIANGLES, GL_N3F_V3F},
+                         lines = {pack_lines, pack_box_lines, 3, 24, GL_LINES, GL_V3F};
+
+/* extend bounds by vertices from a given one on */
+static void bound (struct batch *batch, const struct item *item, int from, GLfloat *bounds)
+{
+  GLfloat *v;
+  int i;
+
+  for (i = from; i < batch->count / item->stride; i ++)
+  {
+    v = batch->data + i * item->stride + item->stride - 3;
+
+    if (v[0] < bounds[0]) bounds[0] = v[0];
+    if (v[1] < bounds[1]) bounds[1] = v[1];
+    if (v[2] < bounds[2]) bounds[2] = v[2];
+    if (v[0] > bounds[3]) bounds[3] = v[0];
+    if (v[1] > bounds[4]) bounds[4] = v[1];
+    if (v[2] > bounds[5]) bounds[5] = v[2];
+  }
+}
+
+/* pack subtree in preorder, collecting proxies separately */
+static void pack_node (struct octree *octree, struct batch *batch, struct batch *proxies, const struct item *item)
+{
+  int index, from, i, j, k;
+  struct node *node;
+  GLfloat b [6];
+
+  if (batch->nodes == batch->nodesize)
+  {
+    batch->nodesize = 2 * batch->nodesize + 64;
+    ERRMEM (batch->node = realloc (batch->node, batch->nodesize * sizeof (struct node)));
+  }
+
+  index = batch->nodes ++;
+  from = batch->count / item->stride;
+
+  SET (b, FLT_MAX);
+  SET (b+3, -FLT_MAX);
+
+  item->pack (octree, batch);
+
+  bound (batch, item, from, b);
+
+  batch->node [index].own = batch->count / item->stride - from;
+
+  if (octree->down [0])
+  {
+    for (i = 0; i < 8; i ++)
+    {
+      j = batch->nodes;
+
+      pack_node (octree->down [i], batch, proxies, item);
+
+      node = &batch->node [j];
+
+      if (node->count) for (k = 0; k < 3; k ++)
+      {
+	b [k] = MIN (b [k], node->bounds [k]);
+	b [k+3] = MAX (b [k+3], node->bounds [k+3]);
+      }
+    }
+  }
+
+  node = &batch->node [index];
+  node->first = from;
+  node->count = batch->count / item->stride - from;
+  node->size = batch->nodes - index;
+  COPY6 (b, node->bounds);
+
+  if (node->count > item->proxycount)
+  {
+    node->proxy = proxies->count / item->stride;
+    item->proxy (b, proxies);
+  }
+  else node->proxy = -1;
+}
+
+/* pack render item of an octree and append its proxies */
+static void pack (struct octree *octree, struct batch *batch, const struct item *item)
+{
+  struct batch proxies = {NULL, 0, 0, 0, NULL, 0, 0, 0};
+  int i;
+
+  pack_node (octree, batch, &proxies, item);
+
+  for (i = 0; i < batch->nodes; i ++)
+  {
+    if (batch->node[i].proxy >= 0) batch->node[i].proxy += batch->count / item->stride;
+  }
+
+  if (proxies.count) push (batch, proxies.data, proxies.count);
+
+  free (proxies.data);
+}
+
+/* turn packed floats into vertices and upload them */
+static void upload (struct batch *batch, int stride)
+{
+  batch->count /= stride;
+
+#if VBO
+  if (batch->count)
+  {
+    glGenBuffers (1, &batch->buffer);
+    glBindBuffer (GL_ARRAY_BUFFER, batch->buffer);
+    glBufferData (GL_ARRAY_BUFFER, batch->count * stride * sizeof (GLfloat), batch->data, GL_STATIC_DRAW);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+  }
+
+  free (batch->data);
+  batch->data = NULL;
+#endif
+}
+
+/* set up culling from current matrices and viewport */
+static void view_setup (struct view *view)
+{
+  GLdouble p [16], m [16], c [16];
+  GLint viewport [4];
+  double *q;
+  int i, j, k;
 
-    glEnd ();
+  glGetDoublev (GL_PROJECTION_MATRIX, p);
+  glGetDoublev (GL_MODELVIEW_MATRIX, m);
+  glGetIntegerv (GL_VIEWPORT, viewport);
+
+  for (i = 0; i < 4; i ++) /* column major c = p m */
+  {
+    for (j = 0; j < 4; j ++)
+    {
+      for (c [4*i+j] = 0.0, k = 0; k < 4; k ++) c [4*i+j] += p [4*k+j] * m [4*i+k];
+    }
+  }
+
+  for (i = 0; i < 6; i ++) /* w +/- x, y, z >= 0 */
+  {
+    q = view->plane [i];
+
+    for (j = 0; j < 4; j ++) q [j] = c [4*j+3] + (i % 2 ? -1.0 : 1.0) * c [4*j+i/2];
+  }
+
+  for (j = 0; j < 4; j ++) view->w [j] = c [4*j+3];
+
+  view->scale = 0.5 * viewport [3] * fabs (p [5]) * sqrt (m[0]*m[0] + m[1]*m[1] + m[2]*m[2]); /* assumes uniform model view scaling */
+}
+
+/* classify bounds against the frustum: 0 outside, 1 intersecting, 2 inside */
+static int view_test (struct view *view, GLfloat *b)
+{
+  int i, inside = 2;
+  double *q;
+
+  for (i = 0; i < 6; i ++)
+  {
+    q = view->plane [i];
+
+    if (q[0]*b[q[0] > 0.0 ? 3 : 0] + q[1]*b[q[1] > 0.0 ? 4 : 1] + q[2]*b[q[2] > 0.0 ? 5 : 2] + q[3] < 0.0) return 0;
+
+    if (q[0]*b[q[0] > 0.0 ? 0 : 3] + q[1]*b[q[1] > 0.0 ? 1 : 4] + q[2]*b[q[2] > 0.0 ? 2 : 5] + q[3] < 0.0) inside = 1;
+  }
+
+  return inside;
+}
+
+/* projected diameter of bounds in pixels */
+static double view_pixels (struct view *view, GLfloat *b)
+{
+  double c [3], d [3], r, w;
+
+  MID (b, b+3, c);
+  SUB (b+3, b, d);
+  r = 0.5 * LEN (d);
+  w = DOT (view->w, c) + view->w [3];
+
+  return w > r ? 2.0 * r * view->scale / w : DBL_MAX;
+}
+
+/* append a draw range, merging it with the previous one when adjacent */
+static void range (GLint from, GLsizei n)
+{
+  if (n == 0) return;
+
+  if (ranges && first [ranges-1] + count [ranges-1] == from)
+  {
+    count [ranges-1] += n;
+    return;
+  }
+
+  if (ranges == rangesize)
+  {
+    rangesize = 2 * rangesize + 256;
+    ERRMEM (first = realloc (first, rangesize * sizeof (GLint)));
+    ERRMEM (count = realloc (count, rangesize * sizeof (GLsizei)));
+  }
+
+  first [ranges] = from;
+  count [ranges] = n;
+  ranges ++;
+}
+
+/* collect visible ranges of a subtree and return the index of the next subtree */
+static int visit (struct batch *batch, const struct item *item, struct view *view, int index, int inside)
+{
+  struct node *node = &batch->node [index];
+  int next = index + node->size, i;
+
+  if (node->count == 0) return next;
+
+  if (inside < 2 && (inside = view_test (view, node->bounds)) == 0) return next;
+
+  if (node->proxy < 0 && inside == 2)
+  {
+    range (node->first, node->count);
+  }
+  else if (node->proxy >= 0 && lod > 0.0 && view_pixels (view, node->bounds) < lod)
+  {
+    range (node->proxy, item->proxycount);
+  }
+  else
+  {
+    range (node->first, node->own);
+
+    for (i = index + 1; i < next; ) i = visit (batch, item, view, i, inside);
+  }
+
+  return next;
+}
+
+/* draw visible parts of a batch */
+static void draw (struct batch *batch, const struct item *item)
+{
+  struct view view;
+
+  if (!batch->count) return;
+
+  view_setup (&view);
+
+  ranges = 0;
+
+  visit (batch, item, &view, 0, 1);
+
+  if (!ranges) return;
+
+  glPushClientAttrib (GL_CLIENT_VERTEX_ARRAY_BIT);
+
+#if VBO
+  glBindBuffer (GL_ARRAY_BUFFER, batch->buffer);
+  glInterleavedArrays (item->format, 0, NULL);
+#else
+  glInterleavedArrays (item->format, 0, batch->data);
+#endif
+
+  glMultiDrawArrays (item->mode, first, count, ranges);
+
+#if VBO
+  glBindBuffer (GL_ARRAY_BUFFER, 0);
+#endif
+
+  glPopClientAttrib ();
+}
+
+/* free a batch */
+static void release (struct batch *batch)
+{
+#if VBO
+  if (batch->buffer) glDeleteBuffers (1, &batch->buffer);
+#endif
+
+  free (batch->data);
+  free (batch->node);
+}
+
+/* return render cache of an octree */
+static struct cache* cached (struct octree *octree)
+{
+  struct cache *cache;
+
+  for (cache = caches; cache; cache = cache->next)
+  {
+    if (cache->octree == octree) return cache;
+  }
+
+  ERRMEM (cache = calloc (1, sizeof (struct cache)));
+  cache->octree = octree;
+  cache->next = caches;
+  caches = cache;
+
+  return cache;
+}
+
+/* return a render item, packing it on first use */
+static struct batch* packed (struct octree *octree, struct batch *batch, const struct item *item)
+{
+  if (!batch->packed)
+  {
+    pack (octree, batch, item);
+    upload (batch, item->stride);
+    batch->packed = 1;
+  }
+
+  return batch;
+}
+
+/* render octree itself */
+void render_octree (struct octree *octree)
+{
+  glColor4f (0.1, 0.1, 0.1, 0.1);
+
+  draw (packed (octree, &cached (octree)->lines, &lines), &lines);
+}
+
+/* render domains */
+void render_domains (struct octree *octree)
+{
+  glColor3f (0.5, 0.5, 0.5);
+
+  draw (packed (octree, &cached (octree)->domains, &domains), &domains);
+}
+
+/* render cells */
+void render_cells (struct octree *octree)
+{
+  glColor4f (0.6, 0.6, 0.6, 0.3);
+
+  draw (packed (octree, &cached (octree)->cells, &cells), &cells);
+}
+
+/* pack octree domains now, or again after the octree has changed; other items are packed when first rendered */
+void render_update (struct octree *octree)
+{
+  render_release (octree);
+
+  packed (octree, &cached (octree)->domains, &domains);
+}
+
+/* set pixel size below which subtrees are drawn as bounding box proxies; zero draws all triangles */
+void render_lod (double pixels)
+{
+  lod = pixels;
+}
+
+/* free render items of an octree */
+void render_release (struct octree *octree)
+{
+  struct cache **cache, *next;
+
+  for (cache = &caches; *cache; cache = &(*cache)->next)
+  {
+    if ((*cache)->octree == octree)
+    {
+      next = (*cache)->next;
+      release (&(*cache)->domains);
+      release (&(*cache)->cells);
+      release (&(*cache)->lines);
+      free (*cache);
+      *cache = next;
+      return;
+    }
   }
 }
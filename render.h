@@ -17,4 +17,13 @@ void render_domains (struct octree *octree);
 /* render cells */
 void render_cells (struct octree *octree);
 
+/* pack octree domains now, or again after the octree has changed; other items are packed when first rendered */
+void render_update (struct octree *octree);
+
+/* set pixel size below which subtrees are drawn as bounding box proxies; zero draws all triangles */
+void render_lod (double pixels);
+
+/* free render items of an octree */
+void render_release (struct octree *octree);
+
 #endif
@@ -33,6 +33,7 @@ static int leaves_count (struct shape *shape)
   case CYL:
   case MLS:
   case FLT:
+  case MESH:
     return 1;
     break;
   }
@@ -113,6 +114,7 @@ static void leaves_within_sphere (struct shape *shape, REAL c [3], REAL r, struc
     break;
   case CYL:
   case MLS:
+  case MESH:
     d [3] = shape_evaluate (shape, c);
 
     if (fabs (d[3]) <= r)
@@ -258,6 +260,7 @@ static int compare_leaves (struct shape **ll, struct shape **rr)
     }
     break;
     case MLS:
+    case MESH:
       return (*ll) < (*rr) ? -1 : (*ll) > (*rr) ? 1 : 0; /* XXX: no comparison for mls */
     break;
     default:
@@ -304,6 +307,13 @@ static int subtracted (struct shape *shape)
       return data->s == -1;
     }
     break;
+  case MESH:
+    {
+      struct trimesh *data = shape->data;
+
+      return data->s == -1;
+    }
+    break;
   }
 
   return 0;
@@ -585,6 +595,17 @@ static struct shape* offset (struct shape *shape, REAL distance)
 
 	ADDMUL (p, distance, n, p);
       }
+
+      mls_index (data);
+    }
+    break;
+  case MESH:
+    {
+      struct trimesh *data = copy->data;
+
+      distance *= data->s;
+
+      data->o += distance;
     }
     break;
   }
@@ -716,10 +737,16 @@ struct shape* shape_copy (struct shape *shape)
       {
 	COPY6 (in->op[i], out->op[i]);
       }
+      out->cell = out->seed = NULL;
+      out->bound = NULL;
+      mls_index (out);
 
       copy->data = out;
     }
     break;
+  case MESH:
+    copy->data = trimesh_copy (shape->data);
+    break;
   case FLT:
     {
       struct fillet *data;
@@ -785,6 +812,13 @@ struct shape* shape_invert (struct shape *shape)
       data->s *= -1.0;
     }
     break;
+  case MESH:
+    {
+      struct trimesh *data = shape->data;
+
+      data->s *= -1.0;
+    }
+    break;
   case FLT:
     {
       struct fillet *data = shape->data;
@@ -857,6 +891,24 @@ void shape_move (struct shape *shape, REAL *vector)
       {
         ACC (vector, data->op[i]);
       }
+
+      ACC (vector, data->lo); /* the index is translation invariant */
+    }
+    break;
+  case MESH:
+    {
+      struct trimesh *data = shape->data;
+
+      for (int i = 0; i < data->np; i ++)
+      {
+        ACC (vector, data->p[i]);
+      }
+
+      for (int i = 0; i < data->nnode; i ++) /* so is the hierarchy */
+      {
+        ACC (vector, data->node[i].box);
+        ACC (vector, data->node[i].box+3);
+      }
     }
     break;
   }
@@ -914,6 +966,21 @@ void shape_rotate (struct shape *shape, REAL *point, REAL *matrix)
 	COPY (data->op[i]+3, v);
 	NVMUL (matrix, v, data->op[i]+3);
       }
+
+      mls_index (data);
+    }
+    break;
+  case MESH:
+    {
+      struct trimesh *data = shape->data;
+
+      for (int i = 0; i < data->np; i ++)
+      {
+	SUB (data->p[i], point, v);
+	NVADDMUL (point, matrix, v, data->p[i]);
+      }
+
+      trimesh_index (data);
     }
     break;
   }
@@ -1044,8 +1111,9 @@ REAL shape_evaluate (struct shape *shape, REAL *point)
   struct cylinder *cylinder;
   struct sphere *sphere;
   struct fillet *fillet;
-  struct mls *mls;
-  REAL a, b, v, q, z [3];
+  REAL a, b, v, z [3];
+
+  if (shape->tape) return tape_evaluate (shape->tape, point);
 
   switch (shape->what)
   {
@@ -1080,18 +1148,10 @@ REAL shape_evaluate (struct shape *shape, REAL *point)
     v = cylinder->s * (b - a);
     break;
   case MLS:
-    mls = shape->data;
-    a = b = 0.0;
-    q = mls->r * mls->r;
-    for (int i = 0; i < mls->nop; i ++)
-    {
-      SUB (point, mls->op[i], z);
-      v = DOT (z, z);
-      v = exp (- v / q);
-      a += DOT (mls->op[i]+3, z) * v;
-      b += v;
-    }
-    v = mls->s * a / b;
+    v = mls_evaluate (shape->data, point);
+    break;
+  case MESH:
+    v = trimesh_evaluate (shape->data, point);
     break;
   case FLT:
     fillet = shape->data;
@@ -1116,6 +1176,203 @@ REAL shape_evaluate (struct shape *shape, REAL *point)
   return v;
 }
 
+/* fillet blend of left and right distances; non-decreasing in both arguments */
+inline static REAL blend (REAL v, REAL a, REAL b)
+{
+  if (v > 0)
+  {
+    if (a > v || b > v) return MIN (a, b);
+    else return v - sqrt((a-v)*(a-v)+(b-v)*(b-v));
+  }
+  else
+  {
+    if (a < v || b < v) return MAX (a, b);
+    else return sqrt((a-v)*(a-v)+(b-v)*(b-v)) + v;
+  }
+}
+
+/* bound shape distance over an axis-aligned box: range [0] <= shape_evaluate (shape, x) <= range [1] */
+void shape_interval (struct shape *shape, REAL box [6], REAL range [2])
+{
+  struct halfspace *halfspace;
+  struct cylinder *cylinder;
+  struct sphere *sphere;
+  struct fillet *fillet;
+  REAL l [2], r [2], c [3], h [3], z [3], a, b, u, v;
+  int i;
+
+  MID (box, box+3, c);
+  SUB (box+3, c, h);
+
+  switch (shape->what)
+  {
+  case ADD:
+    shape_interval (shape->left, box, l);
+    shape_interval (shape->right, box, r);
+    range [0] = MIN (l[0], r[0]);
+    range [1] = MIN (l[1], r[1]);
+    break;
+  case MUL:
+    shape_interval (shape->left, box, l);
+    shape_interval (shape->right, box, r);
+    range [0] = MAX (l[0], r[0]);
+    range [1] = MAX (l[1], r[1]);
+    break;
+  case HSP:
+    halfspace = shape->data;
+    SUB (c, halfspace->p, z);
+    a = DOT (z, halfspace->n);
+    b = fabs (halfspace->n[0])*h[0] + fabs (halfspace->n[1])*h[1] + fabs (halfspace->n[2])*h[2];
+    l [0] = halfspace->s * (a - b);
+    l [1] = halfspace->s * (a + b);
+    range [0] = MIN (l[0], l[1]);
+    range [1] = MAX (l[0], l[1]);
+    break;
+  case SPH:
+    sphere = shape->data;
+    SUB (c, sphere->c, z);
+    for (i = 0; i < 3; i ++) /* nearest and farthest box points */
+    {
+      a = fabs (z[i]);
+      l [0] = MAX (a - h[i], 0.0);
+      c [i] = a + h[i];
+      z [i] = l [0];
+    }
+    l [0] = sphere->s * (LEN (z) - sphere->r);
+    l [1] = sphere->s * (LEN (c) - sphere->r);
+    range [0] = MIN (l[0], l[1]);
+    range [1] = MAX (l[0], l[1]);
+    break;
+  case CYL:
+    cylinder = shape->data;
+    SUB (c, cylinder->p, z);
+    a = DOT (z, cylinder->d);
+    SUBMUL (z, a, cylinder->d, z);
+    u = LEN (z) - LEN (h); /* axis distance is 1-Lipschitz */
+    u = MAX (u, 0.0);
+    for (v = 0.0, i = 0; i < 8; i ++) /* and convex, hence maximal at a corner */
+    {
+      z [0] = (i & 1 ? box[3] : box[0]) - cylinder->p[0];
+      z [1] = (i & 2 ? box[4] : box[1]) - cylinder->p[1];
+      z [2] = (i & 4 ? box[5] : box[2]) - cylinder->p[2];
+      a = DOT (z, cylinder->d);
+      SUBMUL (z, a, cylinder->d, z);
+      a = LEN (z);
+      v = MAX (v, a);
+    }
+    a = cylinder->r;
+    if (u < a) u = 0.5*((u*u)/a + a); /* smoothing is monotone */
+    if (v < a) v = 0.5*((v*v)/a + a);
+    l [0] = cylinder->s * (u - a);
+    l [1] = cylinder->s * (v - a);
+    range [0] = MIN (l[0], l[1]);
+    range [1] = MAX (l[0], l[1]);
+    break;
+  case MLS:
+    mls_interval (shape->data, c, h, range);
+    break;
+  case MESH:
+    trimesh_interval (shape->data, c, h, range);
+    break;
+  case FLT:
+    fillet = shape->data;
+    shape_interval (shape->left, box, l);
+    shape_interval (shape->right, box, r);
+    range [0] = blend (fillet->r, l[0], r[0]);
+    range [1] = blend (fillet->r, l[1], r[1]);
+    break;
+  }
+}
+
+/* free new nodes of a pruned shape */
+static void unprune (struct shape *shape)
+{
+  if (shape->left->up == shape) unprune (shape->left);
+  if (shape->right->up == shape) unprune (shape->right);
+  if (shape->tape) tape_destroy (shape->tape);
+  free (shape);
+}
+
+/* keep one pruned branch and free the other if it was newly created */
+static struct shape* drop (struct shape *keep, struct shape *other)
+{
+  if (!other->up) unprune (other);
+
+  return keep;
+}
+
+/* prune shape to a box, output its distance bounds and return the pruned node */
+static struct shape* prune (struct shape *shape, REAL box [6], REAL range [2])
+{
+  struct shape *l, *r, *out;
+  REAL a [2], b [2];
+
+  switch (shape->what)
+  {
+  case ADD:
+  case MUL:
+    l = prune (shape->left, box, a);
+    r = prune (shape->right, box, b);
+
+    if (shape->what == ADD)
+    {
+      range [0] = MIN (a[0], b[0]);
+      range [1] = MIN (a[1], b[1]);
+
+      if (b[0] > a[1]) return drop (l, r); /* right is above left within the box */
+      if (a[0] > b[1]) return drop (r, l); /* left is above right within the box */
+    }
+    else
+    {
+      range [0] = MAX (a[0], b[0]);
+      range [1] = MAX (a[1], b[1]);
+
+      if (b[1] < a[0]) return drop (l, r); /* right is below left within the box */
+      if (a[1] < b[0]) return drop (r, l); /* left is below right within the box */
+    }
+
+    if (l == shape->left && r == shape->right) return shape;
+
+    ERRMEM (out = calloc (1, sizeof (struct shape)));
+    out->what = shape->what;
+    out->left = l;
+    out->right = r;
+    if (!l->up) l->up = out; /* only new nodes are linked upwards; returned shared nodes keep their parents */
+    if (!r->up) r->up = out;
+
+    return out;
+  case HSP:
+  case SPH:
+  case CYL:
+  case MLS:
+  case FLT:
+  case MESH:
+    shape_interval (shape, box, range);
+    break;
+  }
+
+  return shape;
+}
+
+/* return shape with branches dominated within a box removed; unchanged branches are shared with the input */
+struct shape* shape_prune (struct shape *shape, REAL box [6])
+{
+  struct shape *out;
+  REAL range [2];
+
+  out = prune (shape, box, range);
+
+  if (out != shape && !out->up) shape_compile (out); /* new root */
+
+  return out;
+}
+
+/* free pruned shape nodes that are not shared with the input shape */
+void shape_prune_destroy (struct shape *pruned, struct shape *shape)
+{
+  if (pruned != shape && !pruned->up) unprune (pruned);
+}
+
 /* compute shape extents */
 void shape_extents (struct shape *shape, REAL *extents)
 {
@@ -1204,6 +1461,9 @@ void shape_extents (struct shape *shape, REAL *extents)
     extents [4] += mls->r * 2;
     extents [5] += mls->r * 2;
     break;
+  case MESH:
+    trimesh_extents (shape->data, extents);
+    break;
   }
 }
 
@@ -1262,7 +1522,6 @@ void leaf_normal (struct shape *leaf, REAL *point, REAL *normal)
   struct cylinder *cylinder;
   struct sphere *sphere;
   struct fillet *fillet;
-  struct mls *mls;
   REAL a, b, v, q, z [3];
 
   switch (leaf->what)
@@ -1289,20 +1548,10 @@ void leaf_normal (struct shape *leaf, REAL *point, REAL *normal)
     SCALE (normal, cylinder->s);
     break;
   case MLS:
-    mls = leaf->data;
-    b = 0.0;
-    SET (normal, 0);
-    q = mls->r * mls->r;
-    for (int i = 0; i < mls->nop; i ++)
-    {
-      SUB (point, mls->op[i], z);
-      v = DOT (z, z);
-      v = exp (- v / q);
-      ADDMUL (normal, v, mls->op[i]+3, normal);
-      b += v;
-    }
-    DIV (normal, b, normal);
-    SCALE (normal, mls->s);
+    mls_normal (leaf->data, point, normal);
+    break;
+  case MESH:
+    trimesh_normal (leaf->data, point, normal);
     break;
   case FLT:
     fillet = leaf->data;
@@ -1373,6 +1622,8 @@ void shape_destroy (struct shape *shape)
 {
   struct mls *mls;
 
+  if (shape->tape) tape_destroy (shape->tape);
+
   switch (shape->what)
   {
   case ADD:
@@ -1392,9 +1643,15 @@ void shape_destroy (struct shape *shape)
     break;
   case MLS:
     mls = shape->data;
+    free (mls->cell);
+    free (mls->seed);
+    free (mls->bound);
     free (mls->op);
     free (mls);
     break;
+  case MESH:
+    trimesh_destroy (shape->data);
+    break;
   }
 
   free (shape);
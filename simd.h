@@ -0,0 +1,134 @@
+/*
+ * simd.h
+ * ------
+ * thin vector layer over REAL lanes: AVX, SSE2 or scalar fallback
+ */
+
+#ifndef __simd__
+#define __simd__
+
+#define SIMD_CAT(a, b) a ## b
+#define SIMD_XCAT(a, b) SIMD_CAT(a, b)
+#define float_IS_FLOAT 1
+#define double_IS_FLOAT 0
+#define REAL_IS_FLOAT SIMD_XCAT(REAL, _IS_FLOAT) /* expands to float_IS_FLOAT or double_IS_FLOAT */
+
+#if defined(__AVX__) && !defined(NOSIMD)
+
+#include <immintrin.h>
+
+#if REAL_IS_FLOAT
+typedef __m256 VREAL;
+#define VLEN 8
+#define VSET(a) _mm256_set1_ps (a)
+#define VLOAD(a) _mm256_loadu_ps (a)
+#define VSTORE(a, b) _mm256_storeu_ps (a, b)
+#define VADD(a, b) _mm256_add_ps (a, b)
+#define VSUB(a, b) _mm256_sub_ps (a, b)
+#define VMUL(a, b) _mm256_mul_ps (a, b)
+#define VDIV(a, b) _mm256_div_ps (a, b)
+#define VMIN(a, b) _mm256_min_ps (a, b)
+#define VMAX(a, b) _mm256_max_ps (a, b)
+#define VSQRT(a) _mm256_sqrt_ps (a)
+#define VLTSELECT(a, b, x, y) _mm256_blendv_ps (y, x, _mm256_cmp_ps (a, b, _CMP_LT_OQ)) /* a < b ? x : y */
+/* s * (sqrt (d) - r) with the difference in double precision, as in the scalar code */
+static inline VREAL VSPHERE (VREAL d, REAL r, REAL s)
+{
+  __m256d lo = _mm256_cvtps_pd (_mm256_castps256_ps128 (d)),
+          hi = _mm256_cvtps_pd (_mm256_extractf128_ps (d, 1)),
+	  rr = _mm256_set1_pd (r), ss = _mm256_set1_pd (s);
+  lo = _mm256_mul_pd (ss, _mm256_sub_pd (_mm256_sqrt_pd (lo), rr));
+  hi = _mm256_mul_pd (ss, _mm256_sub_pd (_mm256_sqrt_pd (hi), rr));
+  return _mm256_insertf128_ps (_mm256_castps128_ps256 (_mm256_cvtpd_ps (lo)), _mm256_cvtpd_ps (hi), 1);
+}
+#else
+typedef __m256d VREAL;
+#define VLEN 4
+#define VSET(a) _mm256_set1_pd (a)
+#define VLOAD(a) _mm256_loadu_pd (a)
+#define VSTORE(a, b) _mm256_storeu_pd (a, b)
+#define VADD(a, b) _mm256_add_pd (a, b)
+#define VSUB(a, b) _mm256_sub_pd (a, b)
+#define VMUL(a, b) _mm256_mul_pd (a, b)
+#define VDIV(a, b) _mm256_div_pd (a, b)
+#define VMIN(a, b) _mm256_min_pd (a, b)
+#define VMAX(a, b) _mm256_max_pd (a, b)
+#define VSQRT(a) _mm256_sqrt_pd (a)
+#define VLTSELECT(a, b, x, y) _mm256_blendv_pd (y, x, _mm256_cmp_pd (a, b, _CMP_LT_OQ))
+#define VSPHERE(d, r, s) VMUL (VSET (s), VSUB (VSQRT (d), VSET (r)))
+#endif
+
+#elif defined(__SSE2__) && !defined(NOSIMD)
+
+#include <emmintrin.h>
+
+#if REAL_IS_FLOAT
+typedef __m128 VREAL;
+#define VLEN 4
+#define VSET(a) _mm_set1_ps (a)
+#define VLOAD(a) _mm_loadu_ps (a)
+#define VSTORE(a, b) _mm_storeu_ps (a, b)
+#define VADD(a, b) _mm_add_ps (a, b)
+#define VSUB(a, b) _mm_sub_ps (a, b)
+#define VMUL(a, b) _mm_mul_ps (a, b)
+#define VDIV(a, b) _mm_div_ps (a, b)
+#define VMIN(a, b) _mm_min_ps (a, b)
+#define VMAX(a, b) _mm_max_ps (a, b)
+#define VSQRT(a) _mm_sqrt_ps (a)
+static inline VREAL VLTSELECT (VREAL a, VREAL b, VREAL x, VREAL y)
+{
+  VREAL m = _mm_cmplt_ps (a, b);
+  return _mm_or_ps (_mm_and_ps (m, x), _mm_andnot_ps (m, y));
+}
+static inline VREAL VSPHERE (VREAL d, REAL r, REAL s)
+{
+  __m128d lo = _mm_cvtps_pd (d),
+          hi = _mm_cvtps_pd (_mm_movehl_ps (d, d)),
+	  rr = _mm_set1_pd (r), ss = _mm_set1_pd (s);
+  lo = _mm_mul_pd (ss, _mm_sub_pd (_mm_sqrt_pd (lo), rr));
+  hi = _mm_mul_pd (ss, _mm_sub_pd (_mm_sqrt_pd (hi), rr));
+  return _mm_movelh_ps (_mm_cvtpd_ps (lo), _mm_cvtpd_ps (hi));
+}
+#else
+typedef __m128d VREAL;
+#define VLEN 2
+#define VSET(a) _mm_set1_pd (a)
+#define VLOAD(a) _mm_loadu_pd (a)
+#define VSTORE(a, b) _mm_storeu_pd (a, b)
+#define VADD(a, b) _mm_add_pd (a, b)
+#define VSUB(a, b) _mm_sub_pd (a, b)
+#define VMUL(a, b) _mm_mul_pd (a, b)
+#define VDIV(a, b) _mm_div_pd (a, b)
+#define VMIN(a, b) _mm_min_pd (a, b)
+#define VMAX(a, b) _mm_max_pd (a, b)
+#define VSQRT(a) _mm_sqrt_pd (a)
+static inline VREAL VLTSELECT (VREAL a, VREAL b, VREAL x, VREAL y)
+{
+  VREAL m = _mm_cmplt_pd (a, b);
+  return _mm_or_pd (_mm_and_pd (m, x), _mm_andnot_pd (m, y));
+}
+#define VSPHERE(d, r, s) VMUL (VSET (s), VSUB (VSQRT (d), VSET (r)))
+#endif
+
+#else /* scalar fallback */
+
+#include <math.h>
+
+typedef REAL VREAL;
+#define VLEN 1
+#define VSET(a) (a)
+#define VLOAD(a) (*(a))
+#define VSTORE(a, b) (*(a) = (b))
+#define VADD(a, b) ((a) + (b))
+#define VSUB(a, b) ((a) - (b))
+#define VMUL(a, b) ((a) * (b))
+#define VDIV(a, b) ((a) / (b))
+#define VMIN(a, b) ((a) < (b) ? (a) : (b))
+#define VMAX(a, b) ((a) > (b) ? (a) : (b))
+#define VSQRT(a) ((REAL) sqrt (a))
+#define VLTSELECT(a, b, x, y) ((a) < (b) ? (x) : (y))
+#define VSPHERE(d, r, s) ((REAL) ((s) * (sqrt (d) - (r))))
+
+#endif
+
+#endif
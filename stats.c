@@ -0,0 +1,199 @@
+/*
+ * stats.c
+ * -------
+ * per phase timers and call counts, per level octree counts and memory
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "stats.h"
+#include "arena.h"
+#include "mesh.h"
+#include "error.h"
+
+struct stats *stats = NULL;
+
+static const char *name [STATS_PHASES] = {"initialize", "refine", "prune", "interval", "leaves", "evaluate", "polygonise",
+  "split", "weld", "adjacency", "linear", "trim", "link", "export"};
+
+static const int parent [STATS_PHASES] = {-1, STATS_INITIALIZE, STATS_REFINE, STATS_REFINE, STATS_REFINE, STATS_REFINE, STATS_REFINE,
+  STATS_REFINE, STATS_REFINE, STATS_INITIALIZE, STATS_ADJACENCY, STATS_ADJACENCY, STATS_ADJACENCY, -1};
+
+/* start collecting statistics for a number of workers */
+void stats_create (int workers)
+{
+  stats_destroy ();
+
+  ERRMEM (stats = calloc (1, sizeof (struct stats)));
+  stats->workers = workers > 1 ? workers : 1;
+  ERRMEM (stats->worker = calloc (stats->workers, sizeof (struct phase)));
+}
+
+/* count subtree */
+static void count (struct octree *octree, int level)
+{
+  struct cell *cell;
+  struct face *face;
+  int i;
+
+  if (level >= STATS_LEVELS) level = STATS_LEVELS - 1;
+
+  stats->octants [level] ++;
+
+  for (cell = octree->cell; cell; cell = cell->next)
+  {
+    stats->cells [level] ++;
+
+    for (face = cell->face; face; face = face->next)
+    {
+      stats->faces [level] ++;
+      stats->triangles [level] += face->n;
+    }
+  }
+
+  if (octree->down [0]) for (i = 0; i < 8; i ++) count (octree->down [i], level + 1);
+}
+
+/* count octants, cells, faces and triangles per level and memory of an octree below a root of a given edge length */
+void stats_octree (struct octree *octree, REAL edge)
+{
+  size_t arena, mesh;
+  long chunks, allocations;
+  int level;
+
+  if (!stats) return;
+
+  level = (int) floor (log2 (edge / (octree->extents[3] - octree->extents[0])) + 0.5);
+
+  count (octree, level < 0 ? 0 : level);
+
+  arena = arena_bytes (octree->arena, -1);
+  mesh = mesh_bytes (octree->mesh);
+  arena_stats (octree->arena, &chunks, &allocations);
+
+  if (arena > stats->arena) stats->arena = arena; /* streamed subtrees are counted one at a time */
+  if (mesh > stats->mesh) stats->mesh = mesh;
+  stats->allocations += allocations;
+  stats->vertices += octree->mesh->count;
+}
+
+/* sum phase over workers */
+static void total (int phase, double *time, long *calls)
+{
+  *time = 0.0;
+  *calls = 0;
+
+  for (int i = 0; i < stats->workers; i ++)
+  {
+    *time += stats->worker[i].time [phase];
+    *calls += stats->worker[i].calls [phase];
+  }
+}
+
+/* nesting depth of a phase */
+static int depth (int phase)
+{
+  int d = 0;
+
+  while ((phase = parent [phase]) >= 0) d ++;
+
+  return d;
+}
+
+/* print phase and its children */
+static void print_phase (FILE *f, int phase)
+{
+  double time, up;
+  long calls, n;
+  int i;
+
+  total (phase, &time, &calls);
+
+  if (!calls) return;
+
+  fprintf (f, "%*s%-*s %12ld %12.6f", 2*depth (phase), "", 20 - 2*depth (phase), name [phase], calls, time);
+
+  if (parent [phase] >= 0)
+  {
+    total (parent [phase], &up, &n);
+    fprintf (f, " %6.1f%%\n", up > 0.0 ? 100.0 * time / up : 0.0);
+  }
+  else fprintf (f, "\n");
+
+  for (i = 0; i < STATS_PHASES; i ++) if (parent [i] == phase) print_phase (f, i);
+}
+
+/* print human readable statistics */
+void stats_print (FILE *f)
+{
+  int i;
+
+  if (!stats) return;
+
+  fprintf (f, "%-20s %12s %12s %7s\n", "Phase", "calls", "seconds", "parent");
+
+  for (i = 0; i < STATS_PHASES; i ++) if (parent [i] < 0) print_phase (f, i);
+
+  if (stats->workers > 1) fprintf (f, "Nested phase times are summed over %d workers.\n", stats->workers);
+
+  fprintf (f, "%-20s %12s %12s %12s %12s\n", "Level", "octants", "cells", "faces", "triangles");
+
+  for (i = 0; i < STATS_LEVELS; i ++)
+  {
+    if (stats->octants [i]) fprintf (f, "%-20d %12ld %12ld %12ld %12ld\n", i, stats->octants [i], stats->cells [i], stats->faces [i], stats->triangles [i]);
+  }
+
+  fprintf (f, "Octree chunks %.1f MB in %ld allocations, %ld welded vertices in %.1f MB.\n",
+    (double) stats->arena / 1048576.0, stats->allocations, stats->vertices, (double) stats->mesh / 1048576.0);
+}
+
+/* write statistics as JSON; zero on failure */
+int stats_json (const char *path)
+{
+  double time;
+  long calls;
+  FILE *f;
+  int i, n;
+
+  if (!stats || !(f = fopen (path, "w"))) return 0;
+
+  fprintf (f, "{\n  \"workers\": %d,\n  \"phases\": [\n", stats->workers);
+
+  for (i = 0; i < STATS_PHASES; i ++)
+  {
+    total (i, &time, &calls);
+    fprintf (f, "    {\"name\": \"%s\", \"parent\": ", name [i]);
+    if (parent [i] >= 0) fprintf (f, "\"%s\"", name [parent [i]]);
+    else fprintf (f, "null");
+    fprintf (f, ", \"calls\": %ld, \"seconds\": %.9f}%s\n", calls, time, i < STATS_PHASES - 1 ? "," : "");
+  }
+
+  fprintf (f, "  ],\n  \"levels\": [\n");
+
+  for (n = i = 0; i < STATS_LEVELS; i ++) if (stats->octants [i]) n = i + 1;
+
+  for (i = 0; i < n; i ++)
+  {
+    fprintf (f, "    {\"level\": %d, \"octants\": %ld, \"cells\": %ld, \"faces\": %ld, \"triangles\": %ld}%s\n",
+      i, stats->octants [i], stats->cells [i], stats->faces [i], stats->triangles [i], i < n - 1 ? "," : "");
+  }
+
+  fprintf (f, "  ],\n  \"memory\": {\"arena\": %zu, \"allocations\": %ld, \"mesh\": %zu, \"vertices\": %ld}\n}\n",
+    stats->arena, stats->allocations, stats->mesh, stats->vertices);
+
+  return fclose (f) == 0;
+}
+
+/* stop collecting statistics */
+void stats_destroy (void)
+{
+  if (stats)
+  {
+    free (stats->worker);
+    free (stats);
+    stats = NULL;
+  }
+}
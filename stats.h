@@ -0,0 +1,97 @@
+/*
+ * stats.h
+ * -------
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "oaktree.h"
+
+#ifndef __stats__
+#define __stats__
+
+enum /* instrumented phases; see stats.c for their hierarchy */
+{
+  STATS_INITIALIZE,
+  STATS_REFINE,
+  STATS_PRUNE,
+  STATS_INTERVAL,
+  STATS_LEAVES,
+  STATS_EVALUATE,
+  STATS_POLYGONISE,
+  STATS_SPLIT,
+  STATS_WELD,
+  STATS_ADJACENCY,
+  STATS_LINEAR,
+  STATS_TRIM,
+  STATS_LINK,
+  STATS_EXPORT,
+  STATS_PHASES
+};
+
+#define STATS_LEVELS 32 /* octree levels counted */
+
+struct phase /* per worker phase totals */
+{
+  double time [STATS_PHASES];
+
+  long calls [STATS_PHASES];
+
+  char pad [64]; /* keep workers off each other's cache lines */
+};
+
+struct stats
+{
+  struct phase *worker;
+
+  int workers;
+
+  long octants [STATS_LEVELS], cells [STATS_LEVELS], faces [STATS_LEVELS], triangles [STATS_LEVELS];
+
+  size_t arena, mesh; /* peak bytes of octree chunks and welded vertices */
+
+  long allocations, vertices; /* arena allocations and welded vertices */
+};
+
+extern struct stats *stats; /* NULL unless statistics are collected */
+
+/* return monotonic clock seconds or zero when statistics are off */
+static inline double stats_begin (void)
+{
+  struct timespec t;
+
+  if (!stats) return 0.0;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+
+  return (double) t.tv_sec + 1E-9 * (double) t.tv_nsec;
+}
+
+/* add time since a stats_begin () to a worker's phase */
+static inline void stats_end (int worker, int phase, double start)
+{
+  if (stats)
+  {
+    struct phase *p = &stats->worker [worker];
+
+    p->time [phase] += stats_begin () - start;
+    p->calls [phase] ++;
+  }
+}
+
+/* start collecting statistics for a number of workers */
+void stats_create (int workers);
+
+/* count octants, cells, faces and triangles per level and memory of an octree below a root of a given edge length */
+void stats_octree (struct octree *octree, REAL edge);
+
+/* print human readable statistics */
+void stats_print (FILE *f);
+
+/* write statistics as JSON; zero on failure */
+int stats_json (const char *path);
+
+/* stop collecting statistics */
+void stats_destroy (void);
+
+#endif
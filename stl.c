@@ -1,46 +1,269 @@
+/*
+ * stl.c
+ * -----
+ * binary and ASCII STL reading from a memory mapped file
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "pool.h"
 #include "error.h"
+#include "alg.h"
 
-/* STL read */
-REAL* stlread (const char *path, int *count)
+#define CHUNK_SIZE (1 << 20) /* minimum ASCII bytes per parsing task */
+
+struct chunk /* ASCII parsing task */
 {
-  FILE *f = fopen (path, "r");
-  if (!f) return NULL;
-  int size = 1024, i;
-  char buff[1024];
-  REAL *triang, *t;
-  (*count) = 0;
+  const char *begin, *end, *eof;
+
+  REAL *triang;
+
+  int count, size;
+};
+
+/* skip white space */
+static const char* skip (const char *p, const char *eof)
+{
+  while (p < eof && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p ++;
+
+  return p;
+}
+
+/* match a keyword token at p and return the position after it or NULL */
+static const char* keyword (const char *p, const char *eof, const char *word, size_t length)
+{
+  p = skip (p, eof);
 
-  ERRMEM (triang = malloc (size * sizeof(REAL[9])));
-  t = triang;
+  if ((size_t) (eof - p) < length || memcmp (p, word, length)) return NULL;
 
-  while (fscanf (f, "%s", buff) != EOF)
+  return p + length;
+}
+
+/* parse a number; plain decimals are converted exactly in double precision, anything else by strtod */
+static const char* number (const char *p, const char *eof, REAL *out)
+{
+  static const double power [] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  unsigned long long mantissa = 0;
+  int digits = 0, exponent = 0, e = 0, esign = 1, negative = 0;
+  const char *q;
+  double v;
+
+  p = q = skip (p, eof);
+
+  if (p < eof && (*p == '-' || *p == '+')) negative = (*p ++ == '-');
+
+  for (; p < eof && *p >= '0' && *p <= '9'; p ++, digits ++) mantissa = 10*mantissa + (*p - '0');
+
+  if (p < eof && *p == '.')
   {
-    if (strcmp (buff, "outer") == 0)
+    for (p ++; p < eof && *p >= '0' && *p <= '9'; p ++, digits ++, exponent --) mantissa = 10*mantissa + (*p - '0');
+  }
+
+  ASSERT (digits, "STL format error");
+
+  if (p < eof && (*p == 'e' || *p == 'E'))
+  {
+    p ++;
+    if (p < eof && (*p == '-' || *p == '+')) esign = (*p ++ == '-') ? -1 : 1;
+    for (; p < eof && *p >= '0' && *p <= '9' && e < 10000; p ++) e = 10*e + (*p - '0');
+    exponent += esign * e;
+  }
+
+  if (digits <= 15 && exponent >= -22 && exponent <= 22) /* both operands exact: correctly rounded */
+  {
+    v = exponent < 0 ? (double) mantissa / power [-exponent] : (double) mantissa * power [exponent];
+  }
+  else /* long or large numbers */
+  {
+    char buff [64];
+    size_t n = MIN ((size_t) (p - q), sizeof (buff) - 1);
+    memcpy (buff, q, n);
+    buff [n] = '\0';
+    v = fabs (strtod (buff, NULL));
+  }
+
+  *out = negative ? -v : v;
+
+  return p;
+}
+
+/* parse ASCII facets starting within a chunk */
+static void parse (void *data, int worker)
+{
+  struct chunk *chunk = data;
+  const char *p = chunk->begin, *eof = chunk->eof;
+  REAL *t;
+  int i, k;
+
+  chunk->size = 1024;
+  chunk->count = 0;
+  ERRMEM (chunk->triang = malloc (chunk->size * sizeof (REAL [9])));
+
+  while (p < chunk->end)
+  {
+    p = skip (p, eof);
+
+    if (p + 5 <= eof && memcmp (p, "outer", 5) == 0)
     {
-      fscanf (f, "%s", buff);
-      ASSERT (strcmp (buff, "loop") == 0, "STL fromat error");
-      for (i = 0; i < 3; i ++)
+      if (chunk->count == chunk->size)
       {
-	fscanf (f, "%s", buff);
-        ASSERT (strcmp (buff, "vertex") == 0, "STL fromat error");
-	fscanf (f, "%f", t+3*i+0); /* FIXME: detect REAL type */
-	fscanf (f, "%f", t+3*i+1);
-	fscanf (f, "%f", t+3*i+2);
+	chunk->size *= 2;
+	ERRMEM (chunk->triang = realloc (chunk->triang, chunk->size * sizeof (REAL [9])));
       }
-      t += 9;
-      (*count) ++;
 
-      if ((*count) == size)
+      t = &chunk->triang [9 * chunk->count ++];
+
+      p = keyword (p + 5, eof, "loop", 4);
+      ASSERT (p, "STL format error");
+
+      for (i = 0; i < 3; i ++)
       {
-	size *= 2;
-	ERRMEM (triang = realloc (triang, size * sizeof(REAL[9])));
-	t = &triang[(*count)*9];
+	p = keyword (p, eof, "vertex", 6);
+	ASSERT (p, "STL format error");
+
+	for (k = 0; k < 3; k ++) p = number (p, eof, t+3*i+k);
       }
     }
+    else while (p < eof && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p ++; /* other token */
+  }
+}
+
+/* start of the first facet at or after p */
+static const char* facet (const char *p, const char *eof)
+{
+  for (; p + 5 <= eof; p ++)
+  {
+    if (*p == 'f' && memcmp (p, "facet", 5) == 0 && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n' || p[-1] == '\r')) return p; /* not "endfacet" */
   }
 
+  return eof;
+}
+
+/* read ASCII STL in parallel chunks split at facet boundaries */
+static REAL* ascii (const char *data, size_t size, int *count, int threads)
+{
+  const char *eof = data + size, *p;
+  struct pool *pool = NULL;
+  struct chunk *chunk;
+  struct group group;
+  REAL *triang, *t;
+  int i, n;
+
+  n = MAX (1, MIN (threads * 4, (int) (size / CHUNK_SIZE)));
+
+  ERRMEM (chunk = malloc (n * sizeof (struct chunk)));
+
+  for (p = data, i = 0; i < n; i ++)
+  {
+    chunk[i].begin = p;
+    chunk[i].end = p = (i == n-1) ? eof : facet (MAX (p, data + (size / n) * (i+1)), eof);
+    chunk[i].eof = eof;
+  }
+
+  if (threads > 1 && n > 1)
+  {
+    pool = pool_create (threads);
+    group.pending = 0;
+    for (i = 0; i < n; i ++) pool_spawn (pool, 0, &group, parse, &chunk [i]);
+    pool_wait (pool, 0, &group);
+    pool_destroy (pool);
+  }
+  else for (i = 0; i < n; i ++) parse (&chunk [i], 0);
+
+  for (*count = i = 0; i < n; i ++) *count += chunk[i].count;
+
+  ERRMEM (triang = malloc (MAX (*count, 1) * sizeof (REAL [9])));
+
+  for (t = triang, i = 0; i < n; i ++)
+  {
+    memcpy (t, chunk[i].triang, chunk[i].count * sizeof (REAL [9]));
+    t += 9 * chunk[i].count;
+    free (chunk[i].triang);
+  }
+
+  free (chunk);
+
+  return triang;
+}
+
+/* decode binary STL: 80 byte header, triangle count, then 50 byte records of normal, vertices and attribute */
+static REAL* binary (const char *data, int *count)
+{
+  const char *r = data + 84;
+  uint32_t n;
+  REAL *triang;
+  float v [9];
+  int i, k;
+
+  memcpy (&n, data + 80, 4);
+
+  *count = (int) n;
+
+  ERRMEM (triang = malloc (MAX (*count, 1) * sizeof (REAL [9])));
+
+  for (i = 0; i < *count; i ++, r += 50)
+  {
+    memcpy (v, r + 12, sizeof (v)); /* records are not aligned */
+    for (k = 0; k < 9; k ++) triang [9*i+k] = v [k];
+  }
+
+  return triang;
+}
+
+/* STL read */
+REAL* stlread (const char *path, int *count, int threads)
+{
+  char *data, *head;
+  struct stat st;
+  uint32_t n = 0;
+  REAL *triang;
+  size_t size;
+  int fd;
+
+  if ((fd = open (path, O_RDONLY)) < 0) return NULL;
+
+  if (fstat (fd, &st) < 0)
+  {
+    close (fd);
+    return NULL;
+  }
+
+  size = st.st_size;
+
+  if (size == 0)
+  {
+    close (fd);
+    *count = 0;
+    ERRMEM (triang = malloc (sizeof (REAL [9])));
+    return triang;
+  }
+
+  data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close (fd);
+
+  if (data == MAP_FAILED) return NULL;
+
+  posix_madvise (data, size, POSIX_MADV_SEQUENTIAL);
+
+  if (size >= 84) memcpy (&n, data + 80, 4);
+
+  head = data + MIN (size, 512);
+
+  if (size >= 84 && size == 84 + 50 * (size_t) n && /* binary size, unless an ASCII file happens to match it */
+      !(size >= 5 && memcmp (data, "solid", 5) == 0 && facet (data + 5, head) < head)) triang = binary (data, count);
+  else triang = ascii (data, size, count, threads);
+
+  munmap (data, size);
+
   return triang;
 }
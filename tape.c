@@ -0,0 +1,357 @@
+/*
+ * tape.c
+ * ------
+ * shape trees compiled into flat post-order evaluation tapes
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "oaktree.h"
+#include "error.h"
+#include "simd.h"
+#include "alg.h"
+
+#define BATCH 64 /* points per batch evaluation block (a multiple of VLEN) */
+
+/* count shape nodes */
+static int nodes_count (struct shape *shape)
+{
+  switch (shape->what)
+  {
+  case ADD:
+  case MUL:
+  case FLT:
+    return nodes_count (shape->left) + nodes_count (shape->right) + 1;
+  case HSP:
+  case SPH:
+  case CYL:
+  case MLS:
+  case MESH:
+    return 1;
+  }
+
+  return 0;
+}
+
+/* load node instruction with inlined leaf parameters */
+static void load (struct shape *shape, struct instruction *c)
+{
+  c->what = shape->what;
+
+  switch (shape->what)
+  {
+  case ADD:
+  case MUL:
+    break;
+  case HSP:
+    memcpy (&c->data.halfspace, shape->data, sizeof (struct halfspace));
+    break;
+  case SPH:
+    memcpy (&c->data.sphere, shape->data, sizeof (struct sphere));
+    break;
+  case CYL:
+    memcpy (&c->data.cylinder, shape->data, sizeof (struct cylinder));
+    break;
+  case MLS:
+    c->data.mls = shape->data;
+    break;
+  case MESH:
+    c->data.trimesh = shape->data;
+    break;
+  case FLT:
+    memcpy (&c->data.fillet, shape->data, sizeof (struct fillet));
+    break;
+  }
+}
+
+/* emit post-order instructions of a shape at code [*i] and return subtree stack depth */
+static int emit (struct shape *shape, struct instruction *code, int *i, short root)
+{
+  int j = *i, l, r;
+
+  switch (shape->what)
+  {
+  case ADD:
+  case MUL:
+  case FLT:
+    l = emit (shape->left, code, i, 0);
+    r = emit (shape->right, code, i, 0) + 1;
+    break;
+  case HSP:
+  case SPH:
+  case CYL:
+  case MLS:
+  case MESH:
+    l = r = 1;
+    break;
+  }
+
+  load (shape, &code [*i]);
+
+  (*i) ++;
+
+  l = MAX (l, r);
+
+  if (shape->left && !shape->tape) /* each inner node evaluates its own tape range; shared pruned branches keep theirs */
+  {
+    ERRMEM (shape->tape = malloc (sizeof (struct tape)));
+    shape->tape->code = code + j;
+    shape->tape->size = (*i) - j;
+    shape->tape->depth = l;
+    shape->tape->root = root;
+  }
+
+  return l;
+}
+
+/* compile shape into an evaluation tape; the shape must not be modified afterwards */
+void shape_compile (struct shape *shape)
+{
+  struct instruction *code;
+  int i = 0;
+
+  if (shape->tape || !shape->left) return; /* compiled already or a single leaf */
+
+  ERRMEM (code = malloc (nodes_count (shape) * sizeof (struct instruction)));
+
+  emit (shape, code, &i, 1);
+}
+
+/* return distance to a compiled shape at given point */
+REAL tape_evaluate (struct tape *tape, REAL *point)
+{
+  struct instruction *c = tape->code, *e = c + tape->size;
+  REAL stack [tape->depth], *top = stack;
+  struct halfspace *halfspace;
+  struct cylinder *cylinder;
+  struct sphere *sphere;
+  REAL a, b, v, z [3];
+
+  for (; c < e; c ++)
+  {
+    switch (c->what)
+    {
+    case ADD:
+      b = *(--top);
+      a = *(--top);
+      v = MIN (a, b);
+      break;
+    case MUL:
+      b = *(--top);
+      a = *(--top);
+      v = MAX (a, b);
+      break;
+    case HSP:
+      halfspace = &c->data.halfspace;
+      SUB (point, halfspace->p, z);
+      v = halfspace->s * DOT (z, halfspace->n);
+      break;
+    case SPH:
+      sphere = &c->data.sphere;
+      SUB (point, sphere->c, z);
+      v = sphere->s * (LEN (z) - sphere->r);
+      break;
+    case CYL:
+      cylinder = &c->data.cylinder;
+      SUB (point, cylinder->p, z);
+      a = DOT (z, cylinder->d);
+      SUBMUL (z, a, cylinder->d, z);
+      b = LEN (z);
+      a = cylinder->r;
+      if (b < a) b = 0.5*((b*b)/a + a); /* smooth out inside with y = x**2/(2r) + r/2 */
+      v = cylinder->s * (b - a);
+      break;
+    case MLS:
+      v = mls_evaluate (c->data.mls, point);
+      break;
+    case MESH:
+      v = trimesh_evaluate (c->data.trimesh, point);
+      break;
+    case FLT:
+      b = *(--top);
+      a = *(--top);
+      v = c->data.fillet.r;
+      if (v > 0)
+      {
+	if (a > v || b > v) v = MIN (a, b);
+	else v = v - sqrt((a-v)*(a-v)+(b-v)*(b-v));
+      }
+      else
+      {
+	if (a < v || b < v) v = MAX (a, b);
+	else v = sqrt((a-v)*(a-v)+(b-v)*(b-v)) + v;
+      }
+      break;
+    }
+
+    *(top ++) = v;
+  }
+
+  return stack [0];
+}
+
+/* evaluate tape over a block of m points (x, y, z), m being a multiple of VLEN */
+static void tape_evaluate_block (struct tape *tape, REAL *x, REAL *y, REAL *z, int m, REAL *out)
+{
+  struct instruction *c = tape->code, *e = c + tape->size;
+  REAL stack [tape->depth][m], *v, *a, *b, w, point [3];
+  VREAL vx, vy, vz, vd, vs, vr;
+  int i, top = 0;
+
+  for (; c < e; c ++)
+  {
+    switch (c->what)
+    {
+    case ADD:
+      top --;
+      a = stack [top-1];
+      b = stack [top];
+      for (i = 0; i < m; i += VLEN) VSTORE (a+i, VMIN (VLOAD (a+i), VLOAD (b+i)));
+      continue;
+    case MUL:
+      top --;
+      a = stack [top-1];
+      b = stack [top];
+      for (i = 0; i < m; i += VLEN) VSTORE (a+i, VMAX (VLOAD (a+i), VLOAD (b+i)));
+      continue;
+    case HSP:
+      {
+	struct halfspace *h = &c->data.halfspace;
+
+	v = stack [top ++];
+	for (i = 0; i < m; i += VLEN)
+	{
+	  vx = VSUB (VLOAD (x+i), VSET (h->p[0]));
+	  vy = VSUB (VLOAD (y+i), VSET (h->p[1]));
+	  vz = VSUB (VLOAD (z+i), VSET (h->p[2]));
+	  vd = VADD (VADD (VMUL (vx, VSET (h->n[0])), VMUL (vy, VSET (h->n[1]))), VMUL (vz, VSET (h->n[2])));
+	  VSTORE (v+i, VMUL (VSET (h->s), vd));
+	}
+      }
+      continue;
+    case SPH:
+      {
+	struct sphere *s = &c->data.sphere;
+
+	v = stack [top ++];
+	for (i = 0; i < m; i += VLEN)
+	{
+	  vx = VSUB (VLOAD (x+i), VSET (s->c[0]));
+	  vy = VSUB (VLOAD (y+i), VSET (s->c[1]));
+	  vz = VSUB (VLOAD (z+i), VSET (s->c[2]));
+	  vd = VADD (VADD (VMUL (vx, vx), VMUL (vy, vy)), VMUL (vz, vz));
+	  VSTORE (v+i, VSPHERE (vd, s->r, s->s));
+	}
+      }
+      continue;
+    case CYL:
+      {
+	struct cylinder *l = &c->data.cylinder;
+
+	v = stack [top ++];
+	vr = VSET (l->r);
+	vs = VSET (l->s);
+	for (i = 0; i < m; i += VLEN)
+	{
+	  vx = VSUB (VLOAD (x+i), VSET (l->p[0]));
+	  vy = VSUB (VLOAD (y+i), VSET (l->p[1]));
+	  vz = VSUB (VLOAD (z+i), VSET (l->p[2]));
+	  vd = VADD (VADD (VMUL (vx, VSET (l->d[0])), VMUL (vy, VSET (l->d[1]))), VMUL (vz, VSET (l->d[2])));
+	  vx = VSUB (vx, VMUL (vd, VSET (l->d[0])));
+	  vy = VSUB (vy, VMUL (vd, VSET (l->d[1])));
+	  vz = VSUB (vz, VMUL (vd, VSET (l->d[2])));
+	  vd = VSQRT (VADD (VADD (VMUL (vx, vx), VMUL (vy, vy)), VMUL (vz, vz)));
+	  vd = VLTSELECT (vd, vr, VMUL (VSET (0.5), VADD (VDIV (VMUL (vd, vd), vr), vr)), vd); /* smooth out inside */
+	  VSTORE (v+i, VMUL (vs, VSUB (vd, vr)));
+	}
+      }
+      continue;
+    case MLS:
+    case MESH:
+      {
+	struct tape leaf = {c, 1, 1, 0}; /* scalar evaluation */
+
+	v = stack [top ++];
+	for (i = 0; i < m; i ++)
+	{
+	  VECTOR (point, x[i], y[i], z[i]);
+	  v [i] = tape_evaluate (&leaf, point);
+	}
+      }
+      continue;
+    case FLT:
+      top --;
+      a = stack [top-1];
+      b = stack [top];
+      w = c->data.fillet.r;
+      for (i = 0; i < m; i ++)
+      {
+	if (w > 0)
+	{
+	  if (a[i] > w || b[i] > w) a[i] = MIN (a[i], b[i]);
+	  else a[i] = w - sqrt((a[i]-w)*(a[i]-w)+(b[i]-w)*(b[i]-w));
+	}
+	else
+	{
+	  if (a[i] < w || b[i] < w) a[i] = MAX (a[i], b[i]);
+	  else a[i] = sqrt((a[i]-w)*(a[i]-w)+(b[i]-w)*(b[i]-w)) + w;
+	}
+      }
+      continue;
+    }
+  }
+
+  memcpy (out, stack [0], m * sizeof (REAL));
+}
+
+/* return distances to shape at n points */
+void shape_evaluate_batch (struct shape *shape, REAL (*points) [3], int n, REAL *out)
+{
+  REAL x [BATCH], y [BATCH], z [BATCH], v [BATCH];
+  struct instruction leaf;
+  struct tape single, *tape;
+  int i, j, k, m;
+
+  if ((shape->left && !shape->tape) || n < VLEN) /* not compiled or too few points to fill a vector */
+  {
+    for (i = 0; i < n; i ++) out [i] = shape_evaluate (shape, points [i]);
+    return;
+  }
+  else if (shape->tape) tape = shape->tape;
+  else /* single leaf */
+  {
+    load (shape, &leaf);
+    single.code = &leaf;
+    single.size = 1;
+    single.depth = 1;
+    single.root = 0;
+    tape = &single;
+  }
+
+  for (i = 0; i < n; i += BATCH)
+  {
+    k = MIN (BATCH, n-i);
+    m = ((k + VLEN - 1) / VLEN) * VLEN;
+
+    for (j = 0; j < m; j ++) /* gather coordinates; pad with the last point */
+    {
+      REAL *p = points [i + MIN (j, k-1)];
+      x [j] = p[0];
+      y [j] = p[1];
+      z [j] = p[2];
+    }
+
+    tape_evaluate_block (tape, x, y, z, m, v);
+
+    memcpy (out + i, v, k * sizeof (REAL));
+  }
+}
+
+/* free tape memory */
+void tape_destroy (struct tape *tape)
+{
+  if (tape->root) free (tape->code);
+
+  free (tape);
+}
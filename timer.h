@@ -1,30 +1,31 @@
 /*
  * timer.h
  * ---------
+ * monotonic stopwatch; users define _POSIX_C_SOURCE 199309L or later for clock_gettime
  */
 
-#include <sys/time.h>
+#include <time.h>
 
 #ifndef __timer__
 #define __timer__
 
 struct timing
 {
-  struct timeval time;
+  struct timespec time;
   double sec, total;
 };
 
 static inline void timerstart (struct timing *t)
 {
-  gettimeofday (&t->time, NULL);
+  clock_gettime (CLOCK_MONOTONIC, &t->time);
 }
 
 static inline double timerend (struct timing *t)
 {
-  struct timeval newtime;
-  gettimeofday (&newtime, NULL);
-  t->sec = (((double)newtime.tv_sec - (double)t->time.tv_sec) * 1000000. +
-    ((double)newtime.tv_usec - (double)t->time.tv_usec)) / 1000000.;
+  struct timespec newtime;
+  clock_gettime (CLOCK_MONOTONIC, &newtime);
+  t->sec = ((double)newtime.tv_sec - (double)t->time.tv_sec) +
+    ((double)newtime.tv_nsec - (double)t->time.tv_nsec) / 1000000000.;
   t->total += t->sec;
   return t->sec;
 }
@@ -0,0 +1,527 @@
+/*
+ * trimesh.c
+ * ---------
+ * triangle mesh leaves: signed distance from a bounding volume hierarchy and angle weighted pseudo-normals
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include "oaktree.h"
+#include "error.h"
+#include "alg.h"
+
+#define LEAF_SIZE 4 /* triangles per hierarchy leaf */
+
+#define STACK_SIZE 128 /* traversal stack; the hierarchy is balanced */
+
+enum {FACE, VERTEX_A, VERTEX_B, VERTEX_C, EDGE_AB, EDGE_BC, EDGE_CA}; /* closest triangle features */
+
+struct point /* vertex welding item */
+{
+  REAL p [3];
+
+  int i;
+};
+
+struct edge /* edge pseudo-normal item */
+{
+  int a, b, t, j;
+};
+
+/* lexicographic point order */
+static int point_compare (const void *x, const void *y)
+{
+  const struct point *a = x, *b = y;
+
+  for (int k = 0; k < 3; k ++)
+  {
+    if (a->p[k] < b->p[k]) return -1;
+    else if (a->p[k] > b->p[k]) return 1;
+  }
+
+  return 0;
+}
+
+/* edge order */
+static int edge_compare (const void *x, const void *y)
+{
+  const struct edge *a = x, *b = y;
+
+  if (a->a != b->a) return a->a < b->a ? -1 : 1;
+  else if (a->b != b->b) return a->b < b->b ? -1 : 1;
+
+  return 0;
+}
+
+/* triangle centroid coordinate */
+inline static REAL centroid (struct trimesh *mesh, int t, int k)
+{
+  return mesh->p[mesh->t[t][0]][k] + mesh->p[mesh->t[t][1]][k] + mesh->p[mesh->t[t][2]][k];
+}
+
+/* reorder triangles [first, first+count) so that the one of rank m along an axis is in place, with lower ones before it */
+static void partition (struct trimesh *mesh, int first, int count, int m, int k)
+{
+  int lo = first, hi = first + count - 1, i, j, t [3];
+  REAL pivot;
+
+  while (lo < hi)
+  {
+    pivot = centroid (mesh, (lo + hi) / 2, k);
+
+    for (i = lo, j = hi; i <= j;)
+    {
+      while (centroid (mesh, i, k) < pivot) i ++;
+      while (centroid (mesh, j, k) > pivot) j --;
+
+      if (i <= j)
+      {
+	memcpy (t, mesh->t[i], sizeof (int [3]));
+	memcpy (mesh->t[i], mesh->t[j], sizeof (int [3]));
+	memcpy (mesh->t[j], t, sizeof (int [3]));
+	i ++;
+	j --;
+      }
+    }
+
+    if (m <= j) hi = j;
+    else if (m >= i) lo = i;
+    else break;
+  }
+}
+
+/* build hierarchy node over triangles [first, first+count) and return its index; children follow in pre-order */
+static int build (struct trimesh *mesh, int first, int count, int *size)
+{
+  int i = (*size) ++, j, k, l;
+  struct bnode *node = &mesh->node [i];
+  REAL c [6], *p;
+
+  node->box [0] = node->box [1] = node->box [2] = c [0] = c [1] = c [2] = FLT_MAX;
+  node->box [3] = node->box [4] = node->box [5] = c [3] = c [4] = c [5] = -FLT_MAX;
+
+  for (j = first; j < first + count; j ++)
+  {
+    for (l = 0; l < 3; l ++)
+    {
+      p = mesh->p [mesh->t[j][l]];
+
+      for (k = 0; k < 3; k ++)
+      {
+	node->box [k] = MIN (node->box [k], p[k]);
+	node->box [k+3] = MAX (node->box [k+3], p[k]);
+      }
+    }
+
+    for (k = 0; k < 3; k ++)
+    {
+      c [k] = MIN (c [k], centroid (mesh, j, k));
+      c [k+3] = MAX (c [k+3], centroid (mesh, j, k));
+    }
+  }
+
+  if (count <= LEAF_SIZE)
+  {
+    node->first = first;
+    node->count = count;
+  }
+  else /* object median split along the longest centroid extent */
+  {
+    k = c[4]-c[1] > c[3]-c[0] ? 1 : 0;
+    if (c[5]-c[2] > c[k+3]-c[k]) k = 2;
+
+    partition (mesh, first, count, first + count/2, k);
+
+    build (mesh, first, count/2, size);
+    node = &mesh->node [i];
+    node->first = build (mesh, first + count/2, count - count/2, size); /* right child; left one is i+1 */
+    node->count = 0;
+  }
+
+  return i;
+}
+
+/* squared distance from a point to a box */
+inline static REAL box_distance (REAL *box, REAL *p)
+{
+  REAL d = 0.0, v;
+
+  for (int k = 0; k < 3; k ++)
+  {
+    v = MAX (box[k] - p[k], p[k] - box[k+3]);
+    if (v > 0.0) d += v*v;
+  }
+
+  return d;
+}
+
+/* closest point q of triangle (a, b, c) to p with its feature; return squared distance */
+static REAL triangle (REAL *p, REAL *a, REAL *b, REAL *c, REAL q [3], int *feature)
+{
+  REAL ab [3], ac [3], ap [3], bp [3], cp [3], d1, d2, d3, d4, d5, d6, va, vb, vc, v, w;
+
+  SUB (b, a, ab);
+  SUB (c, a, ac);
+  SUB (p, a, ap);
+  d1 = DOT (ab, ap);
+  d2 = DOT (ac, ap);
+
+  if (d1 <= 0.0 && d2 <= 0.0)
+  {
+    COPY (a, q);
+    *feature = VERTEX_A;
+    goto out;
+  }
+
+  SUB (p, b, bp);
+  d3 = DOT (ab, bp);
+  d4 = DOT (ac, bp);
+
+  if (d3 >= 0.0 && d4 <= d3)
+  {
+    COPY (b, q);
+    *feature = VERTEX_B;
+    goto out;
+  }
+
+  vc = d1*d4 - d3*d2;
+
+  if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+  {
+    v = d1 / (d1 - d3);
+    ADDMUL (a, v, ab, q);
+    *feature = EDGE_AB;
+    goto out;
+  }
+
+  SUB (p, c, cp);
+  d5 = DOT (ab, cp);
+  d6 = DOT (ac, cp);
+
+  if (d6 >= 0.0 && d5 <= d6)
+  {
+    COPY (c, q);
+    *feature = VERTEX_C;
+    goto out;
+  }
+
+  vb = d5*d2 - d1*d6;
+
+  if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+  {
+    w = d2 / (d2 - d6);
+    ADDMUL (a, w, ac, q);
+    *feature = EDGE_CA;
+    goto out;
+  }
+
+  va = d3*d6 - d5*d4;
+
+  if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0)
+  {
+    w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    SUB (c, b, ap);
+    ADDMUL (b, w, ap, q);
+    *feature = EDGE_BC;
+    goto out;
+  }
+
+  v = 1.0 / (va + vb + vc);
+  w = vc * v;
+  v = vb * v;
+  ADDMUL (a, v, ab, q);
+  ADDMUL (q, w, ac, q);
+  *feature = FACE;
+
+out:
+  SUB (p, q, ap);
+  return DOT (ap, ap);
+}
+
+/* find the closest surface point and the pseudo-normal of its feature; return squared distance */
+static REAL closest (struct trimesh *mesh, REAL *point, REAL q [3], REAL normal [3])
+{
+  int stack [STACK_SIZE], top = 0, i, j, l, r, feature, t = -1, f = FACE;
+  REAL best = FLT_MAX, d, dl, dr, z [3];
+  struct bnode *node;
+
+  stack [top ++] = 0;
+
+  while (top)
+  {
+    node = &mesh->node [stack [-- top]];
+
+    if (box_distance (node->box, point) >= best) continue;
+
+    if (node->count)
+    {
+      for (j = node->first; j < node->first + node->count; j ++)
+      {
+	d = triangle (point, mesh->p[mesh->t[j][0]], mesh->p[mesh->t[j][1]], mesh->p[mesh->t[j][2]], z, &feature);
+
+	if (d < best)
+	{
+	  best = d;
+	  COPY (z, q);
+	  t = j;
+	  f = feature;
+	}
+      }
+    }
+    else /* nearer child is visited first */
+    {
+      i = node - mesh->node;
+      l = i + 1;
+      r = node->first;
+      dl = box_distance (mesh->node[l].box, point);
+      dr = box_distance (mesh->node[r].box, point);
+
+      ASSERT (top + 2 <= STACK_SIZE, "Mesh hierarchy is too deep");
+
+      if (dl < dr)
+      {
+	if (dr < best) stack [top ++] = r;
+	if (dl < best) stack [top ++] = l;
+      }
+      else
+      {
+	if (dl < best) stack [top ++] = l;
+	if (dr < best) stack [top ++] = r;
+      }
+    }
+  }
+
+  if (t < 0) /* no triangle is closer than FLT_MAX for a NaN point, which split () makes by normalising the zero normal of a degenerate triangle */
+  {
+    COPY (point, q);
+    SET (normal, 0.0);
+    return best;
+  }
+
+  switch (f)
+  {
+  case FACE: COPY (mesh->n[t], normal); break;
+  case VERTEX_A: COPY (mesh->vn[mesh->t[t][0]], normal); break;
+  case VERTEX_B: COPY (mesh->vn[mesh->t[t][1]], normal); break;
+  case VERTEX_C: COPY (mesh->vn[mesh->t[t][2]], normal); break;
+  case EDGE_AB: COPY (mesh->en[t][0], normal); break;
+  case EDGE_BC: COPY (mesh->en[t][1], normal); break;
+  case EDGE_CA: COPY (mesh->en[t][2], normal); break;
+  }
+
+  return best;
+}
+
+/* create mesh leaf from count triangles given by vertex coordinates; vertices are welded and degenerate triangles dropped; NULL if none remain */
+struct trimesh* trimesh_create (REAL *triang, int count)
+{
+  struct trimesh *mesh;
+  struct point *point;
+  REAL a [3], b [3], c [3];
+  int i, j, n;
+
+  ERRMEM (mesh = calloc (1, sizeof (struct trimesh)));
+  ERRMEM (point = malloc (MAX (3*count, 1) * sizeof (struct point)));
+
+  for (i = 0; i < 3*count; i ++)
+  {
+    COPY (triang + 3*i, point[i].p);
+    point[i].i = i;
+  }
+
+  qsort (point, 3*count, sizeof (struct point), point_compare);
+
+  ERRMEM (mesh->p = malloc (MAX (3*count, 1) * sizeof (REAL [3])));
+  ERRMEM (mesh->t = malloc (MAX (count, 1) * sizeof (int [3])));
+
+  for (n = i = 0; i < 3*count; i ++) /* bitwise equal vertices are welded */
+  {
+    if (i && point_compare (&point[i-1], &point[i])) n ++;
+    COPY (point[i].p, mesh->p[n]);
+    mesh->t [point[i].i / 3][point[i].i % 3] = n;
+  }
+
+  mesh->np = count ? n + 1 : 0;
+
+  for (j = i = 0; i < count; i ++)
+  {
+    int *t = mesh->t [i];
+
+    SUB (mesh->p[t[1]], mesh->p[t[0]], a);
+    SUB (mesh->p[t[2]], mesh->p[t[0]], b);
+    PRODUCT (a, b, c);
+
+    if (DOT (c, c) > 0.0) memcpy (mesh->t [j ++], t, sizeof (int [3]));
+  }
+
+  mesh->nt = j;
+  mesh->s = 1.0;
+  mesh->o = 0.0;
+
+  free (point);
+
+  if (mesh->nt == 0)
+  {
+    trimesh_destroy (mesh);
+    return NULL;
+  }
+
+  trimesh_index (mesh);
+
+  return mesh;
+}
+
+/* (re)build mesh leaf hierarchy and pseudo-normals; this reorders triangles */
+void trimesh_index (struct trimesh *mesh)
+{
+  REAL a [3], b [3], c [3], *p [3], angle;
+  struct edge *edge;
+  int i, j, k, l, size = 0;
+
+  free (mesh->node);
+  free (mesh->n);
+  free (mesh->en);
+  free (mesh->vn);
+
+  ERRMEM (mesh->node = malloc (2 * mesh->nt * sizeof (struct bnode)));
+
+  build (mesh, 0, mesh->nt, &size);
+
+  mesh->nnode = size;
+
+  ERRMEM (mesh->n = malloc (mesh->nt * sizeof (REAL [3])));
+  ERRMEM (mesh->en = malloc (mesh->nt * sizeof (REAL [3][3])));
+  ERRMEM (mesh->vn = calloc (mesh->np, sizeof (REAL [3])));
+  ERRMEM (edge = malloc (3 * mesh->nt * sizeof (struct edge)));
+
+  for (i = 0; i < mesh->nt; i ++)
+  {
+    for (j = 0; j < 3; j ++) p [j] = mesh->p [mesh->t[i][j]];
+
+    NORMAL (p[0], p[1], p[2], mesh->n[i]);
+    NORMALIZE (mesh->n[i]);
+
+    for (j = 0; j < 3; j ++) /* angle weighted vertex normals */
+    {
+      SUB (p[(j+1)%3], p[j], a);
+      SUB (p[(j+2)%3], p[j], b);
+      NORMALIZE (a);
+      NORMALIZE (b);
+      angle = acos (MAX (-1.0, MIN (1.0, DOT (a, b))));
+      ADDMUL (mesh->vn[mesh->t[i][j]], angle, mesh->n[i], mesh->vn[mesh->t[i][j]]);
+
+      k = mesh->t[i][j];
+      l = mesh->t[i][(j+1)%3];
+      edge [3*i+j].a = MIN (k, l);
+      edge [3*i+j].b = MAX (k, l);
+      edge [3*i+j].t = i;
+      edge [3*i+j].j = j;
+    }
+  }
+
+  for (i = 0; i < mesh->np; i ++) NORMALIZE (mesh->vn[i]);
+
+  qsort (edge, 3 * mesh->nt, sizeof (struct edge), edge_compare);
+
+  for (i = 0; i < 3 * mesh->nt; i = j) /* edge normals sum the normals of the faces sharing an edge */
+  {
+    SET (c, 0.0);
+
+    for (j = i; j < 3 * mesh->nt && edge_compare (&edge[i], &edge[j]) == 0; j ++) ACC (mesh->n[edge[j].t], c);
+
+    NORMALIZE (c);
+
+    for (k = i; k < j; k ++) COPY (c, mesh->en[edge[k].t][edge[k].j]);
+  }
+
+  free (edge);
+}
+
+/* return distance to a mesh leaf at given point */
+REAL trimesh_evaluate (struct trimesh *mesh, REAL *point)
+{
+  REAL q [3], n [3], z [3], d;
+
+  d = sqrt (closest (mesh, point, q, n));
+
+  SUB (point, q, z);
+
+  if (DOT (z, n) < 0.0) d = -d; /* inside */
+
+  return mesh->s * (d - mesh->o);
+}
+
+/* compute mesh leaf normal at given point */
+void trimesh_normal (struct trimesh *mesh, REAL *point, REAL *normal)
+{
+  REAL q [3], n [3], d;
+
+  d = closest (mesh, point, q, n);
+
+  SUB (point, q, normal);
+
+  if (d > 0.0)
+  {
+    if (DOT (normal, n) < 0.0) SCALE (normal, -1.0); /* distance gradient inside */
+  }
+  else COPY (n, normal); /* on the surface */
+
+  SCALE (normal, mesh->s);
+}
+
+/* bound mesh leaf distance over a box given by center and half extents */
+void trimesh_interval (struct trimesh *mesh, REAL c [3], REAL h [3], REAL range [2])
+{
+  REAL v = trimesh_evaluate (mesh, c), r = LEN (h); /* signed distance is 1-Lipschitz */
+
+  range [0] = v - r;
+  range [1] = v + r;
+}
+
+/* compute mesh leaf extents */
+void trimesh_extents (struct trimesh *mesh, REAL *extents)
+{
+  REAL o = MAX (mesh->o, 0.0);
+
+  for (int k = 0; k < 3; k ++)
+  {
+    extents [k] = mesh->node[0].box[k] - o;
+    extents [k+3] = mesh->node[0].box[k+3] + o;
+  }
+}
+
+/* copy mesh leaf */
+struct trimesh* trimesh_copy (struct trimesh *mesh)
+{
+  struct trimesh *copy;
+
+  ERRMEM (copy = calloc (1, sizeof (struct trimesh)));
+  ERRMEM (copy->p = malloc (mesh->np * sizeof (REAL [3])));
+  ERRMEM (copy->t = malloc (mesh->nt * sizeof (int [3])));
+  memcpy (copy->p, mesh->p, mesh->np * sizeof (REAL [3]));
+  memcpy (copy->t, mesh->t, mesh->nt * sizeof (int [3]));
+  copy->np = mesh->np;
+  copy->nt = mesh->nt;
+  copy->s = mesh->s;
+  copy->o = mesh->o;
+  copy->scolor = mesh->scolor;
+
+  trimesh_index (copy);
+
+  return copy;
+}
+
+/* free mesh leaf */
+void trimesh_destroy (struct trimesh *mesh)
+{
+  free (mesh->p);
+  free (mesh->t);
+  free (mesh->n);
+  free (mesh->en);
+  free (mesh->vn);
+  free (mesh->node);
+  free (mesh);
+}
@@ -6,7 +6,9 @@
 #if __APPLE__
   #include <GLUT/glut.h>
 #else
+  #define GL_GLEXT_PROTOTYPES
   #include <GL/glut.h>
+  #include <GL/glext.h>
 #endif
 #include <stdarg.h>
 #include <stdlib.h>
@@ -16,235 +18,11 @@
 #include <time.h>
 #include <math.h>
 #include "viewer.h"
+#include "image.h"
+#include "capture.h"
 #include "error.h"
 #include "alg.h"
 
-/* 
- * bitmap and avi video output
- */
-
-/* offsets to AVI header entries updated
- * at the end of the write process */
-#define FILE_SIZE_OFFSET 4
-#define FRAMES_1_OFFSET 48
-#define FRAMES_2_OFFSET 140
-#define MOVIE_SIZE_OFFSET 216
-
-/* movie handle */
-struct avi
-{
-  FILE *file;
-  int width;
-  int height;  
-  int frames;
-};
-
-/* round up to the next 4-divisible width */
-static int ROUNDED_WIDTH (int width)
-{
-  width *= 3;
-  while (width % 4) width ++;
-  return width;
-}
-
-/* rounded up image size */
-#define ROUNDED_SIZE(width, height)\
-  (ROUNDED_WIDTH (width) * (height))
-
-/* little-endian DWORD output */
-static void DWORD (int32_t v, FILE *f)
-{
-  putc (v, f);
-  putc (v >> 8, f);
-  putc (v >> 16, f);
-  putc (v >> 24, f);
-}
-
-/* little-endian WORD output */
-static void WORD (int16_t v, FILE *f)
-{
-  putc (v, f);
-  putc (v >> 8, f);
-}
-
-/* string output (no byte reversal) */
-#define STRING(s, f) fwrite (s, 1, strlen (s), f)
-
-/* little-endian RGB data output */
-static void RGB (int w, int h, char *rgb, FILE *f)
-{
-  w = ROUNDED_WIDTH (w);
-  for (; h; h --)
-  {
-    for(char *b = rgb; b < rgb + w; b += 3)
-    {
-      char tmp = b [2];
-      b [2] = b [0];
-      b [0] = tmp;
-    }
-
-    fwrite (rgb, 1, w, f);
-    rgb += w;
-  }
-}
-
-/* allocate RGB buffer */
-static void* rgb_alloc (int width, int height)
-{
-  void *rgb;
-  ERRMEM (rgb = malloc (ROUNDED_SIZE (width, height)));
-  return rgb;
-}
-
-/* free the buffer */
-static void rgb_free (void *rgb)
-{ 
-  free (rgb);
-}
-
-/* output an RGB bitmap file (24 bits per pixel) */
-static void bmp_output (int width, int height, void *rgb, const char *path)
-{
-  FILE *f;
-
-  ASSERT (f = fopen (path, "wb"), "File open failed!");
-
-  WORD (0x4D42, f); /* BM magic */
-  DWORD (ROUNDED_SIZE (width, height) + 54, f); /* header size */
-  WORD (0, f); /* reserved */
-  WORD (0, f); /* reserved */
-  DWORD (54, f); /* offset to data */
-  DWORD (40, f); /* DIB header size */
-  DWORD (width, f);
-  DWORD (height, f);
-  WORD (1, f); /* number of planes */
-  WORD (24, f); /* bits per pixel */
-  DWORD (0, f); /* compression */
-  DWORD (0, f); /* image size (will be calculated) */
-  DWORD (0, f); /* horisontal pixels per meter */
-  DWORD (0, f); /* vertical ... */
-  DWORD (0, f); /* number of colors */
-  DWORD (0, f); /* number of important colors */
-  RGB (width, height, rgb, f);
-  fclose (f);
-}
-
-/* open an RGB avi file (24 bits per pixel, 'fps' frames per second) */
-static struct avi* avi_open (int width, int height, int fps, const char *path)
-{
-  struct avi *avi;
-  FILE *f;
-
-  ERRMEM (avi = calloc (1, sizeof (struct avi)));
-  ASSERT (avi->file = fopen (path, "wb"), "File open failed!");
-
-  avi->width = width;
-  avi->height = height;
-  avi->frames = 0;
-  f = avi->file;
-  
-  STRING ("RIFF", f);
-  DWORD (0, f); /* file size => updated at the end */
-  STRING ("AVI ", f);
-  STRING ("LIST", f);
-  DWORD (192, f); /* length of this list */
-  STRING ("hdrl", f); /* headers list */
-  STRING ("avih", f); /* avi header */
-  DWORD (56, f); /* size of this header */
-  DWORD (1000000.0 / (double)fps, f);
-  DWORD (0, f); /* maximal bytes per second (leave default) */
-  DWORD (0, f); /* reserved value */
-  DWORD (16, f); /* file will have an index */
-  DWORD (0, f); /* number of frames => updated at the end */
-  DWORD (0, f); /* initial number of frames */
-  DWORD (1, f); /* only one video stram */
-  DWORD (ROUNDED_SIZE (width, height), f);
-  DWORD (width, f);
-  DWORD (height, f);
-  DWORD (0, f); /* scale */
-  DWORD (0, f); /* rate */
-  DWORD (0, f); /* start */
-  DWORD (0, f); /* length */
-  STRING ("LIST", f);
-  DWORD (116, f); /* size of this list */
-  STRING ("strl", f); /* video stream list */
-  STRING ("strh", f);  /* video stream header */
-  DWORD (56, f); /* size of this header */
-  STRING ("vids", f);
-  STRING ("DIB ", f); /* Device Independent Bitmap */
-  DWORD (0, f); /* flags */
-  DWORD (0, f); /* priority */
-  DWORD (0, f); /* initial frames */
-  DWORD (1000000.0 / (double)fps, f); /* micro seconds per frame */
-  DWORD (1000000, f); /* rate */
-  DWORD (0, f); /* start */
-  DWORD (0, f); /* number of frames => updated at the end */
-  DWORD (ROUNDED_SIZE (width, height), f);
-  DWORD (0, f); /* quality */
-  DWORD (0, f); /* sample size */
-  DWORD (0, f); /* reserved */
-  WORD (width, f);
-  WORD (height, f);
-  STRING ("strf", f); /* video stream format */
-  DWORD (40, f); /* size of header */
-  DWORD (40, f); /* size of DIB header */
-  DWORD (width, f);
-  DWORD (height, f);
-  WORD (1, f); /* number of planes */
-  WORD (24, f); /* bits per pixel */
-  DWORD (0, f); /* compression */
-  DWORD (ROUNDED_SIZE (width, height), f); /* image size */
-  DWORD (0, f); /* pixels per meter along x */
-  DWORD (0, f); /* ... along y */
-  DWORD (0, f); /* number of colors */
-  DWORD (0, f); /* number of important colors */
-  STRING ("LIST", f);
-  DWORD (0, f); /* movie size => updated at the end */
-  STRING ("movi", f); /* the movie frames begin here */
-  return avi;
-}
-
-/* output one frame  */
-static void avi_frame (struct avi *avi, void *rgb)
-{
-  STRING ("00db", avi->file);
-  DWORD (ROUNDED_SIZE (avi->width, avi->height), avi->file);
-  RGB (avi->width, avi->height, rgb, avi->file);
-  avi->frames ++;
-}
-
-/* close the avi file */
-static void avi_close (struct avi *avi)
-{
-  int offset = 4, frame = avi->frames, index_size = frame * 16,
-    frame_size = ROUNDED_SIZE (avi->width, avi->height),
-    movie_size = 4 + (frame * (frame_size + 8)),
-    file_size = index_size + movie_size + 212;
-
-  STRING ("idx1", avi->file);
-  DWORD (index_size, avi->file);
-
-  for (frame = 0; frame < avi->frames; frame ++)
-  {
-    STRING ("00db", avi->file);
-    DWORD (16, avi->file);
-    DWORD (offset, avi->file);
-    DWORD (frame_size, avi->file);
-    offset += frame_size + 8;
-  }
-  
-  fseek (avi->file, FILE_SIZE_OFFSET, SEEK_SET);
-  DWORD (file_size, avi->file);
-  fseek (avi->file, FRAMES_1_OFFSET, SEEK_SET);
-  DWORD (avi->frames, avi->file);
-  fseek (avi->file, FRAMES_2_OFFSET, SEEK_SET);
-  DWORD (avi->frames, avi->file);
-  fseek (avi->file, MOVIE_SIZE_OFFSET, SEEK_SET);
-  DWORD (movie_size, avi->file);
-  fclose (avi->file);
-  free (avi);
-}
-
 /*
  * GLUT output
  */
@@ -365,7 +143,21 @@ static struct
 } input;
 
 /* AVI movie context */
-void *AVI = NULL;
+struct capture *AVI = NULL;
+
+#define AVI_QUEUE 8 /* frames queued for the movie writer */
+
+static int quality = 0; /* AVI JPEG quality or zero for uncompressed frames */
+
+#if VBO
+/* double-buffered readback: a frame is mapped while the next one is read */
+static struct
+{
+  GLuint buffer [2];
+  int width, height;
+  int next, pending; /* buffer read into next and buffer holding an unqueued frame or -1 */
+} readback = {{0, 0}, 0, 0, 0, -1};
+#endif
 
 /* rectangle drawing */
 static struct
@@ -615,6 +407,77 @@ static void render2D ()
   glPolygonMode (GL_FRONT_AND_BACK, mode [0]);
 }
 
+/* queue the frame held by the pending readback buffer */
+static void record_pending ()
+{
+#if VBO
+  if (readback.pending >= 0)
+  {
+    void *data;
+
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, readback.buffer [readback.pending]);
+    if ((data = glMapBuffer (GL_PIXEL_PACK_BUFFER, GL_READ_ONLY)))
+    {
+      memcpy (capture_buffer (AVI), data, rgb_row (readback.width) * readback.height);
+      capture_submit (AVI);
+      glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+    readback.pending = -1;
+  }
+#endif
+}
+
+/* read the back buffer into the movie; with buffer objects the read is
+ * asynchronous and the previous frame is queued while this one transfers */
+static void record_frame ()
+{
+  int w, h;
+
+  capture_sizes (AVI, &w, &h);
+
+#if VBO
+  if (!readback.buffer [0]) glGenBuffers (2, readback.buffer);
+
+  if (w != readback.width || h != readback.height)
+  {
+    record_pending ();
+
+    for (int i = 0; i < 2; i ++)
+    {
+      glBindBuffer (GL_PIXEL_PACK_BUFFER, readback.buffer [i]);
+      glBufferData (GL_PIXEL_PACK_BUFFER, rgb_row (w) * h, NULL, GL_STREAM_READ);
+    }
+
+    readback.width = w;
+    readback.height = h;
+  }
+
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, readback.buffer [readback.next]);
+  glReadPixels (0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+
+  record_pending ();
+
+  readback.pending = readback.next;
+  readback.next = !readback.next;
+#else
+  glReadPixels (0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, capture_buffer (AVI));
+  capture_submit (AVI);
+#endif
+}
+
+/* finish the movie */
+static void record_stop ()
+{
+  if (AVI)
+  {
+    record_pending ();
+    capture_close (AVI);
+    AVI = NULL;
+  }
+}
+
 /* draw main window */
 static void render3D ()
 {
@@ -636,15 +499,9 @@ static void render3D ()
     viewports [i].render ();
   }
 
-  glutSwapBuffers();
+  if (AVI) record_frame ();
 
-  if (AVI)
-  {
-    char *rgb = rgb_alloc (width, height);
-    glReadPixels (0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb);
-    avi_frame (AVI, rgb);
-    rgb_free (rgb);
-  }
+  glutSwapBuffers();
 
   if (viewportscount)
     reshape3D (width, height); /* restore main viewport projection */
@@ -949,8 +806,8 @@ static void avi (char *path)
   if (strcmp (&path[len-4], ".avi"))
   sprintf (&path [len], ".avi");
 
-  if (AVI) avi_close (AVI);
-  AVI = avi_open (width, height, 24, path);
+  record_stop ();
+  AVI = capture_open (width, height, 24, quality, AVI_QUEUE, path);
 }
 
 /* view menu */
@@ -1094,7 +951,7 @@ static void menu_export3D (int value)
     case MENU_EXPORT_AVI_STOP:
       glutSetMenu (export_menu);
       glutChangeToMenuEntry (1, "AVI START", MENU_EXPORT_AVI_START);
-      if (AVI) { avi_close (AVI); AVI = NULL; }
+      record_stop ();
       break;
     case MENU_EXPORT_BMP:
       viewer_read_text ("BMP FILE NAME", bmp);
@@ -1108,7 +965,7 @@ static void menu3D (int value)
   switch (value)
   {
     case MENU_QUIT:
-      if (AVI) avi_close (AVI);
+      record_stop ();
       if (user.quit)
 	user.quit ();
       exit (0);
@@ -1568,7 +1425,13 @@ void viewer_rectangle_off ()
 /* stop filming */
 void viewer_avi_stop ()
 {
-  if (AVI) { avi_close (AVI); AVI = NULL; }
+  record_stop ();
+}
+
+/* set AVI JPEG quality in 1..100 or zero for uncompressed frames */
+void viewer_avi_quality (int value)
+{
+  quality = MAX (0, MIN (value, 100));
 }
 
 /* set window title */
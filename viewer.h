@@ -119,6 +119,9 @@ void viewer_rectangle_off ();
 /* stop filming */
 void viewer_avi_stop ();
 
+/* set AVI JPEG quality in 1..100 or zero for uncompressed frames */
+void viewer_avi_quality (int value);
+
 /* set window title */
 void viewer_window_title (char *fmt, ...);
 